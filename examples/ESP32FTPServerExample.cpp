@@ -9,6 +9,13 @@ const char *password = "blablabla..."; //WiFi Password
 
 FtpServer ftpSrv; //set #define FTP_DEBUG in ESP32FtpServer.h to see ftp verbose on serial
 
+// "SITE UPTIME" answers with the seconds since boot
+uint16_t siteUptime(const char *pArgs, char *pText, size_t size, void *pContext)
+{
+    snprintf(pText, size, "Up for %lu s", millis() / 1000);
+    return 200;
+}
+
 void setup(void)
 {
     pinMode(21, OUTPUT); 
@@ -62,6 +69,10 @@ void setup(void)
         Serial.println("UNKNOWN");
     }
 
+    ftpSrv.addSiteCommand("UPTIME", siteUptime);
+    //ftpSrv.enableTransferTask();    //optional: move RETR/STOR data in its own task on core 0, independent of loop()
+    //ftpSrv.enableServerTask();      //optional: serve from its own task, woken by socket events instead of loop()
+    //ftpSrv.enableFileCache();       //optional: keep small, often retrieved files in PSRAM
     ftpSrv.begin("esp32","esp32");    //username, password for ftp.  set ports in ESP32FtpServer.h  (default 21, 50009 for PASV)
   }
 }
@@ -0,0 +1,400 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                 HOST ROUND TRIP TEST OF THE MODE Z STREAMS                 **
+ **                                                                            **
+ *******************************************************************************/
+
+// Checks FtpDeflater and FtpInflater against zlib, byte by byte:
+//
+//  - FtpDeflater -> zlib inflate, levels 0..9, for the FTP_DEFLATE_WINDOW_BITS
+//    the binary is built with (the Makefile builds 9..15)
+//  - zlib deflate -> FtpInflater, levels 0..9, windowBits 9..15 and the zlib
+//    strategies, so stored, fixed and dynamic Huffman blocks are all seen
+//
+// Input is handed over and output is taken in pieces of random size, down
+// to single bytes. Exits with 1 on the first mismatch.
+
+#include <Arduino.h>
+#include <FtpDeflate.h>
+
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+#define TEST_SEED 20240601
+
+
+struct TestInput
+{
+    const char *pName;
+    std::vector<uint8_t> data;
+};
+
+
+static uint32_t s_random = TEST_SEED;
+
+static uint32_t nextRandom()
+{
+    // xorshift32, the same sequence on every host
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 17;
+    s_random ^= s_random << 5;
+
+    return s_random;
+}
+
+
+// Piece size for the next call: mostly small, sometimes large, now and then 1
+static size_t pieceSize(size_t maxSize)
+{
+    uint32_t pick = nextRandom() % 8;
+    size_t size;
+
+    if (pick == 0)
+    {
+        size = 1;
+    }
+    else if (pick < 5)
+    {
+        size = 1 + nextRandom() % 300;
+    }
+    else
+    {
+        size = 1 + nextRandom() % 70000;
+    }
+
+    return (size < maxSize) ? size : maxSize;
+}
+
+
+static std::vector<TestInput> makeInputs()
+{
+    std::vector<TestInput> inputs;
+    static const char *s_words[] = { "drwxr-xr-x", "1", "owner", "group", "4096", "Jan", "17", "2024",
+                                     "-rw-r--r--", "file", ".txt", "\r\n", "music", "mp3", "0" };
+
+    inputs.push_back({ "empty", {} });
+    inputs.push_back({ "one byte", { 'x' } });
+
+    TestInput random = { "random", std::vector<uint8_t>(100000) };
+    for (uint8_t &value : random.data)
+    {
+        value = nextRandom() >> 24;
+    }
+    inputs.push_back(random);
+
+    // a directory listing is what MODE Z mostly carries
+    TestInput text = { "listing text", {} };
+    while (text.data.size() < 100000)
+    {
+        const char *pWord = s_words[nextRandom() % (sizeof(s_words) / sizeof(s_words[0]))];
+        text.data.insert(text.data.end(), pWord, pWord + strlen(pWord));
+        text.data.push_back(' ');
+    }
+    inputs.push_back(text);
+
+    inputs.push_back({ "zeros", std::vector<uint8_t>(100000, 0) });
+
+    // repeats at every distance up to the largest window, mixed with noise
+    TestInput mixed = { "repeats", {} };
+    while (mixed.data.size() < 150000)
+    {
+        size_t length = 3 + nextRandom() % 300;
+
+        if ((mixed.data.size() > 40000) && (nextRandom() % 2))
+        {
+            size_t distance = 1 + nextRandom() % 32768;
+            for (size_t i = 0; i < length; ++i)
+            {
+                mixed.data.push_back(mixed.data[mixed.data.size() - distance]);
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < length; ++i)
+            {
+                mixed.data.push_back(nextRandom() >> 28);
+            }
+        }
+    }
+    inputs.push_back(mixed);
+
+    return inputs;
+}
+
+
+// Type of the first deflate block behind the 2 bytes zlib header
+static int firstBlockType(const std::vector<uint8_t> &stream)
+{
+    return (stream.size() > 2) ? (stream[2] >> 1) & 3 : -1;
+}
+
+
+static bool zlibInflate(const std::vector<uint8_t> &stream, std::vector<uint8_t> &result)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+
+    // the window announced in the header must not be larger than the one used
+    if (inflateInit2(&z, FTP_DEFLATE_WINDOW_BITS) != Z_OK)
+    {
+        return false;
+    }
+
+    uint8_t out[65536];
+    int status = Z_OK;
+
+    z.next_in  = (Bytef *)stream.data();
+    z.avail_in = stream.size();
+
+    while (status == Z_OK)
+    {
+        z.next_out  = out;
+        z.avail_out = sizeof(out);
+        status = inflate(&z, Z_NO_FLUSH);
+        result.insert(result.end(), out, out + sizeof(out) - z.avail_out);
+    }
+
+    inflateEnd(&z);
+
+    return (status == Z_STREAM_END) && (z.avail_in == 0);
+}
+
+
+static bool zlibDeflate(const std::vector<uint8_t> &data, int level, int windowBits, int strategy,
+                        std::vector<uint8_t> &stream)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+
+    if (deflateInit2(&z, level, Z_DEFLATED, windowBits, 8, strategy) != Z_OK)
+    {
+        return false;
+    }
+
+    // for stored blocks with windowBits below 15 zlib's bound is 1 byte short
+    stream.resize(deflateBound(&z, data.size()) + 64);
+    z.next_in   = (Bytef *)data.data();
+    z.avail_in  = data.size();
+    z.next_out  = stream.data();
+    z.avail_out = stream.size();
+
+    int status = deflate(&z, Z_FINISH);
+    stream.resize(stream.size() - z.avail_out);
+    deflateEnd(&z);
+
+    return status == Z_STREAM_END;
+}
+
+
+static bool testDeflater(const TestInput &input, uint8_t level, int *pBlockType)
+{
+    FtpDeflater deflater;
+    std::vector<uint8_t> stream;
+    const uint8_t *pData;
+    size_t taken = 0;
+
+    if (!deflater.begin(level))
+    {
+        return false;
+    }
+
+    while (taken < input.data.size())
+    {
+        taken += deflater.write(input.data.data() + taken, pieceSize(input.data.size() - taken));
+
+        size_t length = deflater.output(&pData);
+        stream.insert(stream.end(), pData, pData + length);
+        deflater.drain();
+    }
+
+    bool finished;
+    do
+    {
+        finished = deflater.finish();
+
+        size_t length = deflater.output(&pData);
+        stream.insert(stream.end(), pData, pData + length);
+        deflater.drain();
+    } while (!finished);
+
+    deflater.end();
+
+    std::vector<uint8_t> result;
+    *pBlockType = firstBlockType(stream);
+
+    return zlibInflate(stream, result) && (result == input.data);
+}
+
+
+static bool testInflater(const TestInput &input, const std::vector<uint8_t> &stream)
+{
+    FtpInflater inflater;
+    std::vector<uint8_t> result;
+    std::vector<uint8_t> out(70000);
+    FtpInflater::Status status = FtpInflater::MORE;
+    size_t inPos = 0;
+    uint32_t stalls = 0;
+
+    inflater.begin();
+
+    while ((status == FtpInflater::MORE) && (stalls < 1000))
+    {
+        size_t consumed = 0;
+        size_t produced = 0;
+        size_t inLength = pieceSize(stream.size() - inPos);
+
+        status = inflater.inflate(stream.data() + inPos, inLength, &consumed,
+                                  out.data(), pieceSize(out.size()), &produced);
+
+        inPos += consumed;
+        result.insert(result.end(), out.begin(), out.begin() + produced);
+
+        // no progress with input left is a hang
+        stalls = ((consumed == 0) && (produced == 0)) ? stalls + 1 : 0;
+    }
+
+    inflater.end();
+
+    return (status == FtpInflater::DONE) && (inPos == stream.size()) && (result == input.data);
+}
+
+
+// A stream with a broken checksum must fail, not pass as complete
+static bool testCorrupt(const std::vector<uint8_t> &stream)
+{
+    std::vector<uint8_t> broken = stream;
+
+    if (broken.empty())
+    {
+        return false;
+    }
+    broken.back() ^= 1;
+
+    FtpInflater inflater;
+    std::vector<uint8_t> out(65536);
+    size_t inPos = 0;
+    FtpInflater::Status status = FtpInflater::MORE;
+
+    inflater.begin();
+
+    while ((status == FtpInflater::MORE) && (inPos < broken.size()))
+    {
+        size_t consumed = 0;
+        size_t produced = 0;
+
+        status = inflater.inflate(broken.data() + inPos, broken.size() - inPos, &consumed,
+                                  out.data(), out.size(), &produced);
+        inPos += consumed;
+    }
+
+    inflater.end();
+
+    return status == FtpInflater::FAILED;
+}
+
+
+int main()
+{
+    static const struct
+    {
+        int strategy;
+        const char *pName;
+    } s_strategies[] = {
+        { Z_DEFAULT_STRATEGY, "default" },
+        { Z_FILTERED, "filtered" },
+        { Z_HUFFMAN_ONLY, "huffman only" },
+        { Z_RLE, "rle" },
+        { Z_FIXED, "fixed" },
+    };
+
+    std::vector<TestInput> inputs = makeInputs();
+    uint32_t passed = 0;
+    uint32_t failed = 0;
+    uint32_t blockTypes[2][4] = { { 0 } };
+
+    for (uint8_t level = 0; level <= 9; ++level)
+    {
+        for (const TestInput &input : inputs)
+        {
+            int blockType = -1;
+
+            if (testDeflater(input, level, &blockType))
+            {
+                ++passed;
+                ++blockTypes[0][blockType & 3];
+            }
+            else
+            {
+                ++failed;
+                printf("FAIL deflater level %u window %u, %s\n", level, FTP_DEFLATE_WINDOW_BITS, input.pName);
+            }
+        }
+    }
+
+    for (int windowBits = 9; windowBits <= 15; ++windowBits)
+    {
+        for (int level = 0; level <= 9; ++level)
+        {
+            for (const auto &strategy : s_strategies)
+            {
+                // the strategy makes no difference to stored blocks
+                if ((level == 0) && (strategy.strategy != Z_DEFAULT_STRATEGY))
+                {
+                    continue;
+                }
+
+                for (const TestInput &input : inputs)
+                {
+                    std::vector<uint8_t> stream;
+
+                    if (zlibDeflate(input.data, level, windowBits, strategy.strategy, stream) &&
+                        testInflater(input, stream) && testCorrupt(stream))
+                    {
+                        ++passed;
+                        ++blockTypes[1][firstBlockType(stream) & 3];
+                    }
+                    else
+                    {
+                        ++failed;
+                        printf("FAIL inflater level %d window %d %s, %s\n", level, windowBits, strategy.pName,
+                               input.pName);
+                    }
+                }
+            }
+        }
+    }
+
+    printf("window %u: %u of %u passed, blocks deflater %u stored %u fixed, inflater %u stored %u fixed %u dynamic\n",
+           FTP_DEFLATE_WINDOW_BITS, passed, passed + failed, blockTypes[0][0], blockTypes[0][1], blockTypes[1][0],
+           blockTypes[1][1], blockTypes[1][2]);
+
+    // every block type must have been met, else the inputs above lost their purpose
+    bool covered = (blockTypes[0][0] > 0) && (blockTypes[0][1] > 0) &&
+                   (blockTypes[1][0] > 0) && (blockTypes[1][1] > 0) && (blockTypes[1][2] > 0);
+
+    if (!covered)
+    {
+        printf("FAIL not all block types were tested\n");
+    }
+
+    return ((failed == 0) && covered) ? 0 : 1;
+}
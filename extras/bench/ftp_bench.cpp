@@ -0,0 +1,745 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                    HOST BENCHMARK OF THE FTP SERVER                        **
+ **                                                                            **
+ *******************************************************************************/
+
+// Builds the server on Linux against the stand-ins in host/, runs it on the
+// loopback interface and drives it with a scripted client:
+//
+//  - round trip time of the control commands
+//  - RETR and STOR throughput of a payload file
+//  - LIST/MLSD time against the number of directory entries, first walk
+//    and second request (listing cache)
+//
+// The report is one JSON object on stdout, see the Makefile to run it for
+// several FTP_BUF_SIZE values.
+
+#include <Arduino.h>
+#include <ESP32FtpServer.h>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BENCH_USER "bench"
+#define BENCH_PASSWORD "bench"
+
+
+struct BenchOptions
+{
+    std::string root;               // directory served, a temporary one by default
+    bool keepRoot = false;
+    bool transferTask = false;      // pump the data from the transfer task
+    bool serverTask = false;        // run the server in its task, no handleFTP() loop
+    uint32_t payloadBytes = 16 << 20;
+    uint32_t repeat = 3;            // runs of every transfer
+    uint32_t commandRuns = 200;     // runs of every control command
+    std::vector<uint32_t> entries = { 10, 100, 1000, 10000, 50000 };
+};
+
+
+static double nowSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+
+    return values.empty() ? 0 : values[values.size() / 2];
+}
+
+
+static double percentile(std::vector<double> values, double share)
+{
+    std::sort(values.begin(), values.end());
+
+    return values.empty() ? 0 : values[(size_t)((values.size() - 1) * share)];
+}
+
+
+/**
+ * @brief Blocking FTP client, one control and one data connection
+ *
+ * */
+class BenchClient
+{
+public:
+    BenchClient() : m_control(-1), m_data(-1) {}
+    ~BenchClient() { closeData(); if (m_control >= 0) close(m_control); }
+
+    bool connectControl()
+    {
+        m_control = connectTo(FTP_CTRL_PORT);
+        return (m_control >= 0) && (readReply() == 220);
+    }
+
+    // Send a command, return the code of its reply
+    int command(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char line[512];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(line, sizeof(line) - 2, format, args);
+        va_end(args);
+
+        strcpy(line + length, "\r\n");
+        if (send(m_control, line, length + 2, MSG_NOSIGNAL) != length + 2)
+        {
+            return -1;
+        }
+
+        return readReply();
+    }
+
+    // Read a complete, maybe multi-line reply
+    int readReply()
+    {
+        std::string line;
+        m_replyText.clear();
+
+        if (!readLine(line))
+        {
+            return -1;
+        }
+
+        int code = atoi(line.c_str());
+        m_replyText = line;
+
+        // "123-" opens a multi-line reply, "123 " closes it
+        if ((line.size() > 3) && (line[3] == '-'))
+        {
+            char end[5];
+            snprintf(end, sizeof(end), "%03d ", code);
+
+            do
+            {
+                if (!readLine(line))
+                {
+                    return -1;
+                }
+                m_replyText += '\n' + line;
+            }
+            while (line.compare(0, 4, end) != 0);
+        }
+
+        return code;
+    }
+
+    // PASV and connect to the port it announced
+    bool openData()
+    {
+        closeData();
+
+        if (command("PASV") != 227)
+        {
+            return false;
+        }
+
+        unsigned values[6];
+        const char *p = strchr(m_replyText.c_str(), '(');
+
+        if ((p == NULL) || (sscanf(p, "(%u,%u,%u,%u,%u,%u)", &values[0], &values[1], &values[2],
+                                   &values[3], &values[4], &values[5]) != 6))
+        {
+            return false;
+        }
+
+        m_data = connectTo(values[4] * 256 + values[5]);
+        return m_data >= 0;
+    }
+
+    // Read the data connection until the server closed it
+    size_t readData()
+    {
+        static char s_buffer[65536];
+        size_t total = 0;
+        ssize_t nb;
+
+        while ((nb = recv(m_data, s_buffer, sizeof(s_buffer), 0)) > 0)
+        {
+            total += nb;
+        }
+
+        closeData();
+        return total;
+    }
+
+    bool writeData(const uint8_t *pData, size_t length)
+    {
+        size_t sent = 0;
+
+        while (sent < length)
+        {
+            ssize_t nb = send(m_data, pData + sent, length - sent, MSG_NOSIGNAL);
+
+            if (nb <= 0)
+            {
+                return false;
+            }
+            sent += nb;
+        }
+
+        closeData();
+        return true;
+    }
+
+    void closeData()
+    {
+        if (m_data >= 0)
+        {
+            close(m_data);
+            m_data = -1;
+        }
+    }
+
+    const std::string &replyText() { return m_replyText; }
+
+private:
+    static int connectTo(uint16_t port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port        = htons(port);
+
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        return fd;
+    }
+
+    bool readLine(std::string &line)
+    {
+        line.clear();
+
+        for (;;)
+        {
+            size_t end = m_rx.find("\r\n");
+
+            if (end != std::string::npos)
+            {
+                line = m_rx.substr(0, end);
+                m_rx.erase(0, end + 2);
+                return true;
+            }
+
+            char buffer[1024];
+            ssize_t nb = recv(m_control, buffer, sizeof(buffer), 0);
+
+            if (nb <= 0)
+            {
+                return false;
+            }
+            m_rx.append(buffer, nb);
+        }
+    }
+
+    int m_control;
+    int m_data;
+    std::string m_rx;         // received, not yet returned bytes of the control connection
+    std::string m_replyText;
+};
+
+
+// Round trip of every command, from sending it until the last reply line arrived
+static void benchCommands(BenchClient &client, const BenchOptions &options, FILE *pOut)
+{
+    static const char *s_commands[] =
+    {
+        "NOOP", "PWD", "TYPE I", "CWD /bench", "SIZE /bench/payload.bin", "MDTM /bench/payload.bin", "FEAT",
+    };
+
+    fprintf(pOut, "  \"commands\": [\n");
+
+    for (size_t i = 0; i < sizeof(s_commands) / sizeof(s_commands[0]); ++i)
+    {
+        std::vector<double> micros;
+
+        for (uint32_t run = 0; run < options.commandRuns; ++run)
+        {
+            double start = nowSeconds();
+            client.command("%s", s_commands[i]);
+            micros.push_back((nowSeconds() - start) * 1e6);
+        }
+
+        double sum = 0;
+        for (double value : micros)
+        {
+            sum += value;
+        }
+
+        fprintf(pOut, "    { \"command\": \"%s\", \"runs\": %u, \"mean_us\": %.1f, \"p50_us\": %.1f, "
+                      "\"p99_us\": %.1f, \"max_us\": %.1f }%s\n",
+                s_commands[i], options.commandRuns, sum / micros.size(), percentile(micros, 0.5),
+                percentile(micros, 0.99), percentile(micros, 1.0),
+                (i + 1 < sizeof(s_commands) / sizeof(s_commands[0])) ? "," : "");
+    }
+
+    fprintf(pOut, "  ],\n");
+}
+
+
+static void printThroughput(FILE *pOut, const char *pName, size_t bytes, const std::vector<double> &seconds)
+{
+    std::vector<double> rates;
+
+    for (double value : seconds)
+    {
+        rates.push_back((value > 0) ? bytes / value / 1e6 : 0);
+    }
+
+    fprintf(pOut, "  \"%s\": { \"bytes\": %zu, \"runs\": %zu, \"mbytes_per_s\": [", pName, bytes, rates.size());
+
+    for (size_t i = 0; i < rates.size(); ++i)
+    {
+        fprintf(pOut, "%s%.2f", i ? ", " : "", rates[i]);
+    }
+
+    fprintf(pOut, "], \"median_mbytes_per_s\": %.2f, \"best_mbytes_per_s\": %.2f },\n",
+            median(rates), rates.empty() ? 0 : *std::max_element(rates.begin(), rates.end()));
+}
+
+
+// Time from RETR until the data arrived completely and the server confirmed it
+static bool benchRetrieve(BenchClient &client, const BenchOptions &options, FILE *pOut)
+{
+    std::vector<double> seconds;
+
+    for (uint32_t run = 0; run < options.repeat; ++run)
+    {
+        if (!client.openData())
+        {
+            return false;
+        }
+
+        double start = nowSeconds();
+        int code = client.command("RETR /bench/payload.bin");
+        size_t received = client.readData();
+
+        if ((code != 150) || (client.readReply() != 226) || (received != options.payloadBytes))
+        {
+            fprintf(stderr, "RETR failed: %d, %zu bytes\n", code, received);
+            return false;
+        }
+        seconds.push_back(nowSeconds() - start);
+    }
+
+    printThroughput(pOut, "retr", options.payloadBytes, seconds);
+    return true;
+}
+
+
+static bool benchStore(BenchClient &client, const BenchOptions &options, const std::vector<uint8_t> &payload,
+                       FILE *pOut)
+{
+    std::vector<double> seconds;
+
+    for (uint32_t run = 0; run < options.repeat; ++run)
+    {
+        if (!client.openData())
+        {
+            return false;
+        }
+
+        double start = nowSeconds();
+        int code = client.command("STOR /bench/upload.bin");
+
+        if ((code != 150) || (!client.writeData(payload.data(), payload.size())) || (client.readReply() != 226))
+        {
+            fprintf(stderr, "STOR failed: %d\n", code);
+            return false;
+        }
+        seconds.push_back(nowSeconds() - start);
+    }
+
+    printThroughput(pOut, "stor", payload.size(), seconds);
+    return true;
+}
+
+
+// First request walks the directory, the second one may come from the listing cache
+static bool benchListings(BenchClient &client, const BenchOptions &options, FILE *pOut)
+{
+    static const char *s_formats[] = { "LIST", "MLSD" };
+
+    fprintf(pOut, "  \"listings\": [\n");
+
+    for (size_t i = 0; i < options.entries.size(); ++i)
+    {
+        if (client.command("CWD /bench/dir%u", options.entries[i]) != 250)
+        {
+            return false;
+        }
+
+        for (size_t f = 0; f < sizeof(s_formats) / sizeof(s_formats[0]); ++f)
+        {
+            double ms[2];
+            size_t bytes = 0;
+
+            for (int run = 0; run < 2; ++run)
+            {
+                if (!client.openData())
+                {
+                    return false;
+                }
+
+                double start = nowSeconds();
+                int code = client.command("%s", s_formats[f]);
+                bytes = client.readData();
+
+                if ((code != 150) || (client.readReply() != 226))
+                {
+                    fprintf(stderr, "%s failed: %d\n", s_formats[f], code);
+                    return false;
+                }
+                ms[run] = (nowSeconds() - start) * 1e3;
+            }
+
+            fprintf(pOut, "    { \"entries\": %u, \"format\": \"%s\", \"bytes\": %zu, \"first_ms\": %.2f, "
+                          "\"second_ms\": %.2f }%s\n",
+                    options.entries[i], s_formats[f], bytes, ms[0], ms[1],
+                    ((i + 1 < options.entries.size()) || (f + 1 < sizeof(s_formats) / sizeof(s_formats[0])))
+                        ? "," : "");
+        }
+    }
+
+    fprintf(pOut, "  ],\n");
+    return true;
+}
+
+
+static bool writeFile(const std::string &path, const uint8_t *pData, size_t length)
+{
+    FILE *pFile = fopen(path.c_str(), "wb");
+
+    if (pFile == NULL)
+    {
+        return false;
+    }
+
+    bool result = fwrite(pData, 1, length, pFile) == length;
+    fclose(pFile);
+
+    return result;
+}
+
+
+// Payload file and one directory per entry count
+static bool createTree(const BenchOptions &options, const std::vector<uint8_t> &payload)
+{
+    std::string bench = options.root + "/bench";
+    mkdir(bench.c_str(), 0755);
+
+    if (!writeFile(bench + "/payload.bin", payload.data(), payload.size()))
+    {
+        return false;
+    }
+
+    for (uint32_t count : options.entries)
+    {
+        char dir[64];
+        snprintf(dir, sizeof(dir), "/dir%u", count);
+        std::string path = bench + dir;
+
+        mkdir(path.c_str(), 0755);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "/file%06u.dat", i);
+
+            if (!writeFile(path + name, payload.data(), i % 1024))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+static void removeTree(const std::string &path)
+{
+    DIR *pDir = opendir(path.c_str());
+    struct dirent *pEntry;
+
+    while ((pDir) && ((pEntry = readdir(pDir)) != NULL))
+    {
+        if ((!strcmp(pEntry->d_name, ".")) || (!strcmp(pEntry->d_name, "..")))
+        {
+            continue;
+        }
+
+        std::string child = path + "/" + pEntry->d_name;
+
+        if (pEntry->d_type == DT_DIR)
+        {
+            removeTree(child);
+        }
+        else
+        {
+            unlink(child.c_str());
+        }
+    }
+
+    if (pDir)
+    {
+        closedir(pDir);
+    }
+    rmdir(path.c_str());
+}
+
+
+static void printServerMetrics(FtpServer &server, FILE *pOut)
+{
+    FtpMetrics metrics;
+    server.metrics(&metrics);
+
+    fprintf(pOut, "  \"server\": { \"transfers_completed\": %u, \"transfers_aborted\": %u, "
+                  "\"bytes_in\": %llu, \"bytes_out\": %llu, \"storage_ms\": %llu, \"network_ms\": %llu, "
+                  "\"avoided_writes\": %u, \"partial_writes\": %u, "
+                  "\"data_waits\": %u, \"max_data_wait_ms\": %.2f, \"list_cache_hits\": %u, "
+                  "\"list_cache_misses\": %u }\n",
+            metrics.transfersCompleted, metrics.transfersAborted,
+            (unsigned long long)metrics.bytesIn, (unsigned long long)metrics.bytesOut,
+            (unsigned long long)(metrics.storageMicros / 1000), (unsigned long long)(metrics.networkMicros / 1000),
+            metrics.avoidedWrites, metrics.partialWrites,
+            metrics.dataWaits, metrics.maxDataWaitMicros / 1000.0, server.listCacheHits(), server.listCacheMisses());
+}
+
+
+static void usage(const char *pName)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --root DIR          directory to serve, a temporary one by default\n"
+            "  --keep              keep the files created in the root\n"
+            "  --transfer-task     move the data in the transfer task instead of handleFTP()\n"
+            "  --server-task       run the server in its event driven task instead of handleFTP()\n"
+            "  --size-mb N         payload of RETR/STOR (16)\n"
+            "  --repeat N          runs of every transfer (3)\n"
+            "  --command-runs N    runs of every control command (200)\n"
+            "  --entries A,B,...   directory sizes listed (10,100,1000,10000,50000)\n",
+            pName);
+}
+
+
+static bool parseOptions(int argc, char **argv, BenchOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char *pValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (arg == "--keep")
+        {
+            options.keepRoot = true;
+        }
+        else if (arg == "--transfer-task")
+        {
+            options.transferTask = true;
+        }
+        else if (arg == "--server-task")
+        {
+            options.serverTask = true;
+        }
+        else if (pValue == NULL)
+        {
+            return false;
+        }
+        else if (arg == "--root")
+        {
+            options.root = pValue;
+            ++i;
+        }
+        else if (arg == "--size-mb")
+        {
+            options.payloadBytes = strtoul(pValue, NULL, 10) << 20;
+            ++i;
+        }
+        else if (arg == "--repeat")
+        {
+            options.repeat = strtoul(pValue, NULL, 10);
+            ++i;
+        }
+        else if (arg == "--command-runs")
+        {
+            options.commandRuns = strtoul(pValue, NULL, 10);
+            ++i;
+        }
+        else if (arg == "--entries")
+        {
+            options.entries.clear();
+
+            for (const char *p = pValue; *p; p += strspn(p, ","))
+            {
+                char *pEnd;
+                options.entries.push_back(strtoul(p, &pEnd, 10));
+                p = pEnd;
+            }
+            ++i;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return (options.repeat > 0) && (options.commandRuns > 0);
+}
+
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    bool temporaryRoot = options.root.empty();
+    if (temporaryRoot)
+    {
+        char root[] = "/tmp/ftp_bench.XXXXXX";
+        options.root = mkdtemp(root);
+    }
+
+    // not compressible, MODE Z stays out of the numbers
+    std::vector<uint8_t> payload(options.payloadBytes);
+    uint32_t seed = 12345;
+    for (uint8_t &value : payload)
+    {
+        seed = seed * 1103515245 + 12345;
+        value = seed >> 24;
+    }
+
+    fprintf(stderr, "Creating the file tree in %s\n", options.root.c_str());
+    if (!createTree(options, payload))
+    {
+        fprintf(stderr, "Could not create the file tree\n");
+        return 1;
+    }
+
+    fs::FS benchFs(options.root.c_str());
+    FtpServer server;
+
+    if (options.transferTask)
+    {
+        server.enableTransferTask();
+    }
+
+    if (options.serverTask)
+    {
+        server.enableServerTask();
+    }
+
+    if (!server.begin(BENCH_USER, BENCH_PASSWORD, benchFs, benchFs.root()))
+    {
+        fprintf(stderr, "Server did not start\n");
+        return 1;
+    }
+
+    // the loop() of the application, idle with the server task
+    std::atomic<bool> stop(options.serverTask);
+    std::thread loop([&server, &stop]()
+    {
+        while (!stop)
+        {
+            server.handleFTP();
+            yield();
+        }
+    });
+
+    BenchClient client;
+    bool result = client.connectControl()
+                  && (client.command("USER " BENCH_USER) == 331)
+                  && (client.command("PASS " BENCH_PASSWORD) == 230)
+                  && (client.command("TYPE I") == 200);
+
+    FILE *pOut = stdout;
+
+    if (result)
+    {
+        fprintf(pOut, "{\n");
+        fprintf(pOut, "  \"version\": \"%s\",\n", FTP_SERVER_VERSION);
+        fprintf(pOut, "  \"config\": { \"buf_size\": %u, \"retr_buffers\": %u, \"stor_ring_size\": %u, "
+                      "\"transfer_task\": %s, \"server_task\": %s },\n",
+                FTP_BUF_SIZE, FTP_RETR_BUFFERS, FTP_STOR_RING_SIZE, options.transferTask ? "true" : "false",
+                options.serverTask ? "true" : "false");
+
+        benchCommands(client, options, pOut);
+        result = benchRetrieve(client, options, pOut)
+                 && benchStore(client, options, payload, pOut)
+                 && benchListings(client, options, pOut);
+
+        printServerMetrics(server, pOut);
+        fprintf(pOut, "}\n");
+    }
+    else
+    {
+        fprintf(stderr, "Login failed: %s\n", client.replyText().c_str());
+    }
+
+    client.command("QUIT");
+
+    stop = true;
+    loop.join();
+
+    if (!options.keepRoot)
+    {
+        std::string root = options.root;
+        removeTree(temporaryRoot ? root : root + "/bench");
+    }
+
+    return result ? 0 : 1;
+}
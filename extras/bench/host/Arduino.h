@@ -0,0 +1,122 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **          ARDUINO CORE STAND-IN FOR THE HOST BENCHMARK (LINUX)              **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// 32 bit like on the ESP32, the library relies on the wrap-around
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// the library logs go to stderr with FTP_HOST_LOG, the benchmark output stays clean
+void hostLog(char level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_v(format, ...) hostLog('V', format, ##__VA_ARGS__)
+#define log_d(format, ...) hostLog('D', format, ##__VA_ARGS__)
+#define log_i(format, ...) hostLog('I', format, ##__VA_ARGS__)
+#define log_w(format, ...) hostLog('W', format, ##__VA_ARGS__)
+#define log_e(format, ...) hostLog('E', format, ##__VA_ARGS__)
+
+/**
+ * @brief The parts of the Arduino String the library uses
+ *
+ * */
+class String
+{
+public:
+    String(const char *pText = "") : m_text(pText ? pText : "") {}
+    String(const std::string &text) : m_text(text) {}
+
+    const char *c_str() const { return m_text.c_str(); }
+    unsigned int length() const { return m_text.length(); }
+
+    String &operator+=(const String &other) { m_text += other.m_text; return *this; }
+    bool operator==(const char *pText) const { return m_text == pText; }
+
+    friend String operator+(const String &a, const String &b) { return String(a.m_text + b.m_text); }
+
+private:
+    std::string m_text;
+};
+
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t *pData, size_t length);
+
+    size_t print(const char *pText) { return write((const uint8_t *)pText, strlen(pText)); }
+    size_t print(const String &text) { return print(text.c_str()); }
+    size_t println(const char *pText = "") { return print(pText) + print("\r\n"); }
+    size_t println(const String &text) { return println(text.c_str()); }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+/**
+ * @brief Serial output goes to stderr
+ *
+ * */
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) { (void)baud; }
+
+    size_t write(uint8_t value);
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,119 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **           FILE SYSTEM STAND-IN ON A POSIX DIRECTORY (HOST BENCHMARK)       **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <Arduino.h>
+
+#include <memory>
+#include <string>
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2,
+};
+
+struct FileImpl;
+typedef std::shared_ptr<FileImpl> FileImplPtr;
+
+/**
+ * @brief Open file or directory, copies share it like on the ESP32
+ *
+ * name() returns the full path below the root, as older cores did.
+ * */
+class File : public Stream
+{
+public:
+    File(FileImplPtr pImpl = FileImplPtr()) : m_pImpl(pImpl) {}
+
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t *pData, size_t length);
+    int available();
+    int read();
+    int peek();
+    size_t read(uint8_t *pData, size_t length);
+    size_t readBytes(char *pData, size_t length) { return read((uint8_t *)pData, length); }
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void flush() {}
+    void close();
+    operator bool() const { return m_pImpl != NULL; }
+
+    time_t getLastWrite();
+    const char *name() const;
+    const char *path() const { return name(); }
+    bool isDirectory();
+    File openNextFile(const char *mode = "r");
+    void rewindDirectory();
+
+private:
+    FileImplPtr m_pImpl;
+};
+
+/**
+ * @brief Paths are relative to a root directory of the host
+ *
+ * */
+class FS
+{
+public:
+    FS(const char *root) : m_root(root) {}
+
+    File open(const char *path, const char *mode = "r", const bool create = false);
+    File open(const String &path, const char *mode = "r", const bool create = false)
+    {
+        return open(path.c_str(), mode, create);
+    }
+
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *pathFrom, const char *pathTo);
+    bool rename(const String &pathFrom, const String &pathTo) { return rename(pathFrom.c_str(), pathTo.c_str()); }
+    bool mkdir(const char *path);
+    bool mkdir(const String &path) { return mkdir(path.c_str()); }
+    bool rmdir(const char *path);
+    bool rmdir(const String &path) { return rmdir(path.c_str()); }
+
+    const char *root() const { return m_root.c_str(); }
+    std::string hostPath(const char *path) const;
+
+private:
+    std::string m_root;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+
+#endif // HOST_FS_H
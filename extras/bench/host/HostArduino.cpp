@@ -0,0 +1,127 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include <sched.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+
+
+// the clock starts with the process, like the ESP32 clock with the boot
+static uint64_t hostMicros()
+{
+    static struct timespec s_start;
+    struct timespec now;
+
+    if ((s_start.tv_sec == 0) && (s_start.tv_nsec == 0))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &s_start);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - s_start.tv_sec) * 1000000 + (now.tv_nsec - s_start.tv_nsec) / 1000;
+}
+
+
+unsigned long millis()
+{
+    return (uint32_t)(hostMicros() / 1000);
+}
+
+
+unsigned long micros()
+{
+    return (uint32_t)hostMicros();
+}
+
+
+void delay(unsigned long ms)
+{
+    usleep(ms * 1000);
+}
+
+
+void yield()
+{
+    sched_yield();
+}
+
+
+void hostLog(char level, const char *format, ...)
+{
+#ifdef FTP_HOST_LOG
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[%c] ", level);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+#else
+    (void)level;
+    (void)format;
+#endif
+}
+
+
+size_t Print::write(const uint8_t *pData, size_t length)
+{
+    size_t written = 0;
+
+    while ((written < length) && (write(pData[written])))
+    {
+        ++written;
+    }
+
+    return written;
+}
+
+
+size_t HardwareSerial::write(uint8_t value)
+{
+    return fputc(value, stderr) == EOF ? 0 : 1;
+}
+
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+
+void heap_caps_free(void *pData)
+{
+    free(pData);
+}
+
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    (void)caps;
+    return 0;
+}
+
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    (void)caps;
+    return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <FS.h>
+#include <SD.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+fs::FS SD(".");
+
+namespace fs
+{
+
+struct FileImpl
+{
+    std::string path;      // below the root of the file system
+    std::string hostPath;
+    int fd = -1;           // files only
+    DIR *pDir = NULL;      // directories only
+
+    ~FileImpl()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+
+        if (pDir)
+        {
+            closedir(pDir);
+        }
+    }
+};
+
+
+std::string FS::hostPath(const char *path) const
+{
+    std::string result = m_root;
+
+    if ((path[0] != '/') && (!result.empty()))
+    {
+        result += '/';
+    }
+    result += path;
+
+    return result;
+}
+
+
+File FS::open(const char *path, const char *mode, const bool create)
+{
+    (void)create;
+
+    FileImplPtr pImpl = std::make_shared<FileImpl>();
+    pImpl->path     = path;
+    pImpl->hostPath = hostPath(path);
+
+    struct stat info;
+
+    if ((!strcmp(mode, "r")) && (stat(pImpl->hostPath.c_str(), &info) == 0) && (S_ISDIR(info.st_mode)))
+    {
+        pImpl->pDir = opendir(pImpl->hostPath.c_str());
+        return (pImpl->pDir) ? File(pImpl) : File();
+    }
+
+    int flags = O_RDONLY;
+
+    if (!strcmp(mode, "w"))
+    {
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    }
+    else if (!strcmp(mode, "a"))
+    {
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    }
+    else if (!strcmp(mode, "r+"))
+    {
+        flags = O_RDWR;
+    }
+
+    pImpl->fd = ::open(pImpl->hostPath.c_str(), flags, 0644);
+
+    return (pImpl->fd >= 0) ? File(pImpl) : File();
+}
+
+
+bool FS::exists(const char *path)
+{
+    struct stat info;
+
+    return stat(hostPath(path).c_str(), &info) == 0;
+}
+
+
+bool FS::remove(const char *path)
+{
+    return unlink(hostPath(path).c_str()) == 0;
+}
+
+
+bool FS::rename(const char *pathFrom, const char *pathTo)
+{
+    return ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()) == 0;
+}
+
+
+bool FS::mkdir(const char *path)
+{
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+
+bool FS::rmdir(const char *path)
+{
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+
+size_t File::write(const uint8_t *pData, size_t length)
+{
+    if ((!m_pImpl) || (m_pImpl->fd < 0))
+    {
+        return 0;
+    }
+
+    ssize_t written = ::write(m_pImpl->fd, pData, length);
+
+    return (written > 0) ? written : 0;
+}
+
+
+size_t File::read(uint8_t *pData, size_t length)
+{
+    if ((!m_pImpl) || (m_pImpl->fd < 0))
+    {
+        return 0;
+    }
+
+    ssize_t nb = ::read(m_pImpl->fd, pData, length);
+
+    return (nb > 0) ? nb : 0;
+}
+
+
+int File::read()
+{
+    uint8_t value;
+
+    return (read(&value, 1) == 1) ? value : -1;
+}
+
+
+int File::peek()
+{
+    int value = read();
+
+    if (value >= 0)
+    {
+        seek(-1, SeekCur);
+    }
+
+    return value;
+}
+
+
+int File::available()
+{
+    return size() - position();
+}
+
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+    if ((!m_pImpl) || (m_pImpl->fd < 0))
+    {
+        return false;
+    }
+
+    static const int s_whence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+    off_t offset = (mode == SeekCur) ? (off_t)(int32_t)pos : (off_t)pos;
+
+    return lseek(m_pImpl->fd, offset, s_whence[mode]) >= 0;
+}
+
+
+size_t File::position() const
+{
+    if ((!m_pImpl) || (m_pImpl->fd < 0))
+    {
+        return 0;
+    }
+
+    return lseek(m_pImpl->fd, 0, SEEK_CUR);
+}
+
+
+size_t File::size() const
+{
+    struct stat info;
+
+    if ((!m_pImpl) || (m_pImpl->pDir) || (fstat(m_pImpl->fd, &info) != 0))
+    {
+        return 0;
+    }
+
+    return info.st_size;
+}
+
+
+void File::close()
+{
+    m_pImpl.reset();
+}
+
+
+time_t File::getLastWrite()
+{
+    struct stat info;
+
+    if ((!m_pImpl) || (stat(m_pImpl->hostPath.c_str(), &info) != 0))
+    {
+        return 0;
+    }
+
+    return info.st_mtime;
+}
+
+
+const char *File::name() const
+{
+    return (m_pImpl) ? m_pImpl->path.c_str() : "";
+}
+
+
+bool File::isDirectory()
+{
+    return (m_pImpl) && (m_pImpl->pDir);
+}
+
+
+// Every entry is opened, as the ESP32 VFS does, so a listing pays the same per entry
+File File::openNextFile(const char *mode)
+{
+    (void)mode;
+
+    if ((!m_pImpl) || (!m_pImpl->pDir))
+    {
+        return File();
+    }
+
+    struct dirent *pEntry;
+
+    do
+    {
+        pEntry = readdir(m_pImpl->pDir);
+    }
+    while ((pEntry) && ((!strcmp(pEntry->d_name, ".")) || (!strcmp(pEntry->d_name, ".."))));
+
+    if (pEntry == NULL)
+    {
+        return File();
+    }
+
+    FileImplPtr pImpl = std::make_shared<FileImpl>();
+    pImpl->path = m_pImpl->path;
+
+    if ((pImpl->path.empty()) || (pImpl->path.back() != '/'))
+    {
+        pImpl->path += '/';
+    }
+    pImpl->path    += pEntry->d_name;
+    pImpl->hostPath = m_pImpl->hostPath + '/' + pEntry->d_name;
+
+    struct stat info;
+
+    if ((stat(pImpl->hostPath.c_str(), &info) == 0) && (S_ISDIR(info.st_mode)))
+    {
+        pImpl->pDir = opendir(pImpl->hostPath.c_str());
+    }
+    else
+    {
+        pImpl->fd = ::open(pImpl->hostPath.c_str(), O_RDONLY);
+    }
+
+    return File(pImpl);
+}
+
+
+void File::rewindDirectory()
+{
+    if ((m_pImpl) && (m_pImpl->pDir))
+    {
+        rewinddir(m_pImpl->pDir);
+    }
+}
+
+} // namespace fs
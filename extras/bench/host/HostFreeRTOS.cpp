@@ -0,0 +1,251 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include <sched.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+struct HostTask
+{
+    std::mutex mutex;
+    std::condition_variable notified;
+    uint32_t notifications = 0;
+};
+
+struct HostQueue
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<uint8_t> items; // ring of length items of itemSize bytes
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head = 0;       // next item to receive
+    UBaseType_t count = 0;
+};
+
+static thread_local HostTask *s_pCurrentTask = NULL;
+
+
+// Wait on cv until ready() holds, ticks is the timeout
+template <typename Ready>
+static bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t ticks, Ready ready)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        cv.wait(lock, ready);
+        return true;
+    }
+
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+
+void portENTER_CRITICAL(portMUX_TYPE *pMux)
+{
+    while (__atomic_test_and_set(&pMux->locked, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+}
+
+
+void portEXIT_CRITICAL(portMUX_TYPE *pMux)
+{
+    __atomic_clear(&pMux->locked, __ATOMIC_RELEASE);
+}
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *pName, uint32_t stackSize, void *pArg,
+                                   UBaseType_t priority, TaskHandle_t *pHandle, BaseType_t core)
+{
+    (void)pName;
+    (void)stackSize;
+    (void)priority;
+    (void)core;
+
+    HostTask *pTask = new HostTask();
+
+    // the handle is valid before the task runs, as in FreeRTOS
+    if (pHandle)
+    {
+        *pHandle = pTask;
+    }
+
+    std::thread([function, pArg, pTask]()
+    {
+        s_pCurrentTask = pTask;
+        function(pArg);
+        delete pTask;
+    }).detach();
+
+    return pdPASS;
+}
+
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *pName, uint32_t stackSize, void *pArg,
+                       UBaseType_t priority, TaskHandle_t *pHandle)
+{
+    return xTaskCreatePinnedToCore(function, pName, stackSize, pArg, priority, pHandle, tskNO_AFFINITY);
+}
+
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // only a task ending itself is supported, its thread returns right after this
+    (void)task;
+}
+
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+
+TickType_t xTaskGetTickCount()
+{
+    return millis();
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    std::lock_guard<std::mutex> lock(task->mutex);
+
+    ++task->notifications;
+    task->notified.notify_one();
+
+    return pdPASS;
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    HostTask *pTask = s_pCurrentTask;
+
+    if (pTask == NULL)
+    {
+        // not a task created here, nobody can notify it
+        vTaskDelay(ticks == portMAX_DELAY ? 0 : ticks);
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(pTask->mutex);
+    waitFor(pTask->notified, lock, ticks, [pTask]() { return pTask->notifications > 0; });
+
+    uint32_t value = pTask->notifications;
+
+    if (value > 0)
+    {
+        pTask->notifications = clear ? 0 : value - 1;
+    }
+
+    return value;
+}
+
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    HostQueue *pQueue = new HostQueue();
+
+    pQueue->length   = length;
+    pQueue->itemSize = itemSize;
+    pQueue->items.resize(length * itemSize);
+
+    return pQueue;
+}
+
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
+
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *pItem, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    if (!waitFor(queue->changed, lock, ticks, [queue]() { return queue->count < queue->length; }))
+    {
+        return pdFALSE;
+    }
+
+    UBaseType_t index = (queue->head + queue->count) % queue->length;
+
+    if (queue->itemSize > 0)
+    {
+        memcpy(&queue->items[index * queue->itemSize], pItem, queue->itemSize);
+    }
+    ++queue->count;
+    queue->changed.notify_all();
+
+    return pdTRUE;
+}
+
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *pItem, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    if (!waitFor(queue->changed, lock, ticks, [queue]() { return queue->count > 0; }))
+    {
+        return pdFALSE;
+    }
+
+    if (queue->itemSize > 0)
+    {
+        memcpy(pItem, &queue->items[queue->head * queue->itemSize], queue->itemSize);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    --queue->count;
+    queue->changed.notify_all();
+
+    return pdTRUE;
+}
+
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+
+    return queue->count;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return xQueueCreate(1, 0);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    SemaphoreHandle_t semaphore = xQueueCreate(1, 0);
+
+    // a mutex starts available
+    xQueueSend(semaphore, NULL, 0);
+
+    return semaphore;
+}
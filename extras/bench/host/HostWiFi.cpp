@@ -0,0 +1,313 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <WiFi.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HOST_READ_TIMEOUT 1000 // ms readBytes() waits, the Stream default
+
+WiFiClass WiFi;
+
+struct HostSocket
+{
+    int fd;
+
+    explicit HostSocket(int socketFd) : fd(socketFd) {}
+
+    ~HostSocket()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+};
+
+
+WiFiClient::WiFiClient(int fd):
+    m_pSocket(std::make_shared<HostSocket>(fd))
+{
+    // no Nagle delay on loopback, the round trips measure the server alone
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+
+size_t WiFiClient::write(const uint8_t *pData, size_t length)
+{
+    size_t sent = 0;
+
+    while ((m_pSocket) && (sent < length))
+    {
+        ssize_t nb = send(m_pSocket->fd, pData + sent, length - sent, MSG_NOSIGNAL);
+
+        if (nb > 0)
+        {
+            sent += nb;
+        }
+        else if ((nb < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+        {
+            struct pollfd pfd = { m_pSocket->fd, POLLOUT, 0 };
+            poll(&pfd, 1, HOST_READ_TIMEOUT);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+
+int WiFiClient::available()
+{
+    int count = 0;
+
+    if ((!m_pSocket) || (ioctl(m_pSocket->fd, FIONREAD, &count) != 0))
+    {
+        return 0;
+    }
+
+    return count;
+}
+
+
+int WiFiClient::read(uint8_t *pData, size_t length)
+{
+    if (!m_pSocket)
+    {
+        return -1;
+    }
+
+    ssize_t nb = recv(m_pSocket->fd, pData, length, MSG_DONTWAIT);
+
+    return (nb > 0) ? nb : -1;
+}
+
+
+int WiFiClient::read()
+{
+    uint8_t value;
+
+    return (read(&value, 1) == 1) ? value : -1;
+}
+
+
+int WiFiClient::peek()
+{
+    uint8_t value;
+
+    if ((!m_pSocket) || (recv(m_pSocket->fd, &value, 1, MSG_DONTWAIT | MSG_PEEK) != 1))
+    {
+        return -1;
+    }
+
+    return value;
+}
+
+
+size_t WiFiClient::readBytes(uint8_t *pData, size_t length)
+{
+    size_t received = 0;
+    uint32_t start  = millis();
+
+    while ((m_pSocket) && (received < length) && (millis() - start < HOST_READ_TIMEOUT))
+    {
+        struct pollfd pfd = { m_pSocket->fd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, HOST_READ_TIMEOUT) <= 0)
+        {
+            break;
+        }
+
+        ssize_t nb = recv(m_pSocket->fd, pData + received, length - received, MSG_DONTWAIT);
+
+        if (nb <= 0)
+        {
+            break;
+        }
+        received += nb;
+    }
+
+    return received;
+}
+
+
+void WiFiClient::stop()
+{
+    m_pSocket.reset();
+}
+
+
+// Connected until the peer closed and everything it sent was read
+uint8_t WiFiClient::connected()
+{
+    if (!m_pSocket)
+    {
+        return false;
+    }
+
+    uint8_t value;
+    ssize_t nb = recv(m_pSocket->fd, &value, 1, MSG_DONTWAIT | MSG_PEEK);
+
+    if ((nb > 0) || ((nb < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))))
+    {
+        return true;
+    }
+
+    m_pSocket.reset();
+    return false;
+}
+
+
+// Address of one end of the connection, 0.0.0.0 once closed
+static IPAddress socketAddress(int fd, bool peer)
+{
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+
+    int rc = peer ? getpeername(fd, (struct sockaddr *)&address, &length)
+                  : getsockname(fd, (struct sockaddr *)&address, &length);
+
+    if ((rc != 0) || (address.sin_family != AF_INET))
+    {
+        return IPAddress();
+    }
+
+    uint32_t ip = ntohl(address.sin_addr.s_addr);
+
+    return IPAddress(ip >> 24, (ip >> 16) & 255, (ip >> 8) & 255, ip & 255);
+}
+
+
+IPAddress WiFiClient::remoteIP()
+{
+    return m_pSocket ? socketAddress(m_pSocket->fd, true) : IPAddress();
+}
+
+
+IPAddress WiFiClient::localIP()
+{
+    return m_pSocket ? socketAddress(m_pSocket->fd, false) : IPAddress();
+}
+
+
+int WiFiClient::fd() const
+{
+    return m_pSocket ? m_pSocket->fd : -1;
+}
+
+
+WiFiServer::WiFiServer(uint16_t port, uint8_t maxClients):
+    m_port(port),
+    m_maxClients(maxClients),
+    m_fd(-1),
+    m_acceptedFd(-1)
+{
+
+}
+
+
+WiFiServer::~WiFiServer()
+{
+    end();
+}
+
+
+void WiFiServer::begin(uint16_t port)
+{
+    if (port)
+    {
+        m_port = port;
+    }
+
+    end();
+
+    m_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    int one = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(m_port);
+
+    if ((bind(m_fd, (struct sockaddr *)&address, sizeof(address)) != 0) || (listen(m_fd, m_maxClients) != 0))
+    {
+        log_e("Port %u can't be opened: %s", m_port, strerror(errno));
+        end();
+        return;
+    }
+
+    fcntl(m_fd, F_SETFL, O_NONBLOCK);
+}
+
+
+bool WiFiServer::hasClient()
+{
+    if ((m_acceptedFd < 0) && (m_fd >= 0))
+    {
+        m_acceptedFd = accept(m_fd, NULL, NULL);
+    }
+
+    return m_acceptedFd >= 0;
+}
+
+
+WiFiClient WiFiServer::available()
+{
+    if (!hasClient())
+    {
+        return WiFiClient();
+    }
+
+    int fd = m_acceptedFd;
+    m_acceptedFd = -1;
+
+    // the listener is non-blocking, the connection must block like on the ESP32
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    return WiFiClient(fd);
+}
+
+
+void WiFiServer::end()
+{
+    if (m_acceptedFd >= 0)
+    {
+        ::close(m_acceptedFd);
+        m_acceptedFd = -1;
+    }
+
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
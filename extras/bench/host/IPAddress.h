@@ -0,0 +1,48 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_IPADDRESS_H
+#define HOST_IPADDRESS_H
+
+#include <stdint.h>
+
+class IPAddress
+{
+public:
+    IPAddress() : IPAddress(0, 0, 0, 0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        m_bytes[0] = a;
+        m_bytes[1] = b;
+        m_bytes[2] = c;
+        m_bytes[3] = d;
+    }
+
+    uint8_t operator[](int index) const { return m_bytes[index]; }
+    uint8_t &operator[](int index) { return m_bytes[index]; }
+
+    bool operator==(const IPAddress &other) const
+    {
+        return (m_bytes[0] == other.m_bytes[0]) && (m_bytes[1] == other.m_bytes[1]) &&
+               (m_bytes[2] == other.m_bytes[2]) && (m_bytes[3] == other.m_bytes[3]);
+    }
+
+private:
+    uint8_t m_bytes[4];
+};
+
+#endif // HOST_IPADDRESS_H
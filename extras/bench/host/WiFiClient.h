@@ -0,0 +1,68 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **              WIFI STAND-IN ON LOOPBACK SOCKETS (HOST BENCHMARK)            **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef HOST_WIFICLIENT_H
+#define HOST_WIFICLIENT_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#include <memory>
+
+struct HostSocket;
+
+/**
+ * @brief TCP connection, copies share the socket like on the ESP32
+ *
+ * write() blocks until everything is sent, read() never waits and
+ * readBytes() waits up to a second, as the ESP32 client does.
+ * */
+class WiFiClient : public Stream
+{
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd);
+
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t *pData, size_t length);
+    int available();
+    int read();
+    int read(uint8_t *pData, size_t length);
+    int peek();
+    size_t readBytes(uint8_t *pData, size_t length);
+    size_t readBytes(char *pData, size_t length) { return readBytes((uint8_t *)pData, length); }
+    void flush() {}
+    void stop();
+
+    uint8_t connected();
+    operator bool() { return connected(); }
+
+    IPAddress remoteIP();
+    IPAddress localIP();
+    int fd() const;
+
+private:
+    std::shared_ptr<HostSocket> m_pSocket;
+};
+
+#endif // HOST_WIFICLIENT_H
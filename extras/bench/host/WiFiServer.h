@@ -0,0 +1,47 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_WIFISERVER_H
+#define HOST_WIFISERVER_H
+
+#include <WiFiClient.h>
+
+/**
+ * @brief Listening socket on all interfaces, never blocks
+ *
+ * */
+class WiFiServer
+{
+public:
+    WiFiServer(uint16_t port = 80, uint8_t maxClients = 4);
+    ~WiFiServer();
+
+    void begin(uint16_t port = 0);
+    bool hasClient();
+    WiFiClient available();
+    void end();
+
+    operator bool() { return m_fd >= 0; }
+
+private:
+    uint16_t m_port;
+    uint8_t m_maxClients;
+    int m_fd;
+    int m_acceptedFd; // taken by hasClient(), handed out by available()
+};
+
+#endif // HOST_WIFISERVER_H
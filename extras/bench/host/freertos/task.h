@@ -0,0 +1,39 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *pArg);
+
+// a task is a detached thread, priority, core and stack size are ignored
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *pName, uint32_t stackSize, void *pArg,
+                                   UBaseType_t priority, TaskHandle_t *pHandle, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t function, const char *pName, uint32_t stackSize, void *pArg,
+                       UBaseType_t priority, TaskHandle_t *pHandle);
+
+// vTaskDelete(NULL) must be the last statement of the task, the thread ends when the function returns
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif // HOST_FREERTOS_TASK_H
@@ -25,50 +25,97 @@
 
 #include <WiFi.h>
 #include <WiFiClient.h>
+#include <stdarg.h>
+#include <utime.h>
+#include <unistd.h>
+#include <esp_heap_caps.h>
 
 
 #define FTP_DEBUG
 
+static_assert(FTP_LIST_FLUSH_SIZE >= FTP_LIST_SEGMENT, "FTP_BUF_SIZE too small to stage a listing segment");
+
 
 FtpServer::FtpServer():
-    m_pCommandServer(NULL),
-    m_pDataServer(NULL)
+    m_siteCount(0),
+    m_transferRate(FTP_RATE_LIMIT_TRANSFER),
+    m_rateBurst(FTP_RATE_BURST),
+    m_storageBlock(FTP_STOR_CHUNK),
+    m_pasvFirst(FTP_DATA_PORT_PASV),
+    m_pasvCount(FTP_DATA_PORT_COUNT),
+    m_pasvNext(0),
+    m_useTransferTask(false),
+    m_taskCore(FTP_TASK_CORE),
+    m_taskPriority(FTP_TASK_PRIORITY),
+    m_taskStackSize(FTP_TASK_STACK_SIZE),
+    m_transferTask(NULL),
+    m_stopTransferTask(false),
+    m_useServerTask(false),
+    m_serverTaskCore(FTP_SERVER_TASK_CORE),
+    m_serverTaskPriority(FTP_SERVER_TASK_PRIORITY),
+    m_serverTaskStackSize(FTP_SERVER_TASK_STACK_SIZE),
+    m_serverTask(NULL),
+    m_stopServerTask(false),
+    m_serverResult(0),
+    m_fs(NULL),
+    m_nextSession(0)
 {
+    for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
+    {
+        m_pSessions[i] = NULL;
+    }
+
+    m_rateLimiter.setRate(FTP_RATE_LIMIT, FTP_RATE_BURST);
 
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    m_metricsMux = unlocked;
+    memset(&m_metrics, 0, sizeof(m_metrics));
 }
 
 
 FtpServer::~FtpServer()
 {
-    if (m_pCommandServer) 
+    // the server task leaves its loop within FTP_EVENT_MAX_WAIT
+    if (m_serverTask)
+    {
+        m_stopServerTask = true;
+
+        while (m_serverTask)
+        {
+            vTaskDelay(1);
+        }
+    }
+
+    // let the transfer task leave its loop before the sessions go away
+    if (m_transferTask)
     {
-        delete m_pCommandServer;
-        m_pCommandServer = NULL;
+        m_stopTransferTask = true;
+        wakeTransferTask();
+
+        while (m_transferTask)
+        {
+            vTaskDelay(1);
+        }
     }
 
-    if (m_pDataServer) 
+    for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
     {
-        delete m_pDataServer;
-        m_pDataServer = NULL;
+        if (m_pSessions[i])
+        {
+            delete m_pSessions[i];
+            m_pSessions[i] = NULL;
+        }
     }
+
+    m_hashIndex.flush(true);
 }
 
 
-bool FtpServer::begin(String uname, String pword, fs::FS &fs)
+bool FtpServer::begin(String uname, String pword, fs::FS &fs, const char *mountPoint)
 {
     bool result = false;
 
-    if (m_pDataServer == NULL)
-    {
-        m_pDataServer = new WiFiServer(FTP_DATA_PORT_PASV);
-    }
-
-    if (m_pCommandServer == NULL)
-    {
-        m_pCommandServer = new WiFiServer(FTP_CTRL_PORT);
-    }
-
-    if ((m_pCommandServer) && (m_pDataServer))
+    if ((m_commandListener) || (m_commandListener.begin(FTP_CTRL_PORT)))
     {
         // Tells the ftp server to begin listening for incoming connection
         m_User      = uname;
@@ -76,1000 +123,4101 @@ bool FtpServer::begin(String uname, String pword, fs::FS &fs)
 
         // tell the server where the files come from
         m_fs = &fs; 
+        m_mountPoint = mountPoint;
 
-        m_pCommandServer->begin();
-        delay(10);
-
-        m_pDataServer->begin();
-        delay(10);
+        m_listCache.begin();
+        m_hashIndex.begin(fs);
+        m_fileCache.begin(fs);
 
         millisTimeOut = (uint32_t)FTP_TIME_OUT * 60 * 1000;
-        millisDelay = 0;
-        cmdStatus = CmdStatus::DISCONNECT;
-        iniVariables();
 
         result = true;
+
+        for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
+        {
+            if (m_pSessions[i] == NULL)
+            {
+                m_pSessions[i] = new FtpSession(*this, i);
+            }
+
+            if ((m_pSessions[i] == NULL) || (!m_pSessions[i]->begin()))
+            {
+                log_e("Ftp session %u could not be started", i);
+                result = false;
+            }
+        }
+
+        if ((result) && (m_useTransferTask) && (m_transferTask == NULL))
+        {
+            m_stopTransferTask = false;
+
+            if (xTaskCreatePinnedToCore(transferTask, "ftpTransfer", m_taskStackSize, this,
+                                        m_taskPriority, &m_transferTask, m_taskCore) != pdPASS)
+            {
+                log_e("Ftp transfer task could not be started, transfers run in handleFTP()");
+                m_transferTask = NULL;
+            }
+        }
+
+        if ((result) && (m_useServerTask) && (m_serverTask == NULL))
+        {
+            m_stopServerTask = false;
+
+            if (xTaskCreatePinnedToCore(serverTask, "ftpServer", m_serverTaskStackSize, this,
+                                        m_serverTaskPriority, &m_serverTask, m_serverTaskCore) != pdPASS)
+            {
+                log_e("Ftp server task could not be started, call handleFTP() from loop()");
+                m_serverTask = NULL;
+            }
+        }
     }
 
     return result;
 }
 
 
-void FtpServer::iniVariables()
+void FtpServer::enableTransferTask(BaseType_t core, UBaseType_t priority, uint32_t stackSize)
 {
-  // Default for data port
-  dataPort = FTP_DATA_PORT_PASV;
-  
-  // Default Data connection is Active
-  dataPassiveConn = true;
-  
-  // Set the root directory
-  strcpy(cwdName, "/" );
-
-  rnfrCmd = false;
-  transferStatus = 0;
+    m_useTransferTask = true;
+    m_taskCore        = core;
+    m_taskPriority    = priority;
+    m_taskStackSize   = stackSize;
 }
 
 
-int FtpServer::handleFTP()
+void FtpServer::wakeTransferTask()
 {
-    //
-    if((int32_t) ( millisDelay - millis() ) > 0 )
+    if (m_transferTask)
     {
-        return 0;
+        xTaskNotifyGive(m_transferTask);
     }
+}
 
-    // allow only one connection at a time
-    if ((m_pCommandServer) && (m_pCommandServer->hasClient())) 
-    {
-        client.stop();
-	    client = m_pCommandServer->available();
-    }
-  
-    if( cmdStatus == CmdStatus::DISCONNECT )
-    {
-        if( client.connected())
-        {
-            disconnectClient();
-        }
-        cmdStatus = CmdStatus::PREPARATION;
-    }
-    else if( cmdStatus == CmdStatus::PREPARATION )                      // cancel all existing connections
-    {
-        abortTransfer();
-        iniVariables();
 
-	    log_i("Ftp server waiting for connection on port %u", FTP_CTRL_PORT);
-        
-        cmdStatus = CmdStatus::IDLE;
-    }
-    else if( cmdStatus == CmdStatus::IDLE )                             // FTP server idle
-    {   		
-        if( client.connected() )                                        // A client connected
-        {
-            clientConnected();      
-            millisEndConnection = millis() + 10 * 1000 ;                // wait client id during 10 s.
-            cmdStatus = CmdStatus::STANDBY;
+void FtpServer::transferTask(void *pArg)
+{
+    FtpServer *pServer = (FtpServer *)pArg;
 
-            log_d("Client connected!");
-        }
-    }
-    else if( readChar() > 0 )                                           // got response
+    while (!pServer->m_stopTransferTask)
     {
-        if( cmdStatus == CmdStatus::STANDBY )            // Ftp server waiting for user identity
-        {
-            if( userIdentity() )
-            {
-                cmdStatus = CmdStatus::AUTHENTICATE;
-            }
-            else
-            {
-                cmdStatus = CmdStatus::DISCONNECT;
-            }
-        }
-        else if( cmdStatus == CmdStatus::AUTHENTICATE )       // Ftp server waiting for user registration
+        bool active   = false;
+        bool progress = false;
+
+        for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
         {
-            if( userPassword() )
-            {
-                cmdStatus = CmdStatus::READY;
-                millisEndConnection = millis() + millisTimeOut;
-            }
-            else
+            FtpSession *pSession = pServer->m_pSessions[i];
+
+            if ((pSession) && (pSession->transferStep(&progress)))
             {
-                cmdStatus = CmdStatus::DISCONNECT;
+                active = true;
             }
         }
-        else if( cmdStatus == CmdStatus::READY )       // Ftp server waiting for user command
-        {
-            if( ! processCommand())
-            {
-                cmdStatus = CmdStatus::DISCONNECT;
-            }
-            else
-            {
-                millisEndConnection = millis() + millisTimeOut;
-            }
-        }  
-    }
-    else if (!client.connected() || !client)
-    {
-	    cmdStatus = CmdStatus::PREPARATION;
-        
-        log_d("client disconnected");   
-    }
 
-    if( transferStatus == 1 )         // Retrieve data
-    {
-        if( ! doRetrieve())
+        if (!active)
         {
-            transferStatus = 0;
+            // sleep until a RETR/STOR starts
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FTP_TASK_IDLE_WAIT));
         }
-    }
-    else if( transferStatus == 2 )    // Store data
-    {
-        if( ! doStore())
+        else if (!progress)
         {
-            transferStatus = 0;
+            // waiting for the network, give the other tasks on this core a chance
+            vTaskDelay(1);
         }
     }
-    else if( cmdStatus > CmdStatus::STANDBY && ! ((int32_t) ( millisEndConnection - millis() ) > 0 ))
-    {
-	    client.println("530 Timeout");
-        millisDelay = millis() + 200;    // delay of 200 ms
-        cmdStatus = CmdStatus::DISCONNECT;
-    }
 
-    return    transferStatus!=0
-           || cmdStatus     != CmdStatus::DISCONNECT;
+    pServer->m_transferTask = NULL;
+    vTaskDelete(NULL);
 }
 
 
-void FtpServer::clientConnected()
+void FtpServer::enableServerTask(BaseType_t core, UBaseType_t priority, uint32_t stackSize)
 {
-    log_d("Client connected!");
-  
-    client.println( "220--- Welcome to FTP for ESP32 ---");
-    client.println( "220---   By EnRav   ---");
-    client.println( "220 --   Version " + String(FTP_SERVER_VERSION) + "   --");
-    iCL = 0;
+    m_useServerTask       = true;
+    m_serverTaskCore      = core;
+    m_serverTaskPriority  = priority;
+    m_serverTaskStackSize = stackSize;
 }
 
 
-void FtpServer::disconnectClient()
+// Run the server without handleFTP()
+//
+// Sleeps in select() on the listeners and the connections of all sessions,
+// a round of serviceSessions() only runs when one of them is ready or a
+// timeout of a session is due.
+void FtpServer::serverTask(void *pArg)
 {
-    log_i(" Disconnecting client");
+    FtpServer *pServer = (FtpServer *)pArg;
+    FtpEventSet events;
 
-    abortTransfer();
-    client.println("221 Goodbye");
-    client.stop();
-}
+    while (!pServer->m_stopServerTask)
+    {
+        pServer->m_serverResult = pServer->serviceSessions();
 
-boolean FtpServer::userIdentity()
-{	
-    log_d("User cmd \"%s\" data \"%s\"", command, parameters);
+        events.clear();
+        events.addRead(pServer->m_commandListener.fd());
+        events.wakeIn(FTP_EVENT_MAX_WAIT);
 
-    if( strcmp( command, "USER" ))
-    {
-        client.println( "500 Syntax error");
-    }
-    else if( strcmp( parameters, m_User.c_str() ))
-    {
-        client.println( "530 user not found");
+        for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
+        {
+            if (pServer->m_pSessions[i])
+            {
+                pServer->m_pSessions[i]->addEvents(events);
+            }
+        }
+
+        events.wait();
     }
-    else
+
+    pServer->m_serverTask = NULL;
+    vTaskDelete(NULL);
+}
+
+
+int FtpServer::handleFTP()
+{
+    // the server task does the work, kept for sketches calling it from loop()
+    if (m_serverTask)
     {
-        client.println( "331 OK. Password required");
-        strcpy( cwdName, "/" );
-        return true;
+        return m_serverResult;
     }
 
-    millisDelay = millis() + 100;  // delay of 100 ms
-    return false;
+    return serviceSessions();
 }
 
-boolean FtpServer::userPassword()
+
+int FtpServer::serviceSessions()
 {
-    log_d("User cmd \"%s\" data \"%s\"", command, parameters);
+    int result = 0;
 
-    if( strcmp( command, "PASS" ))
-    {
-        client.println( "500 Syntax error");
-    }
-    else if( strcmp( parameters, m_Password.c_str() ))
+    if (m_commandListener.hasClient())
     {
-        client.println( "530 ");
+        acceptClient();
     }
-    else
+
+    // service all sessions, starting with a different one on every call
+    for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
     {
-        log_d( "OK. Waiting for commands.");    
-        client.println( "230 OK.");
-        return true;
-    }
+        FtpSession *pSession = m_pSessions[(m_nextSession + i) % FTP_MAX_SESSIONS];
 
-    millisDelay = millis() + 100;  // delay of 100 ms
-    return false;
-}
+        if ((pSession) && (pSession->handleFTP()))
+        {
+            result = 1;
+        }
+    }
+    m_nextSession = (m_nextSession + 1) % FTP_MAX_SESSIONS;
 
+    // the index changes of the last uploads go to the file system together
+    m_hashIndex.flush();
 
-uint8_t FtpServer::isConnected() 
-{
-    return client.connected();
+    return result;
 }
 
-boolean FtpServer::processCommand()
+
+void FtpServer::acceptClient()
 {
-    ///////////////////////////////////////
-    //                                   //
-    //      ACCESS CONTROL COMMANDS      //
-    //                                   //
-    ///////////////////////////////////////
+    bool pending = false;
 
-    log_d("cmd \"%s\"", command);
+    // a new login is only handed to an idle session, a running one is never taken over
+    for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
+    {
+        FtpSession *pSession = m_pSessions[i];
 
-    //
-    //  CDUP - Change to Parent Directory 
-    //
-    if( ! strcmp( command, "CDUP" ))
-    {   
-        //if we are not in the root directory
-        if (strcmp(cwdName, "/"))
+        if (pSession == NULL)
         {
-            uint32_t length = strlen(cwdName);
-
-            while((length) && (cwdName[length] != '/'))
-            {
-                --length;
-            }
+            continue;
+        }
 
-            if (length)
-            {
-                cwdName[length] = '\0';
-            }
-            else
-            {
-                cwdName[length+1] = '\0';
-            }
-            
+        if (pSession->isFree())
+        {
+            pSession->attach(m_commandListener.available());
+            log_d("Client accepted by session %u", i);
+            return;
         }
 
-        log_d("CWD \"%s\"", cwdName);
+        if (pSession->isReleasing())
+        {
+            pending = true;
+        }
+    }
 
-	    client.println("250 Ok. Current directory is \"" + String(cwdName) + "\"");
+    // a session becomes free within the next calls, leave the client in the backlog
+    if (!pending)
+    {
+        WiFiClient rejected = m_commandListener.available();
+        rejected.println("421 Too many users, try again later");
+        rejected.stop();
+        log_w("Client rejected, all %u sessions busy", FTP_MAX_SESSIONS);
     }
+}
 
-    //
-    //  CWD - Change Working Directory
-    //
-    else if( ! strcmp( command, "CWD" ))
+
+bool FtpServer::addMappedFile(const char *path, const char *label, size_t length)
+{
+    for (uint8_t i = 0; i < FTP_MAX_MAPPED_FILES; ++i)
     {
-        if( strcmp( parameters, "." ) == 0 )  // 'CWD .' is the same as PWD command
+        if (!m_mapped[i].file.isMapped())
         {
-            client.println( "257 \"" + String(cwdName) + "\" is your current directory");
-        }
-        else 
-        {      
-            log_d("CWD P=%s CWD=%s", parameters, cwdName);
-    
-            String dir;
-
-            if (parameters[0]=='/')
+            if (!m_mapped[i].file.map(label, length))
             {
-                dir = parameters;
+                log_e("Partition \"%s\" could not be mapped", label);
+                return false;
             }
-            else if (!strcmp(cwdName,"/"))
-            {
-                dir = String("/") + parameters;
-            }
-            else
-            {
-                dir = String(cwdName) + "/" + parameters;
-            }        
 
-            if (m_fs->exists(dir)) 
-            {
-                strcpy(cwdName, dir.c_str());
-                client.println( "250 CWD Ok. Current directory is \"" + String(dir) + "\"");
-                log_i("250 CWD Ok. Current directory is \"%s\"", dir.c_str());
-            }
-            else
-            {
-                client.println( "550 directory or file does not exist \"" + String(parameters) + "\"");
-                log_i( "550 directory or file does not exist \"%s\"", parameters);
-            }
+            m_mapped[i].path = path;
+            log_i("Partition \"%s\" served as %s (%lu bytes)", label, path, (unsigned long)m_mapped[i].file.size());
+            return true;
         }
-    
     }
 
-    //
-    //  PWD - Print Directory
-    //
-    else if( ! strcmp( command, "PWD" ))
-    {
-        client.println( "257 \"" + String(cwdName) + "\" is your current directory");
-    }
+    log_e("No free slot for mapped file %s", path);
+    return false;
+}
 
-    //
-    //  QUIT
-    //
-    else if( ! strcmp( command, "QUIT" ))
+
+bool FtpServer::addSiteCommand(const char *name, FtpSiteCallback callback, void *pContext)
+{
+    if ((m_siteCount >= FTP_MAX_SITE_COMMANDS) || (strlen(name) >= FTP_SITE_NAME_SIZE) || (callback == NULL))
     {
-        disconnectClient();
+        log_e("SITE %s can't be added", name);
         return false;
     }
 
-  ///////////////////////////////////////
-  //                                   //
-  //    TRANSFER PARAMETER COMMANDS    //
-  //                                   //
-  ///////////////////////////////////////
+    SiteEntry &entry = m_siteCommands[m_siteCount++];
+    strcpy(entry.name, name);
+    entry.callback = callback;
+    entry.pContext = pContext;
 
-    //
-    //  MODE - Transfer Mode 
-    //
-    else if( ! strcmp( command, "MODE" ))
+    return true;
+}
+
+
+void FtpServer::setRateLimit(uint32_t rate, uint32_t transferRate, uint32_t burst)
+{
+    m_transferRate = transferRate;
+    m_rateBurst    = burst;
+
+    m_rateLimiter.setRate(rate, burst);
+
+    for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
     {
-        if( ! strcmp( parameters, "S" ))
-        {
-            client.println( "200 S Ok");  
-        // else if( ! strcmp( parameters, "B" ))
-        //  client.println( "200 B Ok\r\n";
-        }
-        else
+        if (m_pSessions[i])
         {
-        client.println( "504 Only S(tream) is suported");
+            m_pSessions[i]->setRateLimit(transferRate, burst);
         }
     }
 
-    //
-    //  PASV - Passive Connection management
-    //
-    else if( ! strcmp( command, "PASV" ))
-    {
-        if (data.connected())
-        {
-            data.stop();
-        }
-    	dataIp = WiFi.localIP();	
-	    dataPort = FTP_DATA_PORT_PASV;
+    log_i("Rate limit %u bytes/s, %u bytes/s per transfer, burst %u bytes", rate, transferRate, burst);
+}
 
-    	log_i("Connection management set to passive");
-        log_i( "Data port set to %u", dataPort);
-   
-        client.println( "227 Entering Passive Mode ("+ String(dataIp[0]) + "," + String(dataIp[1])+","+ String(dataIp[2])+","+ String(dataIp[3])+","+String( dataPort >> 8 ) +","+String ( dataPort & 255 )+").");
-        dataPassiveConn = true;
-    }
 
-    //
-    //  PORT - Data Port
-    //
-    else if( ! strcmp( command, "PORT" ))
-    {
-	    if (data)
-        {
-            data.stop();
-        }
-    
-        // get IP of data client
-        dataIp[ 0 ] = atoi( parameters );
-        char * p = strchr( parameters, ',' );
-        for( uint8_t i = 1; i < 4; i ++ )
-        {
-            dataIp[ i ] = atoi( ++ p );
-            p = strchr( p, ',' );
-        }
+void FtpServer::metrics(FtpMetrics *pMetrics)
+{
+    portENTER_CRITICAL(&m_metricsMux);
+    *pMetrics = m_metrics;
+    portEXIT_CRITICAL(&m_metricsMux);
 
-        // get port of data client
-        dataPort = 256 * atoi( ++ p );
-        p = strchr( p, ',' );
-        dataPort += atoi( ++ p );
-        if( p == NULL )
+    pMetrics->freeHeap    = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    pMetrics->minFreeHeap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+}
+
+
+void FtpServer::resetMetrics()
+{
+    portENTER_CRITICAL(&m_metricsMux);
+    memset(&m_metrics, 0, sizeof(m_metrics));
+    portEXIT_CRITICAL(&m_metricsMux);
+}
+
+
+bool FtpServer::setStorageBlockSize(size_t blockSize)
+{
+    // the ring holds whole blocks and wraps on a block boundary
+    if ((blockSize < 512) || (blockSize & (blockSize - 1)) ||
+        ((FTP_STOR_RING_SIZE > 0) && (FTP_STOR_RING_SIZE % blockSize != 0)))
+    {
+        log_e("Storage block size %lu not supported", (unsigned long)blockSize);
+        return false;
+    }
+
+    m_storageBlock = blockSize;
+    return true;
+}
+
+
+void FtpServer::enableFileCache(size_t size, size_t maxFileSize)
+{
+    m_fileCache.setLimits(size, maxFileSize);
+}
+
+
+bool FtpServer::setPassivePorts(uint16_t first, uint16_t count)
+{
+    if ((first == 0) || (count < FTP_MAX_SESSIONS) || ((uint32_t)first + count - 1 > 65535))
+    {
+        log_e("Passive port range %u+%u not supported", first, count);
+        return false;
+    }
+
+    m_pasvFirst = first;
+    m_pasvCount = count;
+    m_pasvNext  = 0;
+    return true;
+}
+
+
+// Next port of the passive range, skipping the ones other sessions listen on
+//
+// Rotating through the range keeps a port unused for a while after its
+// transfer, late or repeated connections to it are refused instead of
+// becoming the data connection of the next command.
+//
+// return:
+//    port for the listener of pSession, 0 if all ports are taken
+uint16_t FtpServer::allocatePassivePort(const FtpSession *pSession)
+{
+    for (uint16_t i = 0; i < m_pasvCount; ++i)
+    {
+        uint16_t port = m_pasvFirst + m_pasvNext;
+        bool used     = false;
+
+        m_pasvNext = (m_pasvNext + 1) % m_pasvCount;
+
+        for (uint8_t j = 0; j < FTP_MAX_SESSIONS; ++j)
+        {
+            if ((m_pSessions[j]) && (m_pSessions[j] != pSession) && (m_pSessions[j]->passivePort() == port))
+            {
+                used = true;
+            }
+        }
+
+        if (!used)
+        {
+            return port;
+        }
+    }
+
+    return 0;
+}
+
+
+// Count a command of the command table, index is its position there
+void FtpServer::recordCommand(uint8_t index, uint32_t key, uint32_t micros)
+{
+    if (index >= FTP_METRICS_COMMANDS)
+    {
+        return;
+    }
+
+    // decade of the handling time, from < 100 us up
+    uint8_t bucket = 0;
+    for (uint32_t limit = 100; (micros >= limit) && (bucket < FTP_METRICS_LATENCY_BUCKETS - 1); limit *= 10)
+    {
+        ++bucket;
+    }
+
+    portENTER_CRITICAL(&m_metricsMux);
+
+    FtpCommandMetrics &command = m_metrics.commands[index];
+
+    if (command.name[0] == 0)
+    {
+        // the key holds the letters of the command, the first one in the highest used byte
+        uint8_t length = 0;
+        for (int8_t shift = 24; shift >= 0; shift -= 8)
+        {
+            if ((length > 0) || ((key >> shift) & 0xFF))
+            {
+                command.name[length++] = (key >> shift) & 0xFF;
+            }
+        }
+        command.name[length] = 0;
+    }
+
+    ++command.count;
+    command.totalMicros += micros;
+    ++command.latency[bucket];
+
+    if (micros > command.maxMicros)
+    {
+        command.maxMicros = micros;
+    }
+
+    if (index >= m_metrics.commandCount)
+    {
+        m_metrics.commandCount = index + 1;
+    }
+
+    portEXIT_CRITICAL(&m_metricsMux);
+}
+
+
+void FtpServer::recordStoreWrites(uint32_t avoidedWrites, uint32_t partialWrites)
+{
+    portENTER_CRITICAL(&m_metricsMux);
+    m_metrics.avoidedWrites += avoidedWrites;
+    m_metrics.partialWrites += partialWrites;
+    portEXIT_CRITICAL(&m_metricsMux);
+}
+
+
+void FtpServer::recordUnknownCommand()
+{
+    portENTER_CRITICAL(&m_metricsMux);
+    ++m_metrics.unknownCommands;
+    portEXIT_CRITICAL(&m_metricsMux);
+}
+
+
+void FtpServer::recordRefusedData()
+{
+    portENTER_CRITICAL(&m_metricsMux);
+    ++m_metrics.dataRefused;
+    portEXIT_CRITICAL(&m_metricsMux);
+}
+
+
+void FtpServer::recordDataWait(uint32_t micros, bool connected)
+{
+    portENTER_CRITICAL(&m_metricsMux);
+
+    ++m_metrics.dataWaits;
+    m_metrics.dataWaitMicros += micros;
+
+    if (micros > m_metrics.maxDataWaitMicros)
+    {
+        m_metrics.maxDataWaitMicros = micros;
+    }
+
+    if (!connected)
+    {
+        ++m_metrics.dataTimeouts;
+    }
+
+    portEXIT_CRITICAL(&m_metricsMux);
+}
+
+
+void FtpServer::recordTransfer(bool upload, bool completed, uint32_t bytes, uint32_t storageMicros, uint32_t networkMicros)
+{
+    portENTER_CRITICAL(&m_metricsMux);
+
+    if (upload)
+    {
+        m_metrics.bytesIn += bytes;
+    }
+    else
+    {
+        m_metrics.bytesOut += bytes;
+    }
+
+    if (completed)
+    {
+        ++m_metrics.transfersCompleted;
+    }
+    else
+    {
+        ++m_metrics.transfersAborted;
+    }
+
+    m_metrics.storageMicros += storageMicros;
+    m_metrics.networkMicros += networkMicros;
+
+    portEXIT_CRITICAL(&m_metricsMux);
+}
+
+
+const FtpMappedFile *FtpServer::findMappedFile(const char *path)
+{
+    for (uint8_t i = 0; i < FTP_MAX_MAPPED_FILES; ++i)
+    {
+        if ((m_mapped[i].file.isMapped()) && (!strcmp(m_mapped[i].path.c_str(), path)))
+        {
+            return &m_mapped[i].file;
+        }
+    }
+
+    return NULL;
+}
+
+
+// A session is writing path, a copy taken now would be incomplete
+bool FtpServer::isWriting(const char *path)
+{
+    for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
+    {
+        if ((m_pSessions[i]) && (m_pSessions[i]->isWriting(path)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+uint8_t FtpServer::isConnected() 
+{
+    uint8_t connected = 0;
+
+    for (uint8_t i = 0; i < FTP_MAX_SESSIONS; ++i)
+    {
+        if ((m_pSessions[i]) && (m_pSessions[i]->isConnected()))
+        {
+            ++connected;
+        }
+    }
+
+    return connected;
+}
+
+
+FtpSession::FtpSession(FtpServer &server, uint8_t id):
+    m_server(server),
+    m_id(id),
+    m_fs(server.m_fs),
+    m_pasvPort(0),
+    iCL(0),
+    m_rxLength(0),
+    m_rxPos(0),
+    m_restartOffset(0),
+    m_storeOffset(0),
+    m_eventBytes(0),
+    m_retrBlockPos(0),
+    m_pMappedData(NULL),
+    m_mappedSize(0),
+    m_mappedPos(0),
+    m_pCachedData(NULL),
+    m_pCopyBuffer(NULL),
+    m_copySize(0),
+    m_copyProgress(0),
+    m_pListCapture(NULL),
+    m_listCaptureLength(0),
+    m_listCapturing(false),
+    m_listLength(0),
+    m_modeZ(false),
+    m_zLevel(FTP_DEFLATE_LEVEL),
+    m_zInPos(0),
+    m_zInLength(0),
+    m_zFailed(false),
+    m_compressedBytes(0),
+    m_hashAlgorithm(FTP_HASH_ALGORITHM),
+    m_hashStart(0),
+    m_hashEnd(0),
+    m_hashReply(false),
+    m_hashWhole(false),
+    m_storeCrc(0),
+    m_storeWhole(false),
+    m_replyLength(0),
+    cmdStatus(CmdStatus::DISCONNECT),
+    transferStatus(0),
+    millisDelay(0)
+{
+    m_lock = xSemaphoreCreateMutex();
+}
+
+
+FtpSession::~FtpSession()
+{
+    free(m_pListCapture);
+
+    if (m_lock)
+    {
+        vSemaphoreDelete(m_lock);
+        m_lock = NULL;
+    }
+}
+
+
+bool FtpSession::begin()
+{
+    if (m_lock == NULL)
+    {
+        return false;
+    }
+
+    m_fs = m_server.m_fs;
+    m_rateLimiter.setRate(m_server.m_transferRate, m_server.m_rateBurst);
+
+    millisDelay = 0;
+    cmdStatus = CmdStatus::DISCONNECT;
+    iniVariables();
+
+    return true;
+}
+
+
+bool FtpSession::isFree()
+{
+    return (cmdStatus == CmdStatus::IDLE) && (!client.connected());
+}
+
+
+bool FtpSession::isReleasing()
+{
+    return cmdStatus < CmdStatus::IDLE;
+}
+
+
+void FtpSession::attach(const WiFiClient &newClient)
+{
+    client = newClient;
+}
+
+
+void FtpSession::setRateLimit(uint32_t rate, uint32_t burst)
+{
+    m_rateLimiter.setRate(rate, burst);
+}
+
+
+void FtpSession::iniVariables()
+{
+  // Default for data port
+  dataPort = FTP_DATA_PORT_PASV + m_id;
+  
+  // Default Data connection is Active
+  dataPassiveConn = true;
+  
+  // Set the root directory
+  strcpy(cwdName, "/" );
+
+  rnfrCmd = false;
+  cpfrCmd = false;
+  m_fromPath[ 0 ] = 0;
+  transferStatus = 0;
+
+  dataArmed = false;
+  dataPending = false;
+  dataRetry = false;
+  m_epsvAll = false;
+  closePassive();
+
+  iCL = 0;
+  m_rxLength = 0;
+  m_rxPos = 0;
+
+  m_restartOffset = 0;
+  m_storeOffset = 0;
+
+  m_modeZ = false;
+  m_zLevel = FTP_DEFLATE_LEVEL;
+  m_hashAlgorithm = FTP_HASH_ALGORITHM;
+}
+
+
+int FtpSession::handleFTP()
+{
+    //
+    if((int32_t) ( millisDelay - millis() ) > 0 )
+    {
+        return 0;
+    }
+
+    // the transfer task must not touch the session while a command runs
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    if( cmdStatus == CmdStatus::DISCONNECT )
+    {
+        if( client.connected())
+        {
+            disconnectClient();
+        }
+        cmdStatus = CmdStatus::PREPARATION;
+    }
+    else if( cmdStatus == CmdStatus::PREPARATION )                      // cancel all existing connections
+    {
+        abortTransfer();
+        iniVariables();
+        client.stop();
+
+	    log_i("Ftp session %u waiting for connection on port %u", m_id, FTP_CTRL_PORT);
+        
+        cmdStatus = CmdStatus::IDLE;
+    }
+    else if( cmdStatus == CmdStatus::IDLE )                             // FTP server idle
+    {   		
+        if( client.connected() )                                        // A client connected
+        {
+            clientConnected();      
+            millisEndConnection = millis() + 10 * 1000 ;                // wait client id during 10 s.
+            cmdStatus = CmdStatus::STANDBY;
+
+            log_d("Client connected!");
+        }
+    }
+    else if( dataPending )                                              // command waits for its data connection
+    {
+        if( !client.connected() )
+        {
+            cmdStatus = CmdStatus::PREPARATION;
+        }
+        else if( dataConnect() || ! ((int32_t) ( millisDataTimeOut - millis() ) > 0 ))
+        {
+            m_server.recordDataWait( micros() - m_dataWaitStart, data.connected() );
+
+            // complete the command, it answers 425 itself if the client never connected
+            dataPending = false;
+            dataRetry = true;
+
+            if( ! processCommand())
+            {
+                cmdStatus = CmdStatus::DISCONNECT;
+            }
+            else
+            {
+                millisEndConnection = millis() + m_server.millisTimeOut;
+            }
+
+            dataRetry = false;
+
+            // commands pipelined behind it run right away
+            processCommands();
+        }
+    }
+    else if(( m_rxPos < m_rxLength ) || client.available())            // got response
+    {
+        processCommands();
+    }
+    else if (!client.connected() || !client)
+    {
+	    cmdStatus = CmdStatus::PREPARATION;
+        
+        log_d("client disconnected");   
+    }
+
+    // accept the data connection right after PASV, even before the command needing it
+    if( dataArmed && cmdStatus == CmdStatus::READY )
+    {
+        dataConnect();
+    }
+
+    if( transferStatus != 0 )
+    {
+        if( m_server.m_transferTask )     // data is moved by the transfer task
+        {
+            m_server.wakeTransferTask();
+        }
+        else
+        {
+            pumpTransfer();
+        }
+    }
+    else if( cmdStatus > CmdStatus::STANDBY && ! ((int32_t) ( millisEndConnection - millis() ) > 0 ))
+    {
+	    reply( 530, "Timeout" );
+        millisDelay = millis() + 200;    // delay of 200 ms
+        cmdStatus = CmdStatus::DISCONNECT;
+    }
+
+    int result =    transferStatus!=0
+                 || cmdStatus     != CmdStatus::DISCONNECT;
+
+    xSemaphoreGive(m_lock);
+
+    return result;
+}
+
+
+// Run every complete command received so far, in order
+//
+// Stops at a command waiting for its data connection, its checksum or its
+// copy, the commands behind it stay in the receive buffer until it completed.
+// Only ABOR and QUIT get past a checksum or copy.
+void FtpSession::processCommands()
+{
+    while(( cmdStatus != CmdStatus::DISCONNECT ) && ( ! dataPending ) && ( transferStatus < 3 ))
+    {
+        int8_t rc = readLine();
+
+        if( rc == -1 )
+        {
+            break;
+        }
+
+        if( rc > 0 )
+        {
+            // USER and PASS move the state on to READY
+            if( ! processCommand())
+            {
+                cmdStatus = CmdStatus::DISCONNECT;
+            }
+            else if( cmdStatus == CmdStatus::READY )
+            {
+                millisEndConnection = millis() + m_server.millisTimeOut;
+            }
+        }
+    }
+
+    if(( cmdStatus != CmdStatus::DISCONNECT ) && ( transferStatus >= 3 ))
+    {
+        processUrgentCommand();
+    }
+}
+
+
+// Run an ABOR or QUIT waiting behind a checksum or copy right away
+//
+// The other commands stay in the receive buffer, in order. Bytes still in
+// the socket are appended behind them, as far as the buffer holds them.
+void FtpSession::processUrgentCommand()
+{
+    if( m_rxPos > 0 )
+    {
+        memmove( m_rx, m_rx + m_rxPos, m_rxLength - m_rxPos );
+        m_rxLength -= m_rxPos;
+        m_rxPos = 0;
+    }
+
+    if(( m_rxLength < sizeof( m_rx )) && client.available())
+    {
+        int nb = client.read( (uint8_t *) m_rx + m_rxLength, sizeof( m_rx ) - m_rxLength );
+
+        if( nb > 0 )
+        {
+            m_rxLength += nb;
+        }
+    }
+
+    uint16_t start = 0;
+
+    // the first line completes a command already partly parsed
+    if( iCL > 0 )
+    {
+        char *pEnd = (char *) memchr( m_rx, '\n', m_rxLength );
+        start = ( pEnd != NULL ) ? pEnd - m_rx + 1 : m_rxLength;
+    }
+
+    while( start < m_rxLength )
+    {
+        char *pEnd = (char *) memchr( m_rx + start, '\n', m_rxLength - start );
+
+        if( pEnd == NULL )
+        {
+            break;
+        }
+
+        uint16_t end = pEnd - m_rx + 1;
+        uint16_t pos = start;
+
+        // clients may put Telnet IP and Synch in front of ABOR
+        while(( pos < end ) && ((uint8_t) m_rx[ pos ] >= 0x80 ))
+        {
+            ++pos;
+        }
+
+        uint16_t length = end - pos;
+        while(( length > 0 ) && (( m_rx[ pos + length - 1 ] == '\n' ) || ( m_rx[ pos + length - 1 ] == '\r' ) ||
+                                 ( m_rx[ pos + length - 1 ] == ' ' )))
+        {
+            --length;
+        }
+
+        boolean abor = ( length == 4 ) && ! strncasecmp( m_rx + pos, "ABOR", 4 );
+        boolean quit = ( length == 4 ) && ! strncasecmp( m_rx + pos, "QUIT", 4 );
+
+        if( abor || quit )
+        {
+            memmove( m_rx + start, m_rx + end, m_rxLength - end );
+            m_rxLength -= end - start;
+
+            log_d( "cmd \"%s\" while the storage is busy", abor ? "ABOR" : "QUIT" );
+
+            if( abor )
+            {
+                cmdAbor();
+                millisEndConnection = millis() + m_server.millisTimeOut;
+            }
+            else if( ! cmdQuit())
+            {
+                cmdStatus = CmdStatus::DISCONNECT;
+            }
+            return;
+        }
+
+        start = end;
+    }
+}
+
+
+boolean FtpSession::pumpTransfer()
+{
+    if( transferStatus == 1 )         // Retrieve data
+    {
+        if( ! doRetrieve())
+        {
+            transferStatus = 0;
+        }
+    }
+    else if( transferStatus == 2 )    // Store data
+    {
+        if( ! doStore())
+        {
+            transferStatus = 0;
+        }
+    }
+    else if( transferStatus == 3 )    // Checksum of a file
+    {
+        if( ! doHash())
+        {
+            transferStatus = 0;
+        }
+    }
+    else if( transferStatus == 4 )    // Copy of a file
+    {
+        if( ! doCopy())
+        {
+            transferStatus = 0;
+        }
+    }
+
+    return transferStatus != 0;
+}
+
+
+bool FtpSession::transferStep(bool *pProgress)
+{
+    if( transferStatus == 0 )
+    {
+        return false;
+    }
+
+    // a command is being processed, try again on the next round
+    if( xSemaphoreTake(m_lock, 0) != pdTRUE )
+    {
+        return true;
+    }
+
+    uint32_t before = bytesTransferred;
+    bool active = pumpTransfer();
+
+    if( bytesTransferred != before )
+    {
+        *pProgress = true;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return active;
+}
+
+
+// Add what ends the wait of the server task for this session
+//
+// The control connection and the passive listener wake it when ready, the
+// timeouts of the session when due. A transfer moved by the server task
+// waits for its data connection while it makes progress, else it is
+// retried after FTP_EVENT_TRANSFER_WAIT, the storage pipelines and the
+// rate limiter move on without socket events.
+void FtpSession::addEvents(FtpEventSet &events)
+{
+    uint32_t now = millis();
+
+    // leaving a connection and pipelined commands take rounds without socket events
+    if(( cmdStatus < CmdStatus::IDLE ) || (( cmdStatus == CmdStatus::IDLE ) && client.connected()) ||
+       (( m_rxPos < m_rxLength ) && ( transferStatus < 3 )))
+    {
+        events.wakeIn( 0 );
+        return;
+    }
+
+    // checksums and copies only wait for the storage, every round moves them on
+    if(( transferStatus >= 3 ) && ( m_server.m_transferTask == NULL ))
+    {
+        events.wakeIn( 0 );
+        return;
+    }
+
+    events.addRead( client.fd());
+
+    if( m_pasvPort != 0 )
+    {
+        events.addRead( m_dataListener.fd());
+    }
+
+    if( transferStatus >= 3 )
+    {
+        // run by the transfer task, the commands behind it follow soon after it ended
+        events.wakeIn( FTP_EVENT_TRANSFER_WAIT );
+    }
+    else if(( transferStatus != 0 ) && ( m_server.m_transferTask == NULL ))
+    {
+        if( bytesTransferred != m_eventBytes )
+        {
+            if( transferStatus == 1 )
+            {
+                events.addWrite( data.fd());
+            }
+            else
+            {
+                events.addRead( data.fd());
+            }
+        }
+
+        m_eventBytes = bytesTransferred;
+        events.wakeIn( FTP_EVENT_TRANSFER_WAIT );
+    }
+
+    if(( int32_t )( millisDelay - now ) > 0 )
+    {
+        events.wakeIn( millisDelay - now );
+    }
+
+    if( dataPending )
+    {
+        events.wakeIn((( int32_t )( millisDataTimeOut - now ) > 0 ) ? millisDataTimeOut - now : 0 );
+    }
+
+    if( cmdStatus >= CmdStatus::STANDBY )
+    {
+        events.wakeIn((( int32_t )( millisEndConnection - now ) > 0 ) ? millisEndConnection - now : 0 );
+    }
+}
+
+
+void FtpSession::clientConnected()
+{
+    log_d("Client connected!");
+  
+    replyPart( 220, "-- Welcome to FTP for ESP32 ---" );
+    replyPart( 220, "--   By EnRav   ---" );
+    reply( 220, "--   Version %s   --", FTP_SERVER_VERSION );
+}
+
+
+void FtpSession::disconnectClient()
+{
+    log_i(" Disconnecting client");
+
+    abortTransfer();
+    reply( 221, "Goodbye" );
+    client.stop();
+
+    // the next client may never list
+    free( m_pListCapture );
+    m_pListCapture = NULL;
+}
+
+uint8_t FtpSession::isConnected() 
+{
+    return client.connected();
+}
+
+// Command flags of the dispatch table
+#define FTP_CMD_AUTH  0x01  // only after a successful login
+#define FTP_CMD_DATA  0x02  // result goes over the data connection, wait for it
+#define FTP_CMD_PARAM 0x04  // fails without a parameter
+#define FTP_CMD_SUFFIX 0x08 // name may be longer than its key, e.g. XSHA256
+
+// Pack a command of up to 4 characters into 32 bit, readChar() builds the same key
+// from the first 4 characters of longer names
+static constexpr uint32_t ftpCommandKey(const char *pName, uint32_t key = 0)
+{
+    return (*pName) ? ftpCommandKey(pName + 1, (key << 8) | (uint8_t)*pName) : key;
+}
+
+template <typename T, size_t N>
+static constexpr bool ftpKeysSorted(const T (&table)[N], size_t i = 1)
+{
+    return (i >= N) || ((table[i - 1].key < table[i].key) && ftpKeysSorted(table, i + 1));
+}
+
+struct FtpSession::Command
+{
+    uint32_t key;
+    uint8_t flags;
+    boolean (FtpSession::*handler)();
+};
+
+// sorted by key, so 3 letter commands come first
+constexpr FtpSession::Command FtpSession::s_commands[] =
+{
+    { ftpCommandKey( "CWD" ),  FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdCwd },
+    { ftpCommandKey( "MKD" ),  FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdMkd },
+    { ftpCommandKey( "PWD" ),  FTP_CMD_AUTH,                                &FtpSession::cmdPwd },
+    { ftpCommandKey( "RMD" ),  FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdRmd },
+    { ftpCommandKey( "ABOR" ), FTP_CMD_AUTH,                                &FtpSession::cmdAbor },
+    { ftpCommandKey( "APPE" ), FTP_CMD_AUTH | FTP_CMD_DATA | FTP_CMD_PARAM, &FtpSession::cmdAppe },
+    { ftpCommandKey( "CDUP" ), FTP_CMD_AUTH,                                &FtpSession::cmdCdup },
+    { ftpCommandKey( "DELE" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdDele },
+    { ftpCommandKey( "EPSV" ), FTP_CMD_AUTH,                                &FtpSession::cmdEpsv },
+    { ftpCommandKey( "FEAT" ), 0,                                           &FtpSession::cmdFeat },
+    { ftpCommandKey( "HASH" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdHash },
+    { ftpCommandKey( "LIST" ), FTP_CMD_AUTH | FTP_CMD_DATA,                 &FtpSession::cmdList },
+    { ftpCommandKey( "MDTM" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdMdtm },
+    { ftpCommandKey( "MFMT" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdMfmt },
+    { ftpCommandKey( "MLSD" ), FTP_CMD_AUTH | FTP_CMD_DATA,                 &FtpSession::cmdMlsd },
+    { ftpCommandKey( "MLST" ), FTP_CMD_AUTH,                                &FtpSession::cmdMlst },
+    { ftpCommandKey( "MODE" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdMode },
+    { ftpCommandKey( "NLST" ), FTP_CMD_AUTH | FTP_CMD_DATA,                 &FtpSession::cmdNlst },
+    { ftpCommandKey( "NOOP" ), 0,                                           &FtpSession::cmdNoop },
+    { ftpCommandKey( "OPTS" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdOpts },
+    { ftpCommandKey( "PASS" ), FTP_CMD_PARAM,                               &FtpSession::cmdPass },
+    { ftpCommandKey( "PASV" ), FTP_CMD_AUTH,                                &FtpSession::cmdPasv },
+    { ftpCommandKey( "PORT" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdPort },
+    { ftpCommandKey( "QUIT" ), 0,                                           &FtpSession::cmdQuit },
+    { ftpCommandKey( "REST" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdRest },
+    { ftpCommandKey( "RETR" ), FTP_CMD_AUTH | FTP_CMD_DATA | FTP_CMD_PARAM, &FtpSession::cmdRetr },
+    { ftpCommandKey( "RNFR" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdRnfr },
+    { ftpCommandKey( "RNTO" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdRnto },
+    { ftpCommandKey( "SITE" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdSite },
+    { ftpCommandKey( "SIZE" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdSize },
+    { ftpCommandKey( "STOR" ), FTP_CMD_AUTH | FTP_CMD_DATA | FTP_CMD_PARAM, &FtpSession::cmdStor },
+    { ftpCommandKey( "STRU" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdStru },
+    { ftpCommandKey( "TYPE" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdType },
+    { ftpCommandKey( "USER" ), FTP_CMD_PARAM,                               &FtpSession::cmdUser },
+    { ftpCommandKey( "XCRC" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdXcrc },
+    { ftpCommandKey( "XMD5" ), FTP_CMD_AUTH | FTP_CMD_PARAM,                &FtpSession::cmdXmd5 },
+    { ftpCommandKey( "XSHA" ), FTP_CMD_AUTH | FTP_CMD_PARAM | FTP_CMD_SUFFIX, &FtpSession::cmdXsha },
+};
+
+
+// Find the handler of a command
+//
+// Binary search, at most 5 compares for the whole table
+//
+// return:
+//    entry of the command, NULL if unknown
+const FtpSession::Command *FtpSession::findCommand(uint32_t key)
+{
+    static_assert(ftpKeysSorted(s_commands), "FTP command table must be sorted by key");
+
+    size_t low  = 0;
+    size_t high = sizeof(s_commands) / sizeof(s_commands[0]);
+
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+
+        if (s_commands[mid].key == key)
+        {
+            return &s_commands[mid];
+        }
+        else if (s_commands[mid].key < key)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return NULL;
+}
+
+
+boolean FtpSession::processCommand()
+{
+    log_d("cmd \"%s\"", command);
+
+    const Command *pCommand = findCommand( commandKey );
+
+    if(( pCommand == NULL ) || (( strlen( command ) > 4 ) && ! ( pCommand->flags & FTP_CMD_SUFFIX )))
+    {
+        m_server.recordUnknownCommand();
+        reply( 500, "Unknow command" );
+        return true;
+    }
+
+    if(( pCommand->flags & FTP_CMD_AUTH ) && ( cmdStatus != CmdStatus::READY ))
+    {
+        reply( 530, "Please login with USER and PASS" );
+        return true;
+    }
+
+    if(( pCommand->flags & FTP_CMD_PARAM ) && ( strlen( parameters ) == 0 ))
+    {
+        reply( 501, "No parameter given" );
+        return true;
+    }
+
+    // the data connection and buf belong to the running transfer
+    if(( pCommand->flags & FTP_CMD_DATA ) && ( transferStatus != 0 ))
+    {
+        reply( 450, "Transfer in progress" );
+        return true;
+    }
+
+    // park the command until the client opened the data connection, handleFTP()
+    // re-runs it from there without blocking the other sessions
+    if(( pCommand->flags & FTP_CMD_DATA ) && ! dataRetry && ! dataConnect())
+    {
+        dataPending = true;
+        millisDataTimeOut = millis() + (uint32_t)FTP_DATA_TIME_OUT * 1000;
+        m_dataWaitStart = micros();
+        return true;
+    }
+
+    uint32_t start = micros();
+    boolean result = ( this->*pCommand->handler )();
+
+    m_server.recordCommand( pCommand - s_commands, commandKey, micros() - start );
+
+    // the restart offset only applies to the transfer right after REST
+    if( commandKey != ftpCommandKey( "REST" ))
+    {
+        m_restartOffset = 0;
+    }
+
+    return result;
+}
+
+///////////////////////////////////////
+//                                   //
+//      ACCESS CONTROL COMMANDS      //
+//                                   //
+///////////////////////////////////////
+
+//
+//  USER - User Name
+//
+boolean FtpSession::cmdUser()
+{
+    log_d("User cmd \"%s\" data \"%s\"", command, parameters);
+
+    if( cmdStatus != CmdStatus::STANDBY )
+    {
+        reply( 503, "Already logged in" );
+        return true;
+    }
+
+    if( strcmp( parameters, m_server.m_User.c_str() ))
+    {
+        reply( 530, "user not found" );
+        millisDelay = millis() + 100;  // delay of 100 ms
+        return false;
+    }
+
+    reply( 331, "OK. Password required" );
+    strcpy( cwdName, "/" );
+    cmdStatus = CmdStatus::AUTHENTICATE;
+
+    return true;
+}
+
+//
+//  PASS - Password
+//
+boolean FtpSession::cmdPass()
+{
+    log_d("User cmd \"%s\" data \"%s\"", command, parameters);
+
+    if( cmdStatus != CmdStatus::AUTHENTICATE )
+    {
+        reply( 503, "Login with USER first" );
+        return true;
+    }
+
+    if( strcmp( parameters, m_server.m_Password.c_str() ))
+    {
+        reply( 530, "Login incorrect" );
+        millisDelay = millis() + 100;  // delay of 100 ms
+        return false;
+    }
+
+    log_d( "OK. Waiting for commands.");
+    reply( 230, "OK." );
+    cmdStatus = CmdStatus::READY;
+
+    return true;
+}
+
+
+//
+//  CDUP - Change to Parent Directory
+//
+boolean FtpSession::cmdCdup()
+{
+    //if we are not in the root directory
+    if (strcmp(cwdName, "/"))
+    {
+        uint32_t length = strlen(cwdName);
+
+        while((length) && (cwdName[length] != '/'))
+        {
+            --length;
+        }
+
+        if (length)
+        {
+            cwdName[length] = '\0';
+        }
+        else
+        {
+            cwdName[length+1] = '\0';
+        }
+        
+    }
+
+    log_d("CWD \"%s\"", cwdName);
+
+    reply( 250, "Ok. Current directory is \"%s\"", cwdName );
+
+    return true;
+}
+
+
+//
+//  CWD - Change Working Directory
+//
+boolean FtpSession::cmdCwd()
+{
+    if( strcmp( parameters, "." ) == 0 )  // 'CWD .' is the same as PWD command
+    {
+        reply( 257, "\"%s\" is your current directory", cwdName );
+    }
+    else 
+    {      
+        log_d("CWD P=%s CWD=%s", parameters, cwdName);
+
+        String dir;
+
+        if (parameters[0]=='/')
+        {
+            dir = parameters;
+        }
+        else if (!strcmp(cwdName,"/"))
+        {
+            dir = String("/") + parameters;
+        }
+        else
+        {
+            dir = String(cwdName) + "/" + parameters;
+        }        
+
+        if (m_fs->exists(dir)) 
+        {
+            strcpy(cwdName, dir.c_str());
+            reply( 250, "CWD Ok. Current directory is \"%s\"", dir.c_str() );
+            log_i("250 CWD Ok. Current directory is \"%s\"", dir.c_str());
+        }
+        else
+        {
+            reply( 550, "directory or file does not exist \"%s\"", parameters );
+            log_i( "550 directory or file does not exist \"%s\"", parameters);
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  PWD - Print Directory
+//
+boolean FtpSession::cmdPwd()
+{
+    reply( 257, "\"%s\" is your current directory", cwdName );
+
+    return true;
+}
+
+
+//
+//  QUIT
+//
+boolean FtpSession::cmdQuit()
+{
+    disconnectClient();
+    return false;
+}
+
+
+///////////////////////////////////////
+//                                   //
+//    TRANSFER PARAMETER COMMANDS    //
+//                                   //
+///////////////////////////////////////
+
+//
+//  MODE - Transfer Mode
+//
+boolean FtpSession::cmdMode()
+{
+    if( ! strcmp( parameters, "S" ))
+    {
+        m_modeZ = false;
+        reply( 200, "S Ok" );
+    // else if( ! strcmp( parameters, "B" ))
+    //  reply( 200, "B Ok" );
+    }
+    else if( ! strcmp( parameters, "Z" ))
+    {
+        m_modeZ = true;
+        reply( 200, "Z Ok, level %u", m_zLevel );
+    }
+    else
+    {
+        reply( 504, "Only S(tream) and Z(lib) are suported" );
+    }
+
+    return true;
+}
+
+
+//
+//  PASV - Passive Connection management
+//
+boolean FtpSession::cmdPasv()
+{
+    if( m_epsvAll )
+    {
+        reply( 503, "Only EPSV allowed after EPSV ALL" );
+        return true;
+    }
+
+    if (data.connected())
+    {
+        data.stop();
+    }
+
+    if( ! openPassive())
+    {
+        reply( 425, "Can't open passive data port" );
+        return true;
+    }
+
+    // the address the client reached us on, also right for the soft AP
+    dataIp = client.localIP();
+    dataPort = m_pasvPort;
+
+    log_i("Connection management set to passive");
+    log_i( "Data port set to %u", dataPort);
+
+    dataArmed = true;
+   
+    reply( 227, "Entering Passive Mode (%u,%u,%u,%u,%u,%u).", dataIp[0], dataIp[1], dataIp[2], dataIp[3], dataPort >> 8, dataPort & 255 );
+    dataPassiveConn = true;
+
+    return true;
+}
+
+
+//
+//  EPSV - Extended Passive Mode (see RFC 2428)
+//
+boolean FtpSession::cmdEpsv()
+{
+    if( strcasecmp( parameters, "ALL" ) == 0 )
+    {
+        m_epsvAll = true;
+        reply( 200, "EPSV ALL command successful" );
+        return true;
+    }
+
+    // only IPv4, protocol 1
+    if(( strlen( parameters ) > 0 ) && ( strcmp( parameters, "1" ) != 0 ))
+    {
+        reply( 522, "Network protocol not supported, use (1)" );
+        return true;
+    }
+
+    if (data.connected())
+    {
+        data.stop();
+    }
+
+    if( ! openPassive())
+    {
+        reply( 425, "Can't open passive data port" );
+        return true;
+    }
+
+    dataIp = client.localIP();
+    dataPort = m_pasvPort;
+
+    log_i( "Extended passive mode, data port set to %u", dataPort);
+
+    dataArmed = true;
+    reply( 229, "Entering Extended Passive Mode (|||%u|)", dataPort );
+    dataPassiveConn = true;
+
+    return true;
+}
+
+
+//
+//  PORT - Data Port
+//
+boolean FtpSession::cmdPort()
+{
+    if( m_epsvAll )
+    {
+        reply( 503, "Only EPSV allowed after EPSV ALL" );
+        return true;
+    }
+
+    if (data)
+    {
+        data.stop();
+    }
+    closePassive();
+
+    // get IP of data client
+    dataIp[ 0 ] = atoi( parameters );
+    char * p = strchr( parameters, ',' );
+    for( uint8_t i = 1; i < 4; i ++ )
+    {
+        dataIp[ i ] = atoi( ++ p );
+        p = strchr( p, ',' );
+    }
+
+    // get port of data client
+    dataPort = 256 * atoi( ++ p );
+    p = strchr( p, ',' );
+    dataPort += atoi( ++ p );
+    if( p == NULL )
+    {
+        reply( 501, "Can't interpret parameters" );
+    }
+    else
+    {      
+        reply( 200, "PORT command successful" );
+    dataPassiveConn = false;
+    }
+
+    return true;
+}
+
+
+//
+//  STRU - File Structure
+//
+boolean FtpSession::cmdStru()
+{
+    if( ! strcmp( parameters, "F" ))
+    {
+        reply( 200, "F Ok" );
+    }
+    else
+    {
+        reply( 504, "Only F(ile) is suported" );
+    }
+
+    return true;
+}
+
+
+//
+//  TYPE - Data Type
+//
+boolean FtpSession::cmdType()
+{
+    if( ! strcmp( parameters, "A" ))
+    {
+        reply( 200, "TYPE is now ASII" );
+    }
+    else if( ! strcmp( parameters, "I" ))
+    {
+        reply( 200, "TYPE is now 8-bit binary" );
+    }
+    else
+    {
+        reply( 504, "Unknow TYPE" );
+    }
+
+    return true;
+}
+
+
+///////////////////////////////////////
+//                                   //
+//        FTP SERVICE COMMANDS       //
+//                                   //
+///////////////////////////////////////
+
+//
+//  ABOR - Abort
+//
+boolean FtpSession::cmdAbor()
+{
+    abortTransfer();
+    reply( 226, "Data connection closed" );
+
+    return true;
+}
+
+
+//
+//  DELE - Delete a File
+//
+boolean FtpSession::cmdDele()
+{
+    char path[ FTP_CWD_SIZE ];
+    if( makePath( path ) && ! isReserved( path ))
+    {
+        if( ! m_fs->exists( path ))
+        {
+            reply( 550, "File %s not found", parameters );
+        }
+        else
+        {
+            if( m_fs->remove( path ))
+            {
+                m_server.m_listCache.invalidatePath( path );
+                m_server.m_hashIndex.invalidatePath( path );
+                m_server.m_fileCache.invalidatePath( path );
+                reply( 250, "Deleted %s", parameters );
+            }
+            else
+            {
+                reply( 450, "Can't delete %s", parameters );
+            }
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  LIST - List
+//
+boolean FtpSession::cmdList()
+{
+    if( ! dataConnect())
+    {
+        reply( 425, "No data connection" );
+    }
+    else
+    {
+        sendListing( FtpListCache::LIST );
+    }
+
+    return true;
+}
+
+
+//
+//  MLSD - Listing for Machine Processing (see RFC 3659)
+//
+boolean FtpSession::cmdMlsd()
+{
+    if( ! dataConnect())
+    {
+        reply( 425, "No data connection MLSD" );
+    }
+    else
+    {
+        sendListing( FtpListCache::MLSD );
+    }
+
+    return true;
+}
+
+
+//
+//  MLST - Facts of a single file or directory (see RFC 3659)
+//
+//  Without a parameter the current directory, answered on the control connection
+//
+boolean FtpSession::cmdMlst()
+{
+    char path[ FTP_CWD_SIZE ];
+    if( makePath( path, ( strlen( parameters ) > 0 ) ? parameters : cwdName ) && ! isReserved( path ))
+    {
+        const FtpMappedFile *pMapped = m_server.findMappedFile( path );
+        File file;
+
+        if( pMapped == NULL )
+        {
+            file = m_fs->open( path, "r" );
+        }
+
+        if( pMapped )
+        {
+            // a partition has no time
+            replyPart( 250, "Listing %s", path );
+            replyLine( " Type=file;Size=%lu; %s", (unsigned long)pMapped->size(), path );
+            reply( 250, "End" );
+        }
+        else if( ! file )
+        {
+            reply( 550, "%s not found", path );
+        }
+        else
+        {
+            char dt[ 15 ];
+
+            replyPart( 250, "Listing %s", path );
+            replyLine( " Type=%s;Size=%lu;modify=%s; %s", file.isDirectory() ? "dir" : "file",
+                       (unsigned long)file.size(), makeDateTimeStr( dt, file.getLastWrite()), path );
+            reply( 250, "End" );
+            file.close();
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  NLST - Name List
+//
+boolean FtpSession::cmdNlst()
+{
+    if (!dataConnect())
+        reply( 425, "No data connection" );
+    else
+        sendListing( FtpListCache::NLST );
+
+    return true;
+}
+
+
+//
+//  NOOP
+//
+boolean FtpSession::cmdNoop()
+{
+    // dataPort = 0;
+    reply( 200, "Zzz..." );
+
+    return true;
+}
+
+
+//
+//  OPTS - Options of a command
+//
+boolean FtpSession::cmdOpts()
+{
+    unsigned level;
+
+    if( sscanf( parameters, "MODE Z LEVEL %u", &level ) == 1 && level >= 1 && level <= 9 )
+    {
+        m_zLevel = level;
+        reply( 200, "MODE Z LEVEL set to %u", level );
+    }
+    else if( strcasecmp( parameters, "HASH" ) == 0 )
+    {
+        reply( 200, "%s", FtpHash::name( m_hashAlgorithm ));
+    }
+    else if( strncasecmp( parameters, "HASH ", 5 ) == 0 )
+    {
+        if( FtpHash::find( parameters + 5, &m_hashAlgorithm ))
+        {
+            reply( 200, "%s", FtpHash::name( m_hashAlgorithm ));
+        }
+        else
+        {
+            reply( 501, "Unknown algorithm %s", parameters + 5 );
+        }
+    }
+    else
+    {
+        reply( 501, "Option not understood" );
+    }
+
+    return true;
+}
+
+
+//
+//  RETR - Retrieve
+//
+boolean FtpSession::cmdRetr()
+{
+    char path[FTP_CWD_SIZE];
+    if (makePath(path) && !isReserved(path))
+    {
+        const FtpMappedFile *pMapped = m_server.findMappedFile(path);
+        size_t size = 0;
+
+        if (pMapped)
+        {
+            size = pMapped->size();
+        }
+        else if ((m_pCachedData = m_server.m_fileCache.acquire(path, &size)) == NULL)
+        {
+            m_file = m_fs->open(path, "r");
+            size = m_file ? m_file.size() : 0;
+
+            // a small file is read whole, the next RETR of it comes from memory, unless it is being written
+            if ((m_file) && (!m_server.isWriting(path)) &&
+                ((m_pCachedData = m_server.m_fileCache.load(path, m_file, &size)) != NULL))
+            {
+                m_file.close();
+            }
+        }
+
+        if ((!pMapped) && (!m_pCachedData) && (!m_file))
+        {
+            reply( 550, "File %s not found", parameters );
+        }
+        else if ((m_restartOffset > size) || ((m_file) && (!m_file.seek(m_restartOffset))))
+        {
+            reply( 554, "Can't restart at %lu", (unsigned long)m_restartOffset );
+            m_file.close();
+            endMapped();
+        }
+        else if (!dataConnect())
+        {
+            reply( 425, "No data connection" );
+            m_file.close();
+            endMapped();
+        }
+        else if (!beginCompression(isCompressedFile(path) ? 0 : m_zLevel))
+        {
+            reply( 451, "No memory for compression" );
+            m_file.close();
+            endMapped();
+        }
+        else
+        {
+            log_i("Sending %s from %lu", parameters, (unsigned long)m_restartOffset);
+
+            replyPart( 150, "Connected to port %u", dataPort );
+            reply( 150, "%lu bytes to download", (unsigned long)(size - m_restartOffset) );
+            millisBeginTrans = millis();
+            bytesTransferred = 0;
+            m_compressedBytes = 0;
+            m_networkMicros = 0;
+            m_storageMicros = 0;
+
+            if ((pMapped) || (m_pCachedData))
+            {
+                m_pMappedData = (pMapped) ? pMapped->data() : m_pCachedData;
+                m_mappedSize  = size;
+                m_mappedPos   = m_restartOffset;
+            }
+            else if (FTP_RETR_BUFFERS > 1)
+            {
+                m_retrPipe.begin(m_file, FTP_RETR_BUFFERS, FTP_BUF_SIZE);
+                m_retrBlockPos = 0;
+            }
+
+            m_rateLimiter.reset();
+            transferStatus = 1;
+            m_server.wakeTransferTask();
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  STOR - Store
+//
+boolean FtpSession::cmdStor()
+{
+    return storeFile( false );
+}
+
+
+//
+//  APPE - Append with create
+//
+boolean FtpSession::cmdAppe()
+{
+    return storeFile( true );
+}
+
+
+// Open the target of STOR/APPE and start receiving
+//
+// STOR after REST keeps the bytes before the restart offset and overwrites
+// the file from there on, the file ends with the received data
+boolean FtpSession::storeFile( boolean append )
+{
+    char path[ FTP_CWD_SIZE ];
+    if( makePath( path ) && ! isReserved( path ))
+    {
+        const char *mode = "w";
+
+        if( append )
+        {
+            mode = "a";
+        }
+        else if( m_restartOffset > 0 )
+        {
+            mode = "r+";
+        }
+
+        m_file = m_fs->open(path, mode);
+        if( !m_file)
+        {
+            reply( 451, "Can't open/create %s", parameters );
+            return true;
+        }
+
+        // "w" already emptied the file, even if the transfer does not start
+        m_server.m_listCache.invalidatePath( path );
+        m_server.m_hashIndex.invalidatePath( path );
+        m_server.m_fileCache.invalidatePath( path );
+
+        if( ! append && ( m_restartOffset > m_file.size() || ! m_file.seek( m_restartOffset )))
+        {
+            reply( 554, "Can't restart at %lu", (unsigned long)m_restartOffset );
+            m_file.close();
+        }
+        else if( ! dataConnect())
+        {
+            reply( 425, "No data connection" );
+            m_file.close();
+        }
+        else
+        {                
+            log_d( "Receiving %s", parameters);
+         
+            reply( 150, "Connected to port %u", dataPort );
+            millisBeginTrans = millis();
+            bytesTransferred = 0;
+            m_compressedBytes = 0;
+            m_storeCrc = 0;
+            m_networkMicros = 0;
+            m_storageMicros = 0;
+
+            if (m_modeZ)
+            {
+                m_inflater.begin();
+                m_zInPos = 0;
+                m_zInLength = 0;
+                m_zFailed = false;
+            }
+
+            // the first write only reaches the next block boundary
+            uint32_t offset = append ? m_file.size() : m_restartOffset;
+
+            // a file received from its start gets its digests for the hash index on the way in
+            m_storeWhole = ( offset == 0 );
+            if (m_storeWhole && m_hashAlgorithm != FtpHash::CRC32)
+            {
+                m_storeHash.begin(m_hashAlgorithm);
+            }
+
+            if (FTP_STOR_RING_SIZE > 0)
+            {
+                m_storPipe.begin(m_file, FTP_STOR_RING_SIZE, m_server.m_storageBlock, offset);
+            }
+
+            // without the ring buf collects the blocks, in MODE Z only its upper half is free
+            if (!m_storPipe.isActive() && m_modeZ)
+            {
+                m_coalescer.begin(m_file, (uint8_t *)buf + FTP_BUF_SIZE / 2, FTP_BUF_SIZE / 2, m_server.m_storageBlock, offset);
+            }
+            else if (!m_storPipe.isActive())
+            {
+                m_coalescer.begin(m_file, (uint8_t *)buf, FTP_BUF_SIZE, m_server.m_storageBlock, offset);
+            }
+
+            strcpy( transferPath, path );
+            m_storeOffset = append ? 0 : m_restartOffset;
+
+            m_rateLimiter.reset();
+            transferStatus = 2;
+            m_server.wakeTransferTask();
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  MKD - Make Directory
+//
+boolean FtpSession::cmdMkd()
+{
+    log_d("MKD P=\"%s\" CWD=\"%s\"", parameters, cwdName);
+    
+    String dir;
+
+    if (!strcmp(cwdName,"/"))
+    {
+        dir = String("/") + parameters;
+    }
+    else
+    {
+        dir = String(cwdName) +"/" + parameters;
+    }
+
+    log_i("try to create  \"%s\"", dir.c_str());
+
+    
+    char path[ FTP_CWD_SIZE ];
+    if (!makePath(path) || isReserved(path))
+    {
+        return true;
+    }
+
+    if (m_fs->mkdir(dir.c_str()))
+    {
+        m_server.m_listCache.invalidatePath( dir.c_str() );
+        reply( 257, "\"%s\" - Directory successfully created", parameters );
+    }
+    else
+    {
+        reply( 502, "Can't create \"%s", parameters );
+    }
+
+    return true;
+}
+
+
+//
+//  RMD - Remove a Directory
+//
+boolean FtpSession::cmdRmd()
+{
+    log_d("RMD P=\"%s\" CWD=\"%s\"", parameters, cwdName);
+
+    String dir;
+
+    if (!strcmp(cwdName,"/"))
+    {
+        dir = String("/") + parameters;
+    }
+    else
+    {
+        dir = String(cwdName) +"/" + parameters;
+    }
+
+    if (m_fs->rmdir(dir.c_str()))
+    {
+        m_server.m_listCache.invalidatePath( dir.c_str() );
+        m_server.m_hashIndex.invalidatePath( dir.c_str() );
+        m_server.m_fileCache.invalidatePath( dir.c_str() );
+        reply( 250, "RMD command successful" );
+    }
+    else
+    {
+        reply( 502, "Can't delete \"%s", parameters );  //not support on espyet
+    }
+
+    return true;
+}
+
+
+//
+//  RNFR - Rename From
+//
+boolean FtpSession::cmdRnfr()
+{
+    m_fromPath[ 0 ] = 0;
+
+    if( makePath( m_fromPath ) && ! isReserved( m_fromPath ))
+    {
+        if( ! m_fs->exists( m_fromPath ))
+        {
+            reply( 550, "File %s not found", parameters );
+        }
+        else
+        {
+        #ifdef FTP_DEBUG
+            Serial.println("Renaming " + String(m_fromPath));
+        #endif
+            reply( 350, "RNFR accepted - file exists, ready for destination" );
+            rnfrCmd = true;
+            cpfrCmd = false;
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  RNTO - Rename To
+//
+boolean FtpSession::cmdRnto()
+{
+    char path[ FTP_CWD_SIZE ];
+    
+    if( strlen( m_fromPath ) == 0 || ! rnfrCmd )
+    {
+        reply( 503, "Need RNFR before RNTO" );
+    }
+    else if( makePath( path ) && ! isReserved( path ))
+    {
+        if( m_fs->exists( path ))
+        {
+            reply( 553, "%s already exists", parameters );
+        }
+        else
+        {          
+            log_d("Renaming \"%s\" to \"%s\"", m_fromPath, path);            
+            
+            if( m_fs->rename( m_fromPath, path ))
+            {
+                m_server.m_listCache.invalidatePath( m_fromPath );
+                m_server.m_listCache.invalidatePath( path );
+                m_server.m_hashIndex.invalidatePath( m_fromPath );
+                m_server.m_hashIndex.invalidatePath( path );
+                m_server.m_fileCache.invalidatePath( m_fromPath );
+                m_server.m_fileCache.invalidatePath( path );
+                reply( 250, "File successfully renamed or moved" );
+            }
+            else
+            {
+                reply( 451, "Rename/move failure" );
+            }
+        }
+    }
+    rnfrCmd = false;
+
+    return true;
+}
+
+
+///////////////////////////////////////
+//                                   //
+//   EXTENSIONS COMMANDS (RFC 3659)  //
+//                                   //
+///////////////////////////////////////
+
+//
+//  FEAT - New Features
+//
+boolean FtpSession::cmdFeat()
+{
+    char algorithms[ 48 ] = "";
+
+    // the selected algorithm is marked with a star
+    for( uint8_t i = 0; i < FtpHash::ALGORITHMS; i ++ )
+    {
+        size_t length = strlen( algorithms );
+        snprintf( algorithms + length, sizeof( algorithms ) - length, "%s%s%s", ( i > 0 ) ? ";" : "",
+                  FtpHash::name(( FtpHash::Algorithm )i ), ( i == m_hashAlgorithm ) ? "*" : "" );
+    }
+
+    replyPart( 211, "Extensions suported:" );
+    replyLine( " EPSV" );
+    replyLine( " HASH %s", algorithms );
+    replyLine( " MDTM" );
+    replyLine( " MFMT" );
+    replyLine( " MLSD" );
+    replyLine( " MLST Type*;Size*;Modify*;" );
+    replyLine( " MODE Z" );
+    replyLine( " REST STREAM" );
+    replyLine( " XCRC" );
+    replyLine( " XMD5" );
+    replyLine( " XSHA1" );
+    replyLine( " XSHA256" );
+    reply( 211, "End." );
+
+    return true;
+}
+
+
+//
+//  MDTM - File Modification Time (see RFC 3659)
+//
+boolean FtpSession::cmdMdtm()
+{
+    char path[ FTP_CWD_SIZE ];
+    if( makePath( path ) && ! isReserved( path ))
+    {
+        File file;
+
+        if( m_server.findMappedFile( path ) == NULL )
+        {
+            file = m_fs->open( path, "r" );
+        }
+
+        if( ! file )
+        {
+            reply( 550, "Unable to retrieve time of %s", parameters );
+        }
+        else
+        {
+            char dt[ 15 ];
+
+            reply( 213, "%s", makeDateTimeStr( dt, file.getLastWrite()));
+            file.close();
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  MFMT - Modify Fact: Modification Time (draft-somers-ftp-mfxx)
+//
+//  MFMT YYYYMMDDHHMMSS <file>, in UTC
+//
+boolean FtpSession::cmdMfmt()
+{
+    time_t t;
+    uint8_t length = getDateTime( parameters, &t );
+
+    if( length == 0 )
+    {
+        reply( 501, "Syntax: MFMT YYYYMMDDHHMMSS <file>" );
+    }
+    else if( setFileTime( parameters + length, t ))
+    {
+        reply( 213, "Modify=%.14s; %s", parameters, parameters + length );
+    }
+
+    return true;
+}
+
+
+//
+//  SIZE - Size of the file
+//
+boolean FtpSession::cmdSize()
+{
+    char path[ FTP_CWD_SIZE ];
+    if( makePath( path ) && ! isReserved( path ))
+    {
+        const FtpMappedFile *pMapped = m_server.findMappedFile( path );
+        const uint8_t *pCached = NULL;
+        size_t size = 0;
+
+        if( pMapped == NULL )
+        {
+            pCached = m_server.m_fileCache.acquire( path, &size );
+        }
+
+        if(( pMapped == NULL ) && ( pCached == NULL ))
+        {
+            m_file = m_fs->open(path, "r");
+        }
+
+        if( pMapped )
+        {
+            reply( 213, "%lu", (unsigned long)pMapped->size() );
+        }
+        else if( pCached )
+        {
+            m_server.m_fileCache.release( pCached );
+            reply( 213, "%lu", (unsigned long)size );
+        }
+        else if(!m_file)
+        {
+            reply( 450, "Can't open %s", parameters );
+        }
+        else
+        {
+            reply( 213, "%lu", (unsigned long)m_file.size() );
+            m_file.close();
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  REST - Restart of Interrupted Transfer (see RFC 3659)
+//
+boolean FtpSession::cmdRest()
+{
+    char *pEnd;
+    unsigned long offset = strtoul( parameters, &pEnd, 10 );
+
+    if( ! isdigit( parameters[ 0 ] ) || *pEnd != 0 )
+    {
+        reply( 501, "Invalid restart offset %s", parameters );
+    }
+    else
+    {
+        m_restartOffset = offset;
+        reply( 350, "Restarting at %lu. Send RETR or STOR", offset );
+    }
+
+    return true;
+}
+
+
+//
+//  HASH - Checksum of a file (draft-bryan-ftpext-hash)
+//
+//  Covers the file from the REST offset on, OPTS HASH selects the algorithm
+//
+boolean FtpSession::cmdHash()
+{
+    return startHash( m_hashAlgorithm, parameters, m_restartOffset, 0, true );
+}
+
+
+//
+//  XCRC - CRC-32 of a file
+//
+boolean FtpSession::cmdXcrc()
+{
+    char *pName;
+    uint32_t start, end;
+
+    if( parseHashRange( &pName, &start, &end ))
+    {
+        startHash( FtpHash::CRC32, pName, start, end, false );
+    }
+
+    return true;
+}
+
+
+//
+//  XMD5 - MD5 of a file
+//
+boolean FtpSession::cmdXmd5()
+{
+    char *pName;
+    uint32_t start, end;
+
+    if( parseHashRange( &pName, &start, &end ))
+    {
+        startHash( FtpHash::MD5, pName, start, end, false );
+    }
+
+    return true;
+}
+
+
+//
+//  XSHA, XSHA1, XSHA256 - SHA-1 or SHA-256 of a file
+//
+boolean FtpSession::cmdXsha()
+{
+    char *pName;
+    uint32_t start, end;
+    FtpHash::Algorithm algorithm;
+
+    if(( strcmp( command, "XSHA" ) == 0 ) || ( strcmp( command, "XSHA1" ) == 0 ))
+    {
+        algorithm = FtpHash::SHA1;
+    }
+    else if( strcmp( command, "XSHA256" ) == 0 )
+    {
+        algorithm = FtpHash::SHA256;
+    }
+    else
+    {
+        m_server.recordUnknownCommand();
+        reply( 500, "Unknow command" );
+        return true;
+    }
+
+    if( parseHashRange( &pName, &start, &end ))
+    {
+        startHash( algorithm, pName, start, end, false );
+    }
+
+    return true;
+}
+
+
+// Split the parameters of XCRC/XMD5/XSHA into name, start and end
+//
+// The name may be quoted, up to 2 numbers after it are the start and the
+// end position, the byte at end is not included. Without them the REST
+// offset and the end of the file apply
+//
+// return:
+//    true, if the parameters are valid, else the error is answered
+boolean FtpSession::parseHashRange( char ** ppName, uint32_t * pStart, uint32_t * pEnd )
+{
+    char *pName = parameters;
+    char *pRange;
+
+    if( *pName == '"' )
+    {
+        pRange = strchr( ++ pName, '"' );
+
+        if( pRange == NULL )
+        {
+            reply( 501, "Missing closing quote" );
+            return false;
+        }
+
+        *pRange ++ = 0;
+    }
+    else
+    {
+        // unquoted, the numbers at the end are the range
+        pRange = pName + strlen( pName );
+
+        for( uint8_t i = 0; i < 2; i ++ )
+        {
+            char *pSpace = pRange;
+
+            while(( pSpace > pName ) && ( pSpace[ -1 ] != ' ' ))
+            {
+                pSpace --;
+            }
+
+            if(( pSpace == pName ) || ( strspn( pSpace, "0123456789 " ) != strlen( pSpace )))
+            {
+                break;
+            }
+
+            // step over the number and the spaces before it
+            pRange = pSpace;
+            while(( pRange > pName ) && ( pRange[ -1 ] == ' ' ))
+            {
+                pRange --;
+            }
+        }
+
+        if( *pRange )
+        {
+            *pRange ++ = 0;
+        }
+    }
+
+    char *pEndNumber;
+    unsigned long start = strtoul( pRange, &pEndNumber, 10 );
+    boolean hasStart = ( pEndNumber != pRange );
+    pRange = pEndNumber;
+    unsigned long end = strtoul( pRange, &pEndNumber, 10 );
+    boolean hasEnd = ( pEndNumber != pRange );
+
+    while( *pEndNumber == ' ' )
+    {
+        pEndNumber ++;
+    }
+
+    if(( *pName == 0 ) || ( *pEndNumber != 0 ) || ( hasEnd && end < start ))
+    {
+        reply( 501, "Syntax: %s <file> [<start> [<end>]]", command );
+        return false;
+    }
+
+    *ppName = pName;
+    *pStart = hasStart ? start : m_restartOffset;
+    *pEnd   = hasEnd ? end : 0;
+    return true;
+}
+
+
+// Open the file and start its checksum, pumpTransfer() reads it in steps
+// so a large file does not block the other sessions
+//
+// parameters:
+//   end : first byte not included, 0 for the end of the file
+//   hashReply : answer like HASH, else like XCRC
+//
+// return:
+//    true
+boolean FtpSession::startHash( FtpHash::Algorithm algorithm, char * pName, uint32_t start, uint32_t end,
+                               boolean hashReply )
+{
+    char path[ FTP_CWD_SIZE ];
+    char hex[ FTP_HASH_HEX_SIZE ];
+
+    // the file handle belongs to the running transfer
+    if( transferStatus != 0 )
+    {
+        reply( 450, "Transfer in progress" );
+    }
+    else if( makePath( path, pName ) && ! isReserved( path ))
+    {
+        const FtpMappedFile *pMapped = m_server.findMappedFile( path );
+        size_t size = 0;
+
+        if( pMapped )
+        {
+            size = pMapped->size();
+        }
+        else
+        {
+            m_file = m_fs->open( path, "r" );
+            size = m_file ? m_file.size() : 0;
+        }
+
+        if(( end == 0 ) || ( end > size ))
+        {
+            end = size;
+        }
+
+        // only digests of whole files are kept
+        m_hashStart = start;
+        m_hashEnd = end;
+        m_hashReply = hashReply;
+        m_hashWhole = ( ! pMapped ) && ( m_file ) && ( ! m_file.isDirectory()) && ( start == 0 ) && ( end == size );
+        strcpy( transferPath, path );
+
+        if(( ! pMapped ) && ( ! m_file ))
+        {
+            reply( 550, "File %s not found", pName );
+        }
+        else if(( ! pMapped ) && m_file.isDirectory())
+        {
+            reply( 550, "%s is a directory", pName );
+            m_file.close();
+        }
+        else if(( start > end ) || (( m_file ) && ( ! m_file.seek( start ))))
+        {
+            reply( 554, "Invalid range %lu-%lu", (unsigned long)start, (unsigned long)end );
+            m_file.close();
+        }
+        else if( m_hashWhole && m_server.m_hashIndex.lookup( path, size, m_file.getLastWrite(), algorithm, hex ))
+        {
+            log_d( "%s of %s from the hash index", FtpHash::name( algorithm ), path );
+
+            replyHash( algorithm, hex );
+            m_file.close();
+        }
+        else
+        {
+            log_d( "%s of %s from %lu to %lu", FtpHash::name( algorithm ), path,
+                   (unsigned long)start, (unsigned long)end );
+
+            m_hash.begin( algorithm );
+            millisBeginTrans = millis();
+            bytesTransferred = 0;
+            m_storageMicros = 0;
+
+            if( pMapped )
+            {
+                m_pMappedData = pMapped->data();
+                m_mappedSize  = end;
+                m_mappedPos   = start;
+            }
+
+            transferStatus = 3;
+            m_server.wakeTransferTask();
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  SITE - System command
+//
+boolean FtpSession::cmdSite()
+{
+    char name[ FTP_SITE_NAME_SIZE ];
+    size_t length = strcspn( parameters, " " );
+    const char *pArgs = parameters + length;
+
+    while( *pArgs == ' ' )
+    {
+        ++pArgs;
+    }
+
+    // longer names can't be registered
+    if( length >= FTP_SITE_NAME_SIZE )
+    {
+        length = 0;
+    }
+    strncpy( name, parameters, length );
+    name[ length ] = 0;
+
+    if( ! strcasecmp( name, "RATE" ))
+    {
+        return siteRate( pArgs );
+    }
+
+    if( ! strcasecmp( name, "STATS" ))
+    {
+        return siteStats( pArgs );
+    }
+
+    if( ! strcasecmp( name, "UTIME" ))
+    {
+        return siteUtime( pArgs );
+    }
+
+    if( ! strcasecmp( name, "CPFR" ))
+    {
+        return siteCpfr( pArgs );
+    }
+
+    if( ! strcasecmp( name, "CPTO" ))
+    {
+        return siteCpto( pArgs );
+    }
+
+    for( uint8_t i = 0; ( length > 0 ) && ( i < m_server.m_siteCount ); ++i )
+    {
+        const FtpServer::SiteEntry &entry = m_server.m_siteCommands[ i ];
+
+        if( ! strcasecmp( entry.name, name ))
+        {
+            // the text is copied into the reply buffer, it can't be written there directly
+            char text[ FTP_REPLY_SIZE - 8 ];
+            text[ 0 ] = 0;
+
+            uint16_t code = entry.callback( pArgs, text, sizeof( text ), entry.pContext );
+            reply( code, "%s", text );
+            return true;
+        }
+    }
+
+    reply( 500, "Unknow SITE command %s", parameters );
+
+    return true;
+}
+
+
+//
+//  SITE RATE [<total> [<per transfer> [<burst>]]] - show or set the bandwidth caps in bytes/s
+//
+boolean FtpSession::siteRate( const char * pArgs )
+{
+    unsigned long rate, transferRate, burst;
+    int count = sscanf( pArgs, "%lu %lu %lu", &rate, &transferRate, &burst );
+
+    if( count >= 1 )
+    {
+        m_server.setRateLimit( rate,
+                               ( count >= 2 ) ? transferRate : m_server.m_transferRate,
+                               ( count >= 3 ) ? burst : m_server.m_rateBurst );
+    }
+    else if( *pArgs )
+    {
+        reply( 501, "Use SITE RATE <total> [<per transfer> [<burst>]], in bytes/s, 0 is unlimited" );
+        return true;
+    }
+
+    reply( 200, "Rate %lu bytes/s total, %lu bytes/s per transfer, burst %lu bytes",
+           (unsigned long)m_server.m_rateLimiter.rate(), (unsigned long)m_server.m_transferRate,
+           (unsigned long)m_server.m_rateBurst );
+
+    return true;
+}
+
+
+//
+//  SITE STATS [RESET] - show or clear the server metrics
+//
+boolean FtpSession::siteStats( const char * pArgs )
+{
+    if( ! strcasecmp( pArgs, "RESET" ))
+    {
+        m_server.resetMetrics();
+        reply( 200, "Metrics cleared" );
+        return true;
+    }
+
+    // about 1 kB, the copy keeps the transfer task out of the lock while the reply is sent
+    FtpMetrics metrics;
+    m_server.metrics( &metrics );
+
+    replyPart( 211, "Server metrics" );
+    replyLine( " Data: %llu bytes in, %llu bytes out",
+               (unsigned long long)metrics.bytesIn, (unsigned long long)metrics.bytesOut );
+    replyLine( " Transfers: %lu completed, %lu aborted",
+               (unsigned long)metrics.transfersCompleted, (unsigned long)metrics.transfersAborted );
+    replyLine( " Time: storage %lu ms, network %lu ms",
+               (unsigned long)( metrics.storageMicros / 1000 ), (unsigned long)( metrics.networkMicros / 1000 ));
+    replyLine( " Writes: %lu partial writes avoided, %lu partial",
+               (unsigned long)metrics.avoidedWrites, (unsigned long)metrics.partialWrites );
+    replyLine( " Data connection: %lu waits, %lu timeouts, %lu refused, average %lu ms, max %lu ms",
+               (unsigned long)metrics.dataWaits, (unsigned long)metrics.dataTimeouts, (unsigned long)metrics.dataRefused,
+               (unsigned long)( metrics.dataWaits ? metrics.dataWaitMicros / metrics.dataWaits / 1000 : 0 ),
+               (unsigned long)( metrics.maxDataWaitMicros / 1000 ));
+    replyLine( " Heap: %lu bytes free, lowest %lu",
+               (unsigned long)metrics.freeHeap, (unsigned long)metrics.minFreeHeap );
+    replyLine( " Commands: %lu unknown, name count avg_us max_us <100us <1ms <10ms <100ms <1s >=1s",
+               (unsigned long)metrics.unknownCommands );
+
+    for( uint8_t i = 0; i < metrics.commandCount; i ++ )
+    {
+        const FtpCommandMetrics &command = metrics.commands[ i ];
+
+        if( command.count == 0 )
+        {
+            continue;
+        }
+
+        replyLine( "  %-4s %lu %lu %lu %lu %lu %lu %lu %lu %lu", command.name, (unsigned long)command.count,
+                   (unsigned long)( command.totalMicros / command.count ), (unsigned long)command.maxMicros,
+                   (unsigned long)command.latency[ 0 ], (unsigned long)command.latency[ 1 ],
+                   (unsigned long)command.latency[ 2 ], (unsigned long)command.latency[ 3 ],
+                   (unsigned long)command.latency[ 4 ], (unsigned long)command.latency[ 5 ] );
+    }
+
+    reply( 211, "End" );
+
+    return true;
+}
+
+
+//
+//  SITE UTIME YYYYMMDDHHMMSS <file> - set the modification time, in UTC
+//  SITE UTIME <file> <access> <modification> <creation> UTC - the same as older clients send it
+//
+boolean FtpSession::siteUtime( const char * pArgs )
+{
+    char args[ FTP_CMD_SIZE ];
+    char *pName = NULL;
+    time_t t;
+
+    strncpy( args, pArgs, sizeof( args ) - 1 );
+    args[ sizeof( args ) - 1 ] = 0;
+
+    uint8_t length = getDateTime( args, &t );
+
+    if( length > 0 )
+    {
+        pName = args + length;
+    }
+    else
+    {
+        // the 4 words at the end are the times, the name may contain spaces
+        char *pWords[ 4 ];
+        uint8_t count = 0;
+
+        for( ; count < 4; count ++ )
+        {
+            char *pSpace = strrchr( args, ' ' );
+
+            if( pSpace == NULL )
+            {
+                break;
+            }
+
+            pWords[ count ] = pSpace + 1;
+            *pSpace = 0;
+        }
+
+        if(( count == 4 ) && ( ! strcasecmp( pWords[ 0 ], "UTC" )))
+        {
+            // getDateTime() wants the time followed by a space
+            char modification[ 16 ];
+            snprintf( modification, sizeof( modification ), "%s ", pWords[ 2 ] );
+
+            if( getDateTime( modification, &t ) > 0 )
+            {
+                pName = args;
+            }
+        }
+    }
+
+    if( pName == NULL )
+    {
+        reply( 501, "Use SITE UTIME YYYYMMDDHHMMSS <file>, in UTC" );
+    }
+    else if( setFileTime( pName, t ))
+    {
+        reply( 200, "SITE UTIME command successful" );
+    }
+
+    return true;
+}
+
+
+//
+//  SITE CPFR <file> - Copy From, the source of SITE CPTO
+//
+boolean FtpSession::siteCpfr( const char * pArgs )
+{
+    char name[ FTP_CWD_SIZE ];
+
+    strncpy( name, pArgs, sizeof( name ) - 1 );
+    name[ sizeof( name ) - 1 ] = 0;
+    m_fromPath[ 0 ] = 0;
+
+    if( name[ 0 ] == 0 )
+    {
+        reply( 501, "Use SITE CPFR <file>" );
+    }
+    else if( makePath( m_fromPath, name ) && ! isReserved( m_fromPath ))
+    {
+        File file = m_fs->open( m_fromPath, "r" );
+
+        if(( ! file ) || file.isDirectory())
+        {
+            reply( 550, "File %s not found", name );
+        }
+        else
+        {
+            log_d( "Copying from \"%s\"", m_fromPath );
+
+            reply( 350, "CPFR accepted - file exists, ready for destination" );
+            cpfrCmd = true;
+            rnfrCmd = false;
+        }
+    }
+
+    return true;
+}
+
+
+//
+//  SITE CPTO <file> - Copy To, copied on the device in steps between the other sessions
+//
+boolean FtpSession::siteCpto( const char * pArgs )
+{
+    char name[ FTP_CWD_SIZE ];
+    char path[ FTP_CWD_SIZE ];
+
+    strncpy( name, pArgs, sizeof( name ) - 1 );
+    name[ sizeof( name ) - 1 ] = 0;
+
+    if( strlen( m_fromPath ) == 0 || ! cpfrCmd )
+    {
+        reply( 503, "Need SITE CPFR before SITE CPTO" );
+    }
+    else if( name[ 0 ] == 0 )
+    {
+        reply( 501, "Use SITE CPTO <file>" );
+    }
+    else if( transferStatus != 0 )
+    {
+        reply( 450, "Transfer in progress" );
+    }
+    else if( makePath( path, name ) && ! isReserved( path ))
+    {
+        if( m_fs->exists( path ))
+        {
+            reply( 553, "%s already exists", name );
+        }
+        else if( ! ( m_file = m_fs->open( m_fromPath, "r" )))
+        {
+            reply( 550, "Can't open %s", m_fromPath );
+        }
+        else if( ! ( m_copyFile = m_fs->open( path, "w" )))
+        {
+            m_file.close();
+            reply( 451, "Can't create %s", name );
+        }
+        else
+        {
+            log_d( "Copying \"%s\" to \"%s\"", m_fromPath, path );
+
+            // without memory for the large buffer it runs in the smaller steps of buf
+            m_pCopyBuffer = ( uint8_t * )malloc( FTP_COPY_BUF_SIZE );
+            m_copySize = m_file.size();
+
+            strcpy( transferPath, path );
+            m_server.m_listCache.invalidatePath( path );
+            m_server.m_hashIndex.invalidatePath( path );
+            m_server.m_fileCache.invalidatePath( path );
+
+            // one reply is collected until the copy ends, the progress lines
+            // continue it and the outcome sets its code, see replyRecode()
+            replyPart( 250, "Copying to %s, %lu bytes", path, (unsigned long)m_copySize );
+
+            millisBeginTrans = millis();
+            m_copyProgress = millisBeginTrans;
+            bytesTransferred = 0;
+            m_storageMicros = 0;
+
+            transferStatus = 4;
+            m_server.wakeTransferTask();
+        }
+    }
+    cpfrCmd = false;
+
+    return true;
+}
+
+
+// Open the passive listener on the next port of the range
+//
+// A port failing to bind, e.g. still taken by a closing connection, is
+// skipped for the next one.
+//
+// return:
+//    true, if m_pasvPort listens
+boolean FtpSession::openPassive()
+{
+    closePassive();
+
+    for (uint8_t attempt = 0; (attempt < FTP_DATA_PORT_ATTEMPTS) && (m_pasvPort == 0); ++attempt)
+    {
+        uint16_t port = m_server.allocatePassivePort(this);
+
+        if (port == 0)
+        {
+            break;
+        }
+
+        if (m_dataListener.begin(port))
+        {
+            m_pasvPort = port;
+        }
+        else
+        {
+            log_w("Passive port %u can't be opened", port);
+        }
+    }
+
+    return m_pasvPort != 0;
+}
+
+
+// Close the passive listener, connections not taken yet are dropped
+void FtpSession::closePassive()
+{
+    m_dataListener.end();
+    m_pasvPort = 0;
+    dataArmed = false;
+}
+
+
+// Take the data connection from the passive listener if the client opened it
+//
+// Never waits, a command needing the connection is parked by processCommand()
+// Only the host of the control connection is accepted. The listener closes
+// with the first connection, one PASV gives one data connection.
+//
+// return:
+//    true, if the data connection is established
+boolean FtpSession::dataConnect()
+{
+    if ((!data.connected()) && (m_pasvPort != 0) && (m_dataListener.hasClient()))
+    {
+        WiFiClient candidate = m_dataListener.available();
+
+        if (!(candidate.remoteIP() == client.remoteIP()))
+        {
+            log_w("Data connection from another host refused");
+            candidate.stop();
+            m_server.recordRefusedData();
+        }
+        else
+        {
+            data.stop();
+            data = candidate;
+            closePassive();
+
+            log_d("ftpdataserver client....");
+        }
+    }
+
+    return data.connected();
+}
+
+
+// Stop sending from memory, a file cache entry is unpinned
+void FtpSession::endMapped()
+{
+    if (m_pCachedData)
+    {
+        m_server.m_fileCache.release(m_pCachedData);
+        m_pCachedData = NULL;
+    }
+
+    m_pMappedData = NULL;
+}
+
+
+boolean FtpSession::doRetrieve()
+{
+    // mapped partition: hand the flash contents to the socket, no copy into buf
+    if (m_pMappedData)
+    {
+        size_t length = m_mappedSize - m_mappedPos;
+
+        // compressing holds the session, keep the steps short
+        size_t maxLength = m_deflater.isActive() ? FTP_BUF_SIZE : FTP_MAPPED_SEND_SIZE;
+
+        if (length > maxLength)
+        {
+            length = maxLength;
+        }
+
+        // throttled, the rest follows on a later step
+        size_t allowed = transferAllowance(length);
+
+        if ((length > 0) && (allowed == 0))
+        {
+            return true;
+        }
+        length = allowed;
+
+        uint32_t start = micros();
+        size_t sent = 0;
+
+        if ((length > 0) && (m_deflater.isActive()))
+        {
+            sendData(m_pMappedData + m_mappedPos, length);
+            sent = data.connected() ? length : 0;
+        }
+        else if (length > 0)
+        {
+            sent = data.write(m_pMappedData + m_mappedPos, length);
+        }
+        m_networkMicros += micros() - start;
+
+        if (sent > 0)
+        {
+            m_mappedPos += sent;
+            bytesTransferred += sent;
+            transferConsumed(sent);
+            return true;
+        }
+
+        closeTransfer();
+        return false;
+    }
+
+    // pipelined: the reader task already fetched the block, only send it
+    if (m_retrPipe.isActive())
+    {
+        const uint8_t *pBlock;
+        size_t length;
+
+        if (!m_retrPipe.peek(&pBlock, &length))
+        {
+            return true;
+        }
+
+        if (length > 0)
+        {
+            // a throttled block is sent in parts
+            size_t allowed = transferAllowance(length - m_retrBlockPos);
+
+            if (allowed == 0)
+            {
+                return true;
+            }
+
+            uint32_t start = micros();
+            sendData(pBlock + m_retrBlockPos, allowed);
+            m_networkMicros += micros() - start;
+
+            bytesTransferred += allowed;
+            transferConsumed(allowed);
+            m_retrBlockPos += allowed;
+
+            if (m_retrBlockPos == length)
+            {
+                m_retrBlockPos = 0;
+                m_retrPipe.release();
+            }
+            return true;
+        }
+
+        m_retrPipe.release();
+        closeTransfer();
+        return false;
+    }
+
+    size_t allowed = transferAllowance(FTP_BUF_SIZE);
+
+    if (allowed == 0)
+    {
+        return true;
+    }
+
+    //int16_t nb = file.readBytes((uint8_t*) buf, FTP_BUF_SIZE );
+    uint32_t start = micros();
+    int16_t nb = m_file.readBytes(buf, allowed);
+    m_storageMicros += micros() - start;
+
+    if (nb > 0)
+    {
+        start = micros();
+        sendData((uint8_t *)buf, nb);
+        m_networkMicros += micros() - start;
+
+        bytesTransferred += nb;
+        transferConsumed(nb);
+        return true;
+    }
+    closeTransfer();
+    return false;
+}
+
+
+boolean FtpSession::doStore()
+{
+    if (m_inflater.isActive())
+    {
+        return doStoreCompressed();
+    }
+
+    // pipelined: only move socket data into the ring, the writer task stores it
+    if ((m_storPipe.isActive()) && (data.connected()))
+    {
+        int available = data.available();
+
+        if (available > 0)
+        {
+            uint8_t *pSpace;
+            size_t space = m_storPipe.writable(&pSpace);
+
+            // ring full: leave the data in the socket until the writer caught up
+            if ((size_t)available < space)
+            {
+                space = available;
+            }
+
+            // throttled: the unread data closes the TCP window and slows the client down
+            space = transferAllowance(space);
+
+            uint32_t start = micros();
+            int nb = (space > 0) ? data.read(pSpace, space) : 0;
+            m_networkMicros += micros() - start;
+
+            if (nb > 0)
+            {
+                storeReceived(pSpace, nb);
+                m_storPipe.commit(nb);
+                bytesTransferred += nb;
+                transferConsumed(nb);
+            }
+        }
+        return true;
+    }
+
+    if (data.connected())
+    {
+        uint8_t *pSpace;
+        uint32_t readCount = data.available() ;
+        size_t space = m_coalescer.writable(&pSpace);
+
+        // do not read more bytes than available, nor beyond the next block boundary
+        if (readCount > space)
+        {
+            readCount = space;
+        };
+
+        readCount = transferAllowance(readCount);
+        
+        uint32_t start = micros();
+        size_t nb = (readCount > 0) ? data.readBytes(pSpace, readCount) : 0;
+        m_networkMicros += micros() - start;
+
+        if (nb > 0)
+        {
+            storeReceived(pSpace, nb);
+
+            // writes once a block boundary is reached
+            start = micros();
+            m_coalescer.commit(nb);
+            m_storageMicros += micros() - start;
+
+            bytesTransferred += nb;
+            transferConsumed(nb);
+        }
+        return true;
+    }
+    closeTransfer();
+    return false;
+}
+
+// Checksums of the bytes received by a STOR
+//
+// Taken while the bytes are still in the cache, the file is never read back
+void FtpSession::storeReceived(const uint8_t *pData, size_t length)
+{
+    m_storeCrc = FtpHash::crc32(m_storeCrc, pData, length);
+
+    if (m_storeWhole && m_hashAlgorithm != FtpHash::CRC32)
+    {
+        m_storeHash.update(pData, length);
+    }
+}
+
+// Decompress a MODE Z STOR, the compressed bytes wait in the lower half of buf
+//
+// The output goes into the store ring, or into the upper half of buf where
+// it is collected to whole blocks without it
+boolean FtpSession::doStoreCompressed()
+{
+    // the compressed bytes on the wire are throttled
+    size_t allowed = transferAllowance(FTP_BUF_SIZE / 2);
+
+    if ((m_zInPos == m_zInLength) && (allowed > 0) && (data.available() > 0))
+    {
+        uint32_t start = micros();
+        int nb = data.read((uint8_t *)buf, allowed);
+        m_networkMicros += micros() - start;
+
+        m_zInPos = 0;
+        m_zInLength = (nb > 0) ? nb : 0;
+        m_compressedBytes += m_zInLength;
+        transferConsumed(m_zInLength);
+    }
+
+    uint8_t *pOut;
+    size_t space;
+
+    if (m_storPipe.isActive())
+    {
+        space = m_storPipe.writable(&pOut);
+    }
+    else
+    {
+        space = m_coalescer.writable(&pOut);
+    }
+
+    size_t used = 0;
+    size_t produced = 0;
+
+    if ((space > 0) && (!m_zFailed) && (!m_inflater.isDone()))
+    {
+        FtpInflater::Status status = m_inflater.inflate((uint8_t *)buf + m_zInPos, m_zInLength - m_zInPos, &used,
+                                                        pOut, space, &produced);
+
+        if (status == FtpInflater::FAILED)
+        {
+            log_e("Invalid compressed data after %lu bytes", (unsigned long)bytesTransferred);
+            m_zFailed = true;
+        }
+    }
+    else if (m_zFailed || m_inflater.isDone())
+    {
+        // the rest of the stream is dropped
+        used = m_zInLength - m_zInPos;
+    }
+
+    m_zInPos += used;
+
+    if (produced > 0)
+    {
+        // of the decompressed bytes, as they end up in the file
+        storeReceived(pOut, produced);
+
+        if (m_storPipe.isActive())
         {
-            client.println( "501 Can't interpret parameters");
+            m_storPipe.commit(produced);
         }
         else
-        {      
-		    client.println("200 PORT command successful");
-        dataPassiveConn = false;
+        {
+            uint32_t start = micros();
+            m_coalescer.commit(produced);
+            m_storageMicros += micros() - start;
+        }
+
+        bytesTransferred += produced;
+    }
+
+    // done once the client closed and the inflater ran out of input, not of space
+    if ((!data.connected()) && (data.available() == 0) && (m_zInPos == m_zInLength) && (space > 0) && (produced < space))
+    {
+        closeTransfer();
+        return false;
+    }
+
+    return true;
+}
+
+
+// Add the next piece of the file to the running checksum, answer when done
+boolean FtpSession::doHash()
+{
+    uint32_t remaining = m_hashEnd - m_hashStart - bytesTransferred;
+    int32_t nb = ( remaining < FTP_BUF_SIZE ) ? remaining : FTP_BUF_SIZE;
+
+    if( m_pMappedData )
+    {
+        m_hash.update( m_pMappedData + m_mappedPos, nb );
+        m_mappedPos += nb;
+    }
+    else if( nb > 0 )
+    {
+        uint32_t start = micros();
+        nb = m_file.read(( uint8_t * )buf, nb );
+        m_storageMicros += micros() - start;
+
+        if( nb > 0 )
+        {
+            m_hash.update(( uint8_t * )buf, nb );
+        }
+    }
+
+    if( nb > 0 )
+    {
+        bytesTransferred += nb;
+    }
+
+    if(( nb > 0 ) && ( bytesTransferred < m_hashEnd - m_hashStart ))
+    {
+        return true;
+    }
+
+    char hex[ FTP_HASH_HEX_SIZE ];
+    m_hash.finish( hex );
+
+    if( bytesTransferred < m_hashEnd - m_hashStart )
+    {
+        reply( 451, "Error reading %s", transferPath );
+    }
+    else
+    {
+        // indexed before the answer, a client asking again right away finds it
+        if( m_hashWhole )
+        {
+            const char *digests[ FtpHash::ALGORITHMS ] = { NULL };
+            digests[ m_hash.algorithm() ] = hex;
+
+            m_server.m_hashIndex.store( transferPath, m_hashEnd, m_file.getLastWrite(), digests );
+        }
+
+        replyHash( m_hash.algorithm(), hex );
+    }
+
+    log_d( "Checksum of %lu bytes in %lu ms, storage %lu ms", (unsigned long)bytesTransferred,
+           (unsigned long)( millis() - millisBeginTrans ), (unsigned long)( m_storageMicros / 1000 ));
+
+    m_file.close();
+    endMapped();
+
+    // hashing a large file must not count as inactivity of the control connection
+    millisEndConnection = millis() + m_server.millisTimeOut;
+    return false;
+}
+
+
+// Answer a checksum in the format of the command asking for it
+void FtpSession::replyHash( FtpHash::Algorithm algorithm, const char * pHex )
+{
+    if( m_hashReply )
+    {
+        // the range names the last byte, not the one after it
+        reply( 213, "%s %lu-%lu %s %s", FtpHash::name( algorithm ), (unsigned long)m_hashStart,
+               (unsigned long)(( m_hashEnd > m_hashStart ) ? m_hashEnd - 1 : m_hashStart ), pHex, transferPath );
+    }
+    else
+    {
+        reply( 250, "%s", pHex );
+    }
+}
+
+
+// Copy the next piece of the file, answer when done
+boolean FtpSession::doCopy()
+{
+    uint8_t *pBuffer = m_pCopyBuffer ? m_pCopyBuffer : ( uint8_t * )buf;
+    size_t size = m_pCopyBuffer ? FTP_COPY_BUF_SIZE : FTP_BUF_SIZE;
+
+    uint32_t start = micros();
+    int32_t nb = m_file.read( pBuffer, size );
+    boolean written = ( nb <= 0 ) || ( m_copyFile.write( pBuffer, nb ) == ( size_t )nb );
+    m_storageMicros += micros() - start;
+
+    if( nb > 0 )
+    {
+        bytesTransferred += nb;
+    }
+
+    if(( nb > 0 ) && written )
+    {
+        if( millis() - m_copyProgress >= FTP_COPY_PROGRESS_TIME )
+        {
+            m_copyProgress = millis();
+
+            // room stays for the final line, nothing of the reply may be sent before it
+            if( m_replyLength < FTP_REPLY_SIZE - 128 )
+            {
+                replyLine( " %lu of %lu bytes copied", (unsigned long)bytesTransferred, (unsigned long)m_copySize );
+            }
+
+            // a long copy must not count as inactivity of the control connection
+            millisEndConnection = millis() + m_server.millisTimeOut;
         }
+
+        return true;
     }
 
-    //
-    //  STRU - File Structure
-    //
-    else if( ! strcmp( command, "STRU" ))
+    uint32_t duration = millis() - millisBeginTrans;
+    endCopy();
+
+    if( written && ( bytesTransferred == m_copySize ))
     {
-        if( ! strcmp( parameters, "F" ))
-        {
-            client.println( "200 F Ok");
-        }
-        else
-        {
-            client.println( "504 Only F(ile) is suported");
-        }
+        reply( 250, "Copy successful, %lu bytes in %lu ms", (unsigned long)bytesTransferred, (unsigned long)duration );
+    }
+    else
+    {
+        // a partial copy is no copy
+        m_fs->remove( transferPath );
+        replyRecode( 451 );
+        reply( 451, "Copy failure after %lu bytes", (unsigned long)bytesTransferred );
     }
 
-    //
-    //  TYPE - Data Type
-    //
-    else if( ! strcmp( command, "TYPE" ))
+    m_server.m_listCache.invalidatePath( transferPath );
+    m_server.m_fileCache.invalidatePath( transferPath );
+
+    log_d( "Copy of %lu bytes in %lu ms, storage %lu ms", (unsigned long)bytesTransferred,
+           (unsigned long)duration, (unsigned long)( m_storageMicros / 1000 ));
+
+    millisEndConnection = millis() + m_server.millisTimeOut;
+    return false;
+}
+
+
+// Close both files of a copy and free its buffer
+void FtpSession::endCopy()
+{
+    m_file.close();
+    m_copyFile.close();
+
+    free( m_pCopyBuffer );
+    m_pCopyBuffer = NULL;
+}
+
+
+void FtpSession::closeTransfer()
+{
+    // the compressed stream of a RETR ends with the data
+    endCompression();
+
+    // the storage writer may still hold the tail of a STOR
+    boolean stored = true;
+    boolean storPipelined = m_storPipe.isActive();
+    boolean retrPipelined = m_retrPipe.isActive();
+
+    if (storPipelined)
     {
-        if( ! strcmp( parameters, "A" ))
-        {
-            client.println( "200 TYPE is now ASII");
-        }
-        else if( ! strcmp( parameters, "I" ))
-        {
-            client.println( "200 TYPE is now 8-bit binary");
-        }
-        else
-        {
-            client.println( "504 Unknow TYPE");
-        }
+        stored = m_storPipe.finish();
     }
 
-    ///////////////////////////////////////
-    //                                   //
-    //        FTP SERVICE COMMANDS       //
-    //                                   //
-    ///////////////////////////////////////
+    boolean coalesced = m_coalescer.isActive();
 
-    //
-    //  ABOR - Abort
-    //
-    else if( ! strcmp( command, "ABOR" ))
+    if (coalesced)
     {
-        abortTransfer();
-        client.println( "226 Data connection closed");
+        uint32_t start = micros();
+        stored = m_coalescer.finish();
+        m_storageMicros += micros() - start;
     }
 
-    //
-    //  DELE - Delete a File 
-    //
-    else if( ! strcmp( command, "DELE" ))
+    boolean inflated = true;
+
+    if (m_inflater.isActive())
+    {
+        inflated = m_inflater.isDone();
+        m_inflater.end();
+    }
+
+    // digests of the received file, for the reply and the hash index
+    char storeHex[FTP_HASH_HEX_SIZE] = "";
+    boolean indexed = (transferStatus == 2) && stored && inflated && m_storeWhole;
+
+    if (indexed && m_hashAlgorithm != FtpHash::CRC32)
+    {
+        m_storeHash.finish(storeHex);
+    }
+
+    // indexed before the answer, the time of the file is final once it is closed
+    if (indexed)
     {
-        char path[ FTP_CWD_SIZE ];
-        if( strlen( parameters ) == 0 )
+        m_file.close();
+
+        File file = m_fs->open(transferPath, "r");
+        char crcHex[FTP_HASH_HEX_SIZE];
+        const char *digests[FtpHash::ALGORITHMS] = { NULL };
+
+        snprintf(crcHex, sizeof(crcHex), "%08lx", (unsigned long)m_storeCrc);
+        digests[FtpHash::CRC32] = crcHex;
+
+        if (storeHex[0])
         {
-            client.println( "501 No file name");
+            digests[m_hashAlgorithm] = storeHex;
         }
-        else if( makePath( path ))
+
+        if (file)
         {
-            if( ! m_fs->exists( path ))
-            {
-                client.println( "550 File " + String(parameters) + " not found");
-            }
-            else
-            {
-                if( m_fs->remove( path ))
-                {
-                    client.println( "250 Deleted " + String(parameters) );
-                }
-                else
-                {
-                    client.println( "450 Can't delete " + String(parameters));
-                }
-            }
+            m_server.m_hashIndex.store(transferPath, file.size(), file.getLastWrite(), digests);
+            file.close();
         }
     }
+    m_storeWhole = false;
 
-    //
-    //  LIST - List 
-    //
-    else if( ! strcmp( command, "LIST" ))
+    // a restarted STOR replaces the end of the file, an old tail behind the data goes
+    boolean cut = true;
+
+    if ((transferStatus == 2) && (m_storeOffset > 0) && stored && inflated)
+    {
+        m_file.close();
+        cut = truncateFile(transferPath, m_storeOffset + bytesTransferred);
+    }
+    m_storeOffset = 0;
+
+    uint32_t deltaT = (int32_t)(millis() - millisBeginTrans);
+    if (!stored)
+    {
+        reply( 451, "Error writing file" );
+    }
+    else if (!cut)
+    {
+        reply( 451, "Can't cut the file after %lu bytes", (unsigned long)bytesTransferred );
+    }
+    else if (!inflated)
+    {
+        reply( 451, "Compressed data corrupt or incomplete" );
+    }
+    else if (deltaT > 0 && bytesTransferred > 0)
     {
-        if( ! dataConnect())
+        replyPart( 226, "File successfully transferred" );
+
+        if (transferStatus == 2)
         {
-            client.println( "425 No data connection");
+            replyPart( 226, "CRC32 %08lx of %lu received bytes", (unsigned long)m_storeCrc, (unsigned long)bytesTransferred );
         }
-        else
+
+        if (storeHex[0])
         {
-            client.println( "150 Accepted data connection");
-            uint16_t nm = 0;
-            File dir = m_fs->open(cwdName);
-            if((!dir)||(!dir.isDirectory()))
-            {
-                client.println( "550 Can't open directory " + String(cwdName) );
-            }
-            else
-            {
-                File file = dir.openNextFile();
-                while( file)
-                {
-    			    String fn, fs;
-                    fn = file.name();
-    			    fn.remove(0, 1);
-
-  			        log_d("File Name = %s", fn.c_str());
-      		        
-                    fs = String(file.size());
-                    
-                    if(file.isDirectory())
-                    {
-                        data.println( "01-01-2000  00:00AM <DIR> " + fn);
-                    }
-                    else 
-                    {
-                        data.println( "01-01-2000  00:00AM " + fs + " " + fn);
-                    }
-                    nm ++;
-                    file = dir.openNextFile();
-                }
+            replyPart( 226, "%s %s", FtpHash::name( m_hashAlgorithm ), storeHex );
+        }
 
-                client.println( "226 " + String(nm) + " matches total");
-            }
-            data.stop();
+        if (m_compressedBytes > 0)
+        {
+            replyPart( 226, "MODE Z: %lu bytes as %lu compressed bytes",
+                       (unsigned long)bytesTransferred, (unsigned long)m_compressedBytes );
         }
-    }
 
-    //
-    //  MLSD - Listing for Machine Processing (see RFC 3659)
-    //
-    else if( ! strcmp( command, "MLSD" ))
-    {
-        if( ! dataConnect())
+        if (storPipelined)
         {
-            client.println( "425 No data connection MLSD");
+            replyPart( 226, "Buffer max %lu of %lu bytes, %lu times full, storage %lu ms",
+                       (unsigned long)m_storPipe.maxFill(), (unsigned long)m_storPipe.size(),
+                       (unsigned long)m_storPipe.fullCount(), (unsigned long)m_storPipe.storageMicros() / 1000 );
+            replyPart( 226, "Writes aligned to %lu bytes, %lu partial writes avoided, %lu partial",
+                       (unsigned long)m_server.m_storageBlock, (unsigned long)m_storPipe.avoidedWrites(),
+                       (unsigned long)m_storPipe.partialWrites() );
         }
-        else
+        else if (coalesced)
         {
-	        client.println( "150 Accepted data connection");
-            uint16_t nm = 0;
-            File dir= m_fs->open(cwdName);
-        
-            if((!dir)||(!dir.isDirectory()))
-            {
-                client.println( "550 Can't open directory " +String(cwdName) );
-            }
-            else
-            {    
-                File file = dir.openNextFile();
+            replyPart( 226, "Writes aligned to %lu bytes, %lu partial writes avoided, %lu partial",
+                       (unsigned long)m_coalescer.block(), (unsigned long)m_coalescer.avoidedWrites(),
+                       (unsigned long)m_coalescer.partialWrites() );
+        }
 
-                while( file)
-                {
-                    String fn,fs;
-                    fn = file.name();
-                    fn.remove(0, strlen(cwdName));
+        if (m_retrPipe.isActive())
+        {
+            m_retrPipe.end();
 
-                    if(fn[0] == '/') 
-                    {
-                        fn.remove(0, 1);
-                    }
-            
-                    fs = String(file.size());
-                    
-                    if(file.isDirectory())
-                    {
-                        data.println( "Type=dir;Size=" + fs + ";"+"modify=20000101000000;" +" " + fn);
-                    } 
-                    else 
-                    {            
-                    data.println( "Type=file;Size=" + fs + ";"+"modify=20000101000000;" +" " + fn);
-                    }
+            // share of the shorter phase that ran in parallel to the other one
+            uint32_t storageMs = m_retrPipe.storageMicros() / 1000;
+            uint32_t networkMs = m_networkMicros / 1000;
+            uint32_t shorterMs = (storageMs < networkMs) ? storageMs : networkMs;
+            uint32_t overlap   = 0;
 
-                    nm ++;
-                    file = dir.openNextFile();
+            if ((shorterMs > 0) && (storageMs + networkMs > deltaT))
+            {
+                overlap = (storageMs + networkMs - deltaT) * 100 / shorterMs;
+                if (overlap > 100)
+                {
+                    overlap = 100;
                 }
-
-                client.println( "226-options: -a -l");
-                client.println( "226 " + String(nm) + " matches total");
             }
 
-            data.stop();
+            replyPart( 226, "Overlap %lu%%, storage %lu ms, network %lu ms",
+                       (unsigned long)overlap, (unsigned long)storageMs, (unsigned long)networkMs );
         }
-    }
 
-    //
-    //  NLST - Name List
-    //
-    else if (!strcmp(command, "NLST"))
+        reply( 226, "%lu ms, %lu kbytes/s", (unsigned long)deltaT, (unsigned long)(bytesTransferred / deltaT) );
+    }
+    else if (transferStatus == 2)
     {
-        if (!dataConnect())
-            client.println("425 No data connection");
-        else
-        {
-            client.println("150 Accepted data connection");
-            uint16_t nm = 0;
-            File dir = m_fs->open(cwdName);
-            if (!m_fs->exists(cwdName))
-                client.println("550 Can't open directory " + String(parameters));
-            else
-            {
-                File file = dir.openNextFile();
-                //        while( dir.next())
-                while (file)
-                {
-                    //          data.println( dir.fileName());
-                    data.println(file.name());
-                    nm++;
-                    file = dir.openNextFile();
-                }
-                client.println("226 " + String(nm) + " matches total");
-            }
-            data.stop();
-        }
+        replyPart( 226, "File successfully transferred" );
+        reply( 226, "CRC32 %08lx of %lu received bytes", (unsigned long)m_storeCrc, (unsigned long)bytesTransferred );
+    }
+    else
+    {
+        reply( 226, "File successfully transferred" );
     }
 
-    //
-    //  NOOP
-    //
-    else if( ! strcmp( command, "NOOP" ))
+    m_retrPipe.end();
+    m_file.close();
+    data.stop();
+    endMapped();
+
+    // the pipelines keep their time after they ended
+    if (retrPipelined)
     {
-        // dataPort = 0;
-        client.println( "200 Zzz...");
+        m_storageMicros += m_retrPipe.storageMicros();
+    }
+    else if (storPipelined)
+    {
+        m_storageMicros += m_storPipe.storageMicros();
     }
 
-    //
-    //  RETR - Retrieve
-    //
-    else if (!strcmp(command, "RETR"))
+    m_server.recordTransfer( transferStatus == 2, stored && inflated && cut,
+                             ( m_compressedBytes > 0 ) ? m_compressedBytes : bytesTransferred,
+                             m_storageMicros, m_networkMicros );
+
+    if (storPipelined)
     {
-        char path[FTP_CWD_SIZE];
-        if (strlen(parameters) == 0)
-        {
-            client.println("501 No file name");
-        }
-        else if (makePath(path))
-        {
-            m_file = m_fs->open(path, "r");
-            if (!m_file)
-            {
-                client.println("550 File " + String(parameters) + " not found");
-            }
-            else if (!m_file)
-            {
-                client.println("450 Can't open " + String(parameters));
-            }
-            else if (!dataConnect())
-            {
-                client.println("425 No data connection");
-            }
-            else
-            {
-                log_i("Sending %s", parameters);
+        m_server.recordStoreWrites( m_storPipe.avoidedWrites(), m_storPipe.partialWrites() );
+    }
+    else if (coalesced)
+    {
+        m_server.recordStoreWrites( m_coalescer.avoidedWrites(), m_coalescer.partialWrites() );
+    }
 
-                client.println("150-Connected to port " + String(dataPort));
-                client.println("150 " + String(m_file.size()) + " bytes to download");
-                millisBeginTrans = millis();
-                bytesTransferred = 0;
-                transferStatus = 1;
-            }
-        }
+    // the stored file changed its size, a RETR meanwhile may have cached a part of it
+    if (transferStatus == 2)
+    {
+        m_server.m_listCache.invalidatePath( transferPath );
+        m_server.m_fileCache.invalidatePath( transferPath );
     }
 
-    //
-    //  STOR - Store
-    //
-    else if( ! strcmp( command, "STOR" ))
+    // a long transfer must not count as inactivity of the control connection
+    millisEndConnection = millis() + m_server.millisTimeOut;
+}
+
+// Send the listing of cwdName over the data connection
+//
+// A cached rendering is sent as is, otherwise the directory is walked and
+// the rendered lines are kept for the next request
+void FtpSession::sendListing(uint8_t format)
+{
+    if( ! beginCompression( m_zLevel ))
     {
-        char path[ FTP_CWD_SIZE ];
-        if( strlen( parameters ) == 0 )
-        {
-            client.println( "501 No file name");
-        }
-        else if( makePath( path ))
-        {
-		    m_file = m_fs->open(path, "w");
-            if( !m_file)
-            {
-                client.println( "451 Can't open/create " +String(parameters) );
-            }
-            else if( ! dataConnect())
-            {
-                client.println( "425 No data connection");
-                m_file.close();
-            }
-            else
-            {                
-                log_d( "Receiving %s", parameters);
-             
-                client.println( "150 Connected to port " + String(dataPort));
-                millisBeginTrans = millis();
-                bytesTransferred = 0;
-                transferStatus = 2;
-            }
-        }
+        reply( 451, "No memory for compression" );
+        data.stop();
+        return;
     }
 
-    //
-    //  MKD - Make Directory
-    //
-    else if( ! strcmp( command, "MKD" ))
+    reply( 150, "Accepted data connection" );
+
+    uint32_t nm = 0;
+    size_t length;
+    const uint8_t *pCached = m_server.m_listCache.acquire( cwdName, (FtpListCache::Format)format, &length, &nm );
+
+    if( pCached )
     {
-        log_d("MKD P=\"%s\" CWD=\"%s\"", parameters, cwdName);
-        
-        String dir;
+        sendData( pCached, length );
+        m_server.m_listCache.release( pCached );
+    }
+    else
+    {
+        // an invalidation from here on means the walk may see an old state
+        uint32_t generation = m_server.m_listCache.generation();
 
-        if (!strcmp(cwdName,"/"))
+        File dir = m_fs->open(cwdName);
+        if((!dir)||(!dir.isDirectory()))
         {
-            dir = String("/") + parameters;
+            reply( 550, "Can't open directory %s", cwdName );
+            m_deflater.end();
+            data.stop();
+            return;
         }
-        else
+
+        // allocated on the first miss and kept for the following ones
+        if( m_pListCapture == NULL )
         {
-            dir = String(cwdName) +"/" + parameters;
+            m_pListCapture = (uint8_t *)malloc( FTP_LIST_CACHE_MAX_SIZE );
         }
+        m_listCapturing = ( m_pListCapture != NULL );
+        m_listCaptureLength = 0;
 
-        log_i("try to create  \"%s\"", dir);
-    
-        
-        if (m_fs->mkdir(dir.c_str()))
+        m_listLength = 0;
+
+        File file = dir.openNextFile();
+        while( file)
         {
-            client.println( "257 \"" + String(parameters) + "\" - Directory successfully created");  
+            // the hash index is the server's, not the client's
+            if( ! m_server.m_hashIndex.isIndex( file.path()))
+            {
+                listEntry( format, file );
+                nm ++;
+            }
+
+            file = dir.openNextFile();
         }
-        else
+
+        listFlush( true );
+
+        if( m_listCapturing )
         {
-	        client.println( "502 Can't create \"" + String(parameters));  
+            m_server.m_listCache.store( cwdName, (FtpListCache::Format)format, m_pListCapture, m_listCaptureLength, nm,
+                                        generation );
+            m_listCapturing = false;
         }
     }
 
-    //
-    //  RMD - Remove a Directory 
-    //
-    else if( ! strcmp( command, "RMD" ))
+    endCompression();
+
+    if( format == FtpListCache::MLSD )
     {
-        log_d("RMD P=\"%s\" CWD=\"%s\"", parameters, cwdName);
+        replyPart( 226, "options: -a -l" );
+    }
+    reply( 226, "%lu matches total", (unsigned long)nm );
+    data.stop();
+}
 
-        String dir;
 
-        if (!strcmp(cwdName,"/"))
-        {
-            dir = String("/") + parameters;
-        }
-        else
+// Copy at most max characters of a string, return the end of the copy
+static char *listCopy(char *pDest, const char *pSrc, size_t max = FTP_FIL_SIZE)
+{
+    while( (*pSrc) && (max --) )
+    {
+        *pDest ++ = *pSrc ++;
+    }
+    return pDest;
+}
+
+
+// Decimal representation of a number, return the end of it
+static char *listNumber(char *pDest, uint32_t value)
+{
+    char digits[10];
+    uint8_t count = 0;
+
+    do
+    {
+        digits[ count ++ ] = '0' + value % 10;
+        value /= 10;
+    } while( value );
+
+    while( count )
+    {
+        *pDest ++ = digits[ -- count ];
+    }
+    return pDest;
+}
+
+
+// Render one directory entry into the staging buffer, no heap is used
+//
+// Full segments are sent once they fill the buffer, the rest waits for
+// the next entries
+void FtpSession::listEntry(uint8_t format, File &file)
+{
+    const char *pName = file.name();
+    char *p = buf + m_listLength;
+
+    // LIST and MLSD show the name only, older cores report the full path
+    if( format != FtpListCache::NLST )
+    {
+        const char *pSlash = strrchr( pName, '/' );
+
+        if( pSlash )
         {
-            dir = String(cwdName) +"/" + parameters;
+            pName = pSlash + 1;
         }
-    
-        if (m_fs->rmdir(dir.c_str()))
+    }
+
+    if( format == FtpListCache::LIST )
+    {
+        // local time like the DOS listing of IIS, the format mirroring clients parse
+        time_t t = file.getLastWrite();
+        struct tm tm;
+        localtime_r( &t, &tm );
+
+        p += sprintf( p, "%02u-%02u-%04u  %02u:%02u%s ", tm.tm_mon + 1, tm.tm_mday, tm.tm_year + 1900,
+                      ( tm.tm_hour % 12 ) ? tm.tm_hour % 12 : 12, tm.tm_min, ( tm.tm_hour < 12 ) ? "AM" : "PM" );
+
+        if( file.isDirectory() )
         {
-            client.println( "250 RMD command successful");  
+            p = listCopy( p, "<DIR> " );
         }
         else
         {
-	        client.println( "502 Can't delete \"" + String(parameters));  //not support on espyet
+            p = listNumber( p, file.size() );
+            *p ++ = ' ';
         }
     }
+    else if( format == FtpListCache::MLSD )
+    {
+        p = listCopy( p, file.isDirectory() ? "Type=dir;Size=" : "Type=file;Size=" );
+        p = listNumber( p, file.size() );
+        p = listCopy( p, ";modify=" );
+        p = makeDateTimeStr( p, file.getLastWrite() ) + 14;
+        p = listCopy( p, "; " );
+    }
 
-    //
-    //  RNFR - Rename From 
-    //
-    else if( ! strcmp( command, "RNFR" ))
+    p = listCopy( p, pName );
+    *p ++ = '\r';
+    *p ++ = '\n';
+
+    m_listLength = p - buf;
+
+    if( m_listLength >= FTP_LIST_FLUSH_SIZE )
     {
-        buf[ 0 ] = 0;
+        listFlush( false );
+    }
+}
 
-        if( strlen( parameters ) == 0 )
-        {
-            client.println( "501 No file name");
-        }
-        else if( makePath( buf ))
-        {
-            if( ! m_fs->exists( buf ))
-            {
-                client.println( "550 File " +String(parameters)+ " not found");
-            }
-            else
-            {
-        #ifdef FTP_DEBUG
-		  Serial.println("Renaming " + String(buf));
-        #endif
-                client.println( "350 RNFR accepted - file exists, ready for destination");     
-                rnfrCmd = true;
-            }
-        }
+
+// Send the staged listing, only whole segments unless all is set
+//
+// Every byte sent is also kept for the listing cache
+void FtpSession::listFlush(boolean all)
+{
+    size_t length = all ? m_listLength : ( m_listLength / FTP_LIST_SEGMENT ) * FTP_LIST_SEGMENT;
+
+    if( length == 0 )
+    {
+        return;
     }
 
-    //
-    //  RNTO - Rename To 
-    //
-    else if( ! strcmp( command, "RNTO" ))
-    {  
-        char path[ FTP_CWD_SIZE ];
-        
-        if( strlen( buf ) == 0 || ! rnfrCmd )
-        {
-            client.println( "503 Need RNFR before RNTO");
-        }
-        else if( strlen( parameters ) == 0 )
+    sendData( (uint8_t *)buf, length );
+
+    if( m_listCapturing )
+    {
+        // too big to be cached
+        if( m_listCaptureLength + length > FTP_LIST_CACHE_MAX_SIZE )
         {
-            client.println( "501 No file name");
+            m_listCapturing = false;
         }
-        else if( makePath( path ))
+        else
         {
-            if( m_fs->exists( path ))
-            {
-                client.println( "553 " +String(parameters)+ " already exists");
-            }
-            else
-            {          
-                log_d("Renaming \"%s\" to \"%s\"", buf, path);            
-                
-                if( m_fs->rename( buf, path ))
-                {
-                    client.println( "250 File successfully renamed or moved");
-                }
-                else
-				{
-                    client.println( "451 Rename/move failure");
-                }
-            }
+            memcpy( m_pListCapture + m_listCaptureLength, buf, length );
+            m_listCaptureLength += length;
         }
-        rnfrCmd = false;
     }
 
-    ///////////////////////////////////////
-    //                                   //
-    //   EXTENSIONS COMMANDS (RFC 3659)  //
-    //                                   //
-    ///////////////////////////////////////
+    m_listLength -= length;
+    memmove( buf, buf + length, m_listLength );
+}
 
-    //
-    //  FEAT - New Features
-    //
-    else if( ! strcmp( command, "FEAT" ))
+
+// Add a line "code-text" to the reply, it is sent together with the final line
+void FtpSession::replyPart(uint16_t code, const char *format, ...)
+{
+    va_list args;
+    va_start( args, format );
+    replyAppend( code, '-', format, args );
+    va_end( args );
+}
+
+
+// Add a free-form continuation line to the reply, e.g. a FEAT entry
+void FtpSession::replyLine(const char *format, ...)
+{
+    va_list args;
+    va_start( args, format );
+    replyAppend( 0, 0, format, args );
+    va_end( args );
+}
+
+
+// Add the final line "code text" and send the complete reply in one write
+void FtpSession::reply(uint16_t code, const char *format, ...)
+{
+    va_list args;
+    va_start( args, format );
+    replyAppend( code, ' ', format, args );
+    va_end( args );
+
+    replyFlush();
+}
+
+
+// Format one reply line into the reply buffer, no heap is used
+//
+// A line not fitting behind the previous ones pushes them out first, an
+// overlong line is truncated
+void FtpSession::replyAppend(uint16_t code, char separator, const char *format, va_list args)
+{
+    char line[ FTP_REPLY_SIZE ];
+    int length = 0;
+
+    if( separator )
     {
-        client.println( "211-Extensions suported:");
-        client.println( " MLSD");
-        client.println( "211 End.");
+        length = snprintf( line, sizeof( line ), "%03u%c", code, separator );
     }
 
-    //
-    //  MDTM - File Modification Time (see RFC 3659)
-    //
-    else if (!strcmp(command, "MDTM"))
+    int text = vsnprintf( line + length, sizeof( line ) - length, format, args );
+    if( text > 0 )
     {
-	    client.println("550 Unable to retrieve time");
+        length += text;
     }
 
-    //
-    //  SIZE - Size of the file
-    //
-    else if( ! strcmp( command, "SIZE" ))
+    if( length > FTP_REPLY_SIZE - 3 )
     {
-        char path[ FTP_CWD_SIZE ];
-        if ( strlen( parameters ) == 0 )
-        {
-            client.println( "501 No file name");
-        }
-        else if( makePath( path ))
-	    {
-		    m_file = m_fs->open(path, "r");
-            if(!m_file)
-            {
-                client.println( "450 Can't open " + String(parameters) );
-            }
-            else
-            {
-                client.println( "213 " + String(m_file.size()));
-                m_file.close();
-            }
-        }
+        length = FTP_REPLY_SIZE - 3;
     }
 
-    //
-    //  SITE - System command
-    //
-    else if( ! strcmp( command, "SITE" ))
+    if( m_replyLength + length + 2 > FTP_REPLY_SIZE )
     {
-        client.println( "500 Unknow SITE command " +String(parameters) );      
+        replyFlush();
     }
 
-    //
-    //  Unrecognized commands ...
-    //
-    else
+    memcpy( m_reply + m_replyLength, line, length );
+    m_replyLength += length;
+    m_reply[ m_replyLength ++ ] = '\r';
+    m_reply[ m_replyLength ++ ] = '\n';
+}
+
+
+// Give the collected multi-line reply the code of its final line
+//
+// A long command starts its reply before the outcome is known, the
+// first line must carry the same code as the last one
+void FtpSession::replyRecode(uint16_t code)
+{
+    if(( m_replyLength > 3 ) && ( m_reply[ 3 ] == '-' ))
     {
-        client.println( "500 Unknow command");
+        m_reply[ 0 ] = '0' + ( code / 100 ) % 10;
+        m_reply[ 1 ] = '0' + ( code / 10 ) % 10;
+        m_reply[ 2 ] = '0' + code % 10;
     }
-  
-    return true;
 }
 
-boolean FtpServer::dataConnect()
+
+void FtpSession::replyFlush()
 {
-  unsigned long startTime = millis();
-  //wait 5 seconds for a data connection
-  if (!data.connected())
-  {
-    while (!m_pDataServer->hasClient() && millis() - startTime < 10000)
-//    while (!dataServer.available() && millis() - startTime < 10000)
-	  {
-		  //delay(100);
-		  yield();
-	  }
-    if (m_pDataServer->hasClient()) {
-//    if (dataServer.available()) {
-		  data.stop();
-		  data = m_pDataServer->available();
-			#ifdef FTP_DEBUG
-		      Serial.println("ftpdataserver client....");
-			#endif
-		
-	  }
-  }
+    if( m_replyLength > 0 )
+    {
+        client.write( (uint8_t *)m_reply, m_replyLength );
+        m_replyLength = 0;
+    }
+}
+
 
-  return data.connected();
+// Bytes up to wanted the running transfer may move now, by its own and the global cap
+size_t FtpSession::transferAllowance(size_t wanted)
+{
+    wanted = m_rateLimiter.allowance(wanted);
 
+    return m_server.m_rateLimiter.allowance(wanted);
 }
 
-boolean FtpServer::doRetrieve()
+
+void FtpSession::transferConsumed(size_t length)
 {
-    //int16_t nb = file.readBytes((uint8_t*) buf, FTP_BUF_SIZE );
-    int16_t nb = m_file.readBytes(buf, FTP_BUF_SIZE);
-    if (nb > 0)
-    {
-        data.write((uint8_t *)buf, nb);
-        bytesTransferred += nb;
-        return true;
-    }
-    closeTransfer();
-    return false;
+    m_rateLimiter.consume(length);
+    m_server.m_rateLimiter.consume(length);
 }
 
 
-boolean FtpServer::doStore()
+// Start a zlib stream on the data connection in MODE Z
+//
+// return:
+//    false, if the compressor got no memory
+boolean FtpSession::beginCompression(uint8_t level)
 {
-    if (data.connected())
-    {
-        uint32_t readCount = data.available() ;
+    return (!m_modeZ) || (m_deflater.begin(level));
+}
 
-        // do not read more bytes than available
-        if (readCount > FTP_BUF_SIZE)
-        {
-            readCount = FTP_BUF_SIZE;
-        };
-        
-        size_t nb = data.readBytes((uint8_t *)buf, readCount);
 
-        if (nb > 0)
-        {
-            size_t written = m_file.write((uint8_t *)buf, nb);
+// Send data as is or through the compressor
+void FtpSession::sendData(const uint8_t *pData, size_t length)
+{
+    if (!m_deflater.isActive())
+    {
+        data.write(pData, length);
+        return;
+    }
 
-            if (written != nb)
-            {
-                log_e("Bytes written (%d) differs from available bytes (%d)", written, nb);
-            }
+    while (length > 0)
+    {
+        size_t taken = m_deflater.write(pData, length);
 
-            bytesTransferred += nb;
-        }
-        else
+        pData  += taken;
+        length -= taken;
+
+        // the output buffer is full
+        if (length > 0)
         {
-            Serial.println(".");
+            sendCompressed();
         }
-        return true;
     }
-    closeTransfer();
-    return false;
 }
 
-void FtpServer::closeTransfer()
+
+void FtpSession::sendCompressed()
 {
-    uint32_t deltaT = (int32_t)(millis() - millisBeginTrans);
-    if (deltaT > 0 && bytesTransferred > 0)
+    const uint8_t *pData;
+    size_t length = m_deflater.output(&pData);
+
+    if (length > 0)
     {
-        client.println("226-File successfully transferred");
-        client.println("226 " + String(deltaT) + " ms, " + String(bytesTransferred / deltaT) + " kbytes/s");
+        data.write(pData, length);
+        m_compressedBytes += length;
+        m_deflater.drain();
     }
-    else
+}
+
+
+// Close the zlib stream and send its tail
+void FtpSession::endCompression()
+{
+    if (!m_deflater.isActive())
     {
-        client.println("226 File successfully transferred");
+        return;
     }
 
-    m_file.close();
-    data.stop();
+    while (!m_deflater.finish())
+    {
+        sendCompressed();
+    }
+
+    sendCompressed();
+    m_deflater.end();
 }
 
-void FtpServer::abortTransfer()
+
+void FtpSession::abortTransfer()
 {
-    if (transferStatus > 0)
+    if (transferStatus == 3)
+    {
+        // a checksum has no data connection and is no transfer
+        m_file.close();
+        endMapped();
+        reply( 426, "Checksum aborted" );
+    }
+    else if (transferStatus == 4)
+    {
+        // a partial copy is no copy
+        endCopy();
+        m_fs->remove( transferPath );
+        m_server.m_listCache.invalidatePath( transferPath );
+        m_server.m_fileCache.invalidatePath( transferPath );
+        replyRecode( 426 );
+        reply( 426, "Copy aborted after %lu bytes", (unsigned long)bytesTransferred );
+    }
+    else if (transferStatus > 0)
     {
+        if (m_retrPipe.isActive())
+        {
+            m_retrPipe.end();
+            m_storageMicros += m_retrPipe.storageMicros();
+        }
+
+        if (m_storPipe.isActive())
+        {
+            m_storPipe.end();
+            m_storageMicros += m_storPipe.storageMicros();
+        }
+
+        m_coalescer.end();
+        m_storeWhole = false;
+        m_deflater.end();
+        m_inflater.end();
         m_file.close();
+        endMapped();
         data.stop();
-        client.println("426 Transfer aborted");
+        reply( 426, "Transfer aborted" );
+
+        // the part stored so far is on the storage
+        if (transferStatus == 2)
+        {
+            m_server.m_listCache.invalidatePath( transferPath );
+            m_server.m_fileCache.invalidatePath( transferPath );
+        }
+
+        m_server.recordTransfer( transferStatus == 2, false,
+                                 ( m_compressedBytes > 0 ) ? m_compressedBytes : bytesTransferred,
+                                 m_storageMicros, m_networkMicros );
         log_w("Transfer aborted!");
     }
     transferStatus = 0;
 }
 
-// Read a char from client connected to ftp server
+// Take everything the client sent so far into the receive buffer
+//
+// return:
+//    true, if there are bytes to parse
+boolean FtpSession::fillReceiveBuffer()
+{
+    int nb = 0;
+
+    if( client.available())
+    {
+        nb = client.read( (uint8_t *) m_rx, sizeof( m_rx ));
+    }
+
+    m_rxPos = 0;
+    m_rxLength = ( nb > 0 ) ? nb : 0;
+
+    return m_rxLength > 0;
+}
+
+// Parse received bytes up to the end of the next line
+//
+//  return:
+//    like readChar(), -1 once no complete line is left
+int8_t FtpSession::readLine()
+{
+    int8_t rc = -1;
+
+    while(( rc == -1 ) && (( m_rxPos < m_rxLength ) || fillReceiveBuffer()))
+    {
+        rc = readChar();
+    }
+
+    return rc;
+}
+
+// Parse the next char of the receive buffer
 //
 //  update cmdLine and command buffers, iCL and parameters pointers
 //
@@ -1078,14 +4226,13 @@ void FtpServer::abortTransfer()
 //    -1 if line not completed
 //     0 if empty line received
 //    length of cmdLine (positive) if no empty line received 
-int8_t FtpServer::readChar()
+int8_t FtpSession::readChar()
 {
     int8_t rc = -1;
 
-    if( client.available())
+    if( m_rxPos < m_rxLength )
     {
-        char c = client.read();
-	 
+        char c = m_rx[ m_rxPos ++ ];
 
         if( c == '\\' )
         {
@@ -1095,7 +4242,7 @@ int8_t FtpServer::readChar()
         {
             if( c != '\n' )
             {
-                if( iCL < FTP_CMD_SIZE )
+                if( iCL < FTP_CMD_SIZE - 1 )   // room for the terminating 0
                 {
                     cmdLine[ iCL ++ ] = c;
                 }
@@ -1122,7 +4269,7 @@ int8_t FtpServer::readChar()
                     parameters = strchr( cmdLine, ' ' );
                     if( parameters != NULL )
                     {
-                        if( parameters - cmdLine > 4 )
+                        if( parameters - cmdLine > (int)sizeof( command ) - 1 )
                         {
                             rc = -2; // Syntax error
                         }
@@ -1135,13 +4282,14 @@ int8_t FtpServer::readChar()
                             ;
                         }
                     }
-                    else if( strlen( cmdLine ) > 4 )
+                    else if( strlen( cmdLine ) > sizeof( command ) - 1 )
                     {
                         rc = -2; // Syntax error.
                     }
                     else
                     {
                         strcpy( command, cmdLine );
+                        parameters = cmdLine + iCL; // no parameter, empty string
                     }
                     iCL = 0;
                 }
@@ -1151,21 +4299,113 @@ int8_t FtpServer::readChar()
 
         if( rc > 0 )
         {
+            commandKey = 0;
             for( uint8_t i = 0 ; i < strlen( command ); i ++ )
             {
                 command[ i ] = toupper( command[ i ] );
+                if( i < 4 )
+                {
+                    commandKey = ( commandKey << 8 ) | (uint8_t)command[ i ];
+                }
             }
         }
 
         if( rc == -2 )
         {
             iCL = 0;
-            client.println( "500 Syntax error");
+            reply( 500, "Syntax error" );
         }
     }
     return rc;
 }
 
+// Files compressed already, MODE Z sends them in stored blocks
+static const char *s_compressedExtensions[] =
+{
+    ".gz", ".tgz", ".zip", ".7z", ".bz2", ".xz", ".zst",
+    ".jpg", ".jpeg", ".png", ".gif", ".webp", ".mp3", ".mp4", ".ogg", ".avi", ".mkv",
+};
+
+boolean FtpSession::isCompressedFile( const char * path )
+{
+    size_t length = strlen( path );
+
+    for( uint8_t i = 0; i < sizeof( s_compressedExtensions ) / sizeof( s_compressedExtensions[ 0 ] ); i ++ )
+    {
+        size_t extLength = strlen( s_compressedExtensions[ i ] );
+
+        if(( length > extLength ) && ! strcasecmp( path + length - extLength, s_compressedExtensions[ i ] ))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The hash index belongs to the server, clients neither see nor change it
+//
+// return:
+//    true, if path is the index and 550 was answered
+boolean FtpSession::isReserved( const char * path )
+{
+    if( ! m_server.m_hashIndex.isIndex( path ))
+    {
+        return false;
+    }
+
+    reply( 550, "%s is reserved by the server", path );
+    return true;
+}
+
+// Collapse repeated separators, "." and ".." segments of an absolute path in place
+//
+// ".." never leaves the root. Two spellings of one file must not pass
+// isReserved() differently
+static void normalizePath( char * path )
+{
+    char * pOut = path;
+    const char * pIn = path;
+
+    while( *pIn )
+    {
+        while( *pIn == '/' )
+        {
+            pIn ++;
+        }
+
+        const char * pSegment = pIn;
+        while(( *pIn ) && ( *pIn != '/' ))
+        {
+            pIn ++;
+        }
+        size_t length = pIn - pSegment;
+
+        if(( length == 0 ) || (( length == 1 ) && ( pSegment[ 0 ] == '.' )))
+        {
+            continue;
+        }
+
+        if(( length == 2 ) && ( pSegment[ 0 ] == '.' ) && ( pSegment[ 1 ] == '.' ))
+        {
+            // back to the separator of the previous segment
+            while(( pOut > path ) && ( *-- pOut != '/' ))
+            {
+            }
+            continue;
+        }
+
+        *pOut ++ = '/';
+        memmove( pOut, pSegment, length );
+        pOut += length;
+    }
+
+    if( pOut == path )
+    {
+        *pOut ++ = '/';
+    }
+    *pOut = 0;
+}
+
 // Make complete path/name from cwdName and parameters
 //
 // 3 possible cases: parameters can be absolute path, relative path or only the name
@@ -1175,13 +4415,13 @@ int8_t FtpServer::readChar()
 //
 // return:
 //    true, if done
-boolean FtpServer::makePath( char * fullName )
+boolean FtpSession::makePath( char * fullName )
 {
     return makePath( fullName, parameters );
 }
 
 
-boolean FtpServer::makePath( char * fullName, char * param )
+boolean FtpSession::makePath( char * fullName, char * param )
 {
     if (param == NULL)
     {
@@ -1210,74 +4450,170 @@ boolean FtpServer::makePath( char * fullName, char * param )
         strcpy(fullName, param);
     }
 
-    // If ends with '/', remove it
-    uint16_t strl = strlen(fullName) - 1;
-    if (fullName[strl] == '/' && strl > 1)
-    {
-        fullName[strl] = 0;
-    }    
+    // also removes a trailing '/'
+    normalizePath(fullName);
+
     if (strlen(fullName) < FTP_CWD_SIZE)
     {
         return true;
     }
 
-    client.println("500 Command line too long");
+    reply( 500, "Command line too long" );
     return false;
 }
 
-// Calculate year, month, day, hour, minute and second
-//   from first parameter sent by MDTM command (YYYYMMDDHHMMSS)
+// Calculate the time from the first parameter sent by MFMT (YYYYMMDDHHMMSS)
 //
 // parameters:
-//   pyear, pmonth, pday, phour, pminute and psecond: pointer of
-//     variables where to store data
+//   pText: time in UTC, followed by a space and the name of the file
+//   pTime: where to store the seconds since 1970
 //
 // return:
 //    0 if parameter is not YYYYMMDDHHMMSS
 //    length of parameter + space
 
-uint8_t FtpServer::getDateTime( uint16_t * pyear, uint8_t * pmonth, uint8_t * pday,
-                                uint8_t * phour, uint8_t * pminute, uint8_t * psecond )
+uint8_t FtpSession::getDateTime( const char * pText, time_t * pTime )
 {
     char dt[15];
 
     // Date/time are expressed as a 14 digits long string
     //   terminated by a space and followed by name of file
-    if (strlen(parameters) < 15 || parameters[14] != ' ')
+    if (strlen(pText) < 15 || pText[14] != ' ')
         return 0;
     for (uint8_t i = 0; i < 14; i++)
-        if (!isdigit(parameters[i]))
+        if (!isdigit(pText[i]))
             return 0;
 
-    strncpy(dt, parameters, 14);
+    strncpy(dt, pText, 14);
     dt[14] = 0;
-    *psecond = atoi(dt + 12);
+    int second = atoi(dt + 12);
     dt[12] = 0;
-    *pminute = atoi(dt + 10);
+    int minute = atoi(dt + 10);
     dt[10] = 0;
-    *phour = atoi(dt + 8);
+    int hour = atoi(dt + 8);
     dt[8] = 0;
-    *pday = atoi(dt + 6);
+    int day = atoi(dt + 6);
     dt[6] = 0;
-    *pmonth = atoi(dt + 4);
+    int month = atoi(dt + 4);
     dt[4] = 0;
-    *pyear = atoi(dt);
+    int year = atoi(dt);
+
+    if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+        return 0;
+
+    // days since 1970 of the civil date, newlib has no timegm()
+    int y = year - (month <= 2);
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = (long)era * 146097 + doe - 719468;
+
+    *pTime = (time_t)days * 86400 + hour * 3600 + minute * 60 + second;
     return 15;
 }
 
-// Create string YYYYMMDDHHMMSS from date and time
+// Set the modification time of a file
+//
+// fs::FS has no call for it, the time is set with utime() on the path of
+// the file in the VFS. Answers the errors itself
+//
+// return:
+//    true, if done
+boolean FtpSession::setFileTime( char * pName, time_t t )
+{
+    char path[ FTP_CWD_SIZE ];
+
+    if( ! makePath( path, pName ) || isReserved( path ))
+    {
+        return false;
+    }
+
+    File file;
+
+    if( *pName )
+    {
+        file = m_fs->open( path, "r" );
+    }
+
+    if( ! file )
+    {
+        reply( 550, "File %s not found", pName );
+        return false;
+    }
+
+    time_t before = file.getLastWrite();
+    file.close();
+
+    String vfsPath = m_server.m_mountPoint + path;
+    struct utimbuf times;
+    times.actime = t;
+    times.modtime = t;
+
+    if( utime( vfsPath.c_str(), &times ) != 0 )
+    {
+        reply( 550, "Can't set the time of %s", pName );
+        return false;
+    }
+
+    // the file system may round the time, e.g. FAT to 2 s
+    file = m_fs->open( path, "r" );
+    time_t after = file ? file.getLastWrite() : t;
+    file.close();
+
+    // listings show the time, a known digest stays valid
+    m_server.m_listCache.invalidatePath( path );
+    m_server.m_hashIndex.retime( path, before, after );
+    m_server.m_fileCache.invalidatePath( path );
+    return true;
+}
+
+// Cut a file behind length bytes
+//
+// fs::FS has no call for it either, truncate() works on the path in the VFS.
+// A file not longer than length is left alone, the file system need not
+// support truncate() then
+//
+// return:
+//    true, if the file ends at length at the latest
+boolean FtpSession::truncateFile( const char * path, uint32_t length )
+{
+    File file = m_fs->open( path, "r" );
+    size_t size = file ? file.size() : 0;
+    file.close();
+
+    if( size <= length )
+    {
+        return true;
+    }
+
+    String vfsPath = m_server.m_mountPoint + path;
+
+    if( truncate( vfsPath.c_str(), length ) != 0 )
+    {
+        log_e( "Can't truncate %s to %lu bytes", vfsPath.c_str(), (unsigned long)length );
+        return false;
+    }
+
+    return true;
+}
+
+// Create string YYYYMMDDHHMMSS from a file time, in UTC as RFC 3659 demands
 //
 // parameters:
-//    date, time 
+//    t : seconds since 1970 as returned by File::getLastWrite()
 //    tstr: where to store the string. Must be at least 15 characters long
 //
 // return:
 //    pointer to tstr
 
-char * FtpServer::makeDateTimeStr( char * tstr, uint16_t date, uint16_t time )
+char * FtpSession::makeDateTimeStr( char * tstr, time_t t )
 {
+    struct tm tm;
+    gmtime_r( &t, &tm );
+
     sprintf(tstr, "%04u%02u%02u%02u%02u%02u",
-            ((date & 0xFE00) >> 9) + 1980, (date & 0x01E0) >> 5, date & 0x001F,
-            (time & 0xF800) >> 11, (time & 0x07E0) >> 5, (time & 0x001F) << 1);
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+            tm.tm_hour, tm.tm_min, tm.tm_sec);
     return tstr;
 }
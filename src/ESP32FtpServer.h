@@ -34,37 +34,134 @@
 #ifndef FTP_SERVERESP_H
 #define FTP_SERVERESP_H
 
+#include <stdarg.h>
+
 #include <FS.h>
 #include <SD.h>
 #include <WiFi.h>
 #include <WiFiClient.h>
 
+#include "FtpDeflate.h"
+#include "FtpEvents.h"
+#include "FtpFileCache.h"
+#include "FtpHash.h"
+#include "FtpHashIndex.h"
+#include "FtpListCache.h"
+#include "FtpMappedFile.h"
+#include "FtpMetrics.h"
+#include "FtpPipeline.h"
+#include "FtpRateLimiter.h"
+#include "FtpWriteCoalescer.h"
+
 #define FTP_SERVER_VERSION "0.1.0"
 
+#ifndef FTP_CTRL_PORT
 #define FTP_CTRL_PORT    21          // Command port on which server is listening
-#define FTP_DATA_PORT_PASV 50009     // Data port in passive mode
+#endif
+#ifndef FTP_DATA_PORT_PASV
+#define FTP_DATA_PORT_PASV 50009     // First data port in passive mode
+#endif
+#ifndef FTP_DATA_PORT_COUNT
+#define FTP_DATA_PORT_COUNT 16       // passive ports from FTP_DATA_PORT_PASV on, handed out in turn
+#endif
+#define FTP_DATA_PORT_ATTEMPTS 4     // ports PASV tries when binding fails, e.g. while one is still in use
 
+#define FTP_MAX_SESSIONS 2        // max number of concurrent control connections
 #define FTP_TIME_OUT  5           // Disconnect client after 5 minutes of inactivity
+#define FTP_DATA_TIME_OUT 10      // seconds a command waits for its data connection
 #define FTP_CMD_SIZE 255 + 8 // max size of a command
 #define FTP_CWD_SIZE 255 + 8 // max size of a directory name
 #define FTP_FIL_SIZE 255     // max size of a file name
+#define FTP_REPLY_SIZE 512   // replies are collected up to this size and sent in one write
+#define FTP_RX_SIZE 512      // bytes taken from the control connection at once
 //#define FTP_BUF_SIZE (8192*1)-1 //512   // size of file buffer for read/write
+#ifndef FTP_BUF_SIZE
 #define FTP_BUF_SIZE 4096 //512   // size of file buffer for read/write
+#endif
+#define FTP_RETR_BUFFERS 2        // blocks of FTP_BUF_SIZE read ahead during RETR, below 2 reads serially
+#define FTP_STOR_RING_SIZE 16384  // ring between socket and storage writer during STOR, 0 writes directly
+#define FTP_STOR_CHUNK 4096       // storage block, STOR writes end on its boundaries, setStorageBlockSize() changes it
+#define FTP_MAX_MAPPED_FILES 4    // read-only files served from memory-mapped partitions
+#define FTP_MAPPED_SEND_SIZE 65536 // bytes of a mapped file handed to the socket per step
+#define FTP_DEFLATE_LEVEL 6       // MODE Z compression, 1 fastest .. 9 smallest, OPTS MODE Z LEVEL changes it
+#define FTP_RATE_LIMIT 0          // bytes/s of all transfers together, 0 is unlimited, SITE RATE changes it
+#define FTP_RATE_LIMIT_TRANSFER 0 // bytes/s of a single transfer, 0 is unlimited
+#define FTP_RATE_BURST 16384      // bytes a transfer may move at once after a pause
+#define FTP_HASH_ALGORITHM FtpHash::SHA256 // digest of HASH, OPTS HASH changes it
+#define FTP_MOUNT_POINT "/sd"     // where the file system is mounted in the VFS, MFMT and REST+STOR use it
 
-class FtpServer
+#define FTP_LIST_SEGMENT 1436     // listings are sent in multiples of this, the TCP MSS of lwIP
+#define FTP_LIST_MAX_ENTRY (FTP_FIL_SIZE + 64) // longest rendered listing line
+#define FTP_LIST_FLUSH_SIZE (((FTP_BUF_SIZE - FTP_LIST_MAX_ENTRY) / FTP_LIST_SEGMENT) * FTP_LIST_SEGMENT)
+
+#define FTP_TASK_CORE 0           // core the optional transfer task is pinned to
+#define FTP_TASK_PRIORITY 2       // priority of the optional transfer task
+#define FTP_TASK_STACK_SIZE 4096  // stack size of the optional transfer task
+#define FTP_TASK_IDLE_WAIT 100    // ms the transfer task sleeps without an active transfer
+#define FTP_SERVER_TASK_CORE 1           // core the optional server task is pinned to
+#define FTP_SERVER_TASK_PRIORITY 1       // priority of the optional server task
+#define FTP_SERVER_TASK_STACK_SIZE 8192  // stack size of the optional server task, commands run in it
+#define FTP_EVENT_MAX_WAIT 1000          // ms the server task sleeps at most without a socket event
+#define FTP_EVENT_TRANSFER_WAIT 1        // ms the server task sleeps while a transfer waits for storage or the rate limit
+
+#define FTP_MAX_SITE_COMMANDS 8   // SITE subcommands an application can add
+#define FTP_SITE_NAME_SIZE 12     // max size of a SITE subcommand name
+#define FTP_COPY_BUF_SIZE 16384   // buffer of SITE CPTO, without memory for it FTP_BUF_SIZE is used
+#define FTP_COPY_PROGRESS_TIME 2000 // ms between the progress lines in the reply of SITE CPTO
+
+class FtpServer;
+
+/**
+ * @brief Handler of an application defined SITE subcommand
+ *
+ * Gets the arguments following the subcommand name, writes the reply text
+ * into pText (size bytes) and returns the reply code.
+ * */
+typedef uint16_t (*FtpSiteCallback)(const char *pArgs, char *pText, size_t size, void *pContext);
+
+/**
+ * @brief State of one control connection, its data channel and its transfer
+ *
+ * The server owns FTP_MAX_SESSIONS of these and services them round-robin.
+ * */
+class FtpSession
 {
 public:
-    FtpServer();
-    ~FtpServer();
+    FtpSession(FtpServer &server, uint8_t id);
+    ~FtpSession();
 
     /**
-     * @brief
+     * @brief Start the passive data listener of this session
+     * 
+     * */
+    bool begin();
+
+    /**
+     * @brief Session is waiting for a new control connection
      * 
      * */
-    bool begin(String uname, String pword, fs::FS &fs = SD);
+    bool isFree();
+
+    /**
+     * @brief Session is closing its last connection and becomes free shortly
+     * 
+     * */
+    bool isReleasing();
+
+    /**
+     * @brief Hand a freshly accepted control connection to this session
+     * 
+     * */
+    void attach(const WiFiClient &newClient);
+
+    /**
+     * @brief Cap the bandwidth of the transfers of this session, 0 is unlimited
+     *
+     * */
+    void setRateLimit(uint32_t rate, uint32_t burst);
 
     /** 
-     * @brief
+     * @brief Run one step of the command state machine and the transfer
      * 
      * */
     int handleFTP();
@@ -75,25 +172,135 @@ public:
      * */
     uint8_t isConnected();
 
+    /**
+     * @brief Port the passive listener is open on, 0 if none
+     *
+     * */
+    uint16_t passivePort() { return m_pasvPort; }
+
+    /**
+     * @brief A STOR or SITE CPTO of the session is writing path
+     *
+     * */
+    bool isWriting(const char *path) { return ((transferStatus == 2) || (transferStatus == 4)) && (!strcmp(transferPath, path)); }
+
+    /**
+     * @brief Move the data of a running RETR/STOR, called by the transfer task
+     *
+     * Returns true while a transfer is active, pProgress reports whether
+     * any byte was moved.
+     * */
+    bool transferStep(bool *pProgress);
+
+    /**
+     * @brief Add the sockets and timeouts the server task waits for
+     *
+     * */
+    void addEvents(FtpEventSet &events);
+
 private:
     void iniVariables();
     void clientConnected();
     void disconnectClient();
-    boolean userIdentity();
-    boolean userPassword();
     boolean processCommand();
     boolean dataConnect();
+    boolean openPassive();
+    void closePassive();
     boolean doRetrieve();
+    void endMapped();
     boolean doStore();
+    boolean doHash();
+    boolean doCopy();
+    void endCopy();
+    boolean startHash(FtpHash::Algorithm algorithm, char *pName, uint32_t start, uint32_t end, boolean hashReply);
+    boolean parseHashRange(char **ppName, uint32_t *pStart, uint32_t *pEnd);
+    void replyHash(FtpHash::Algorithm algorithm, const char *pHex);
+    void storeReceived(const uint8_t *pData, size_t length);
+    boolean storeFile(boolean append);
+    boolean pumpTransfer();
     void closeTransfer();
+    size_t transferAllowance(size_t wanted);
+    void transferConsumed(size_t length);
     void abortTransfer();
+    void reply(uint16_t code, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    void replyPart(uint16_t code, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    void replyLine(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void replyAppend(uint16_t code, char separator, const char *format, va_list args);
+    void replyFlush();
+    void replyRecode(uint16_t code);
+    void sendListing(uint8_t format);
+    void listEntry(uint8_t format, File &file);
+    void listFlush(boolean all);
+    boolean beginCompression(uint8_t level);
+    void sendData(const uint8_t *pData, size_t length);
+    void sendCompressed();
+    void endCompression();
+    boolean doStoreCompressed();
+    boolean isCompressedFile(const char *path);
+    boolean isReserved(const char *path);
     boolean makePath(char *fullname);
     boolean makePath(char *fullName, char *param);
-    uint8_t getDateTime(uint16_t *pyear, uint8_t *pmonth, uint8_t *pday,
-                        uint8_t *phour, uint8_t *pminute, uint8_t *second);
-    char *makeDateTimeStr(char *tstr, uint16_t date, uint16_t time);
+    uint8_t getDateTime(const char *pText, time_t *pTime);
+    char *makeDateTimeStr(char *tstr, time_t t);
+    void processCommands();
+    void processUrgentCommand();
+    boolean fillReceiveBuffer();
+    int8_t readLine();
     int8_t readChar();
 
+    // command handlers, return false to close the control connection
+    boolean cmdAbor();
+    boolean cmdAppe();
+    boolean cmdCdup();
+    boolean cmdCwd();
+    boolean cmdDele();
+    boolean cmdEpsv();
+    boolean cmdFeat();
+    boolean cmdHash();
+    boolean cmdList();
+    boolean cmdMdtm();
+    boolean cmdMfmt();
+    boolean cmdMkd();
+    boolean cmdMlsd();
+    boolean cmdMlst();
+    boolean cmdMode();
+    boolean cmdNlst();
+    boolean cmdNoop();
+    boolean cmdOpts();
+    boolean cmdPass();
+    boolean cmdPasv();
+    boolean cmdPort();
+    boolean cmdPwd();
+    boolean cmdQuit();
+    boolean cmdRest();
+    boolean cmdRetr();
+    boolean cmdRmd();
+    boolean cmdRnfr();
+    boolean cmdRnto();
+    boolean cmdSite();
+    boolean siteRate(const char *pArgs);
+    boolean siteStats(const char *pArgs);
+    boolean siteUtime(const char *pArgs);
+    boolean siteCpfr(const char *pArgs);
+    boolean siteCpto(const char *pArgs);
+    boolean setFileTime(char *pName, time_t t);
+    boolean truncateFile(const char *path, uint32_t length);
+    boolean cmdSize();
+    boolean cmdStor();
+    boolean cmdStru();
+    boolean cmdType();
+    boolean cmdUser();
+    boolean cmdXcrc();
+    boolean cmdXmd5();
+    boolean cmdXsha();
+
+    struct Command;
+    static const Command s_commands[]; // dispatch table, sorted by key
+    static const Command *findCommand(uint32_t key);
+
+    FtpServer &m_server; // server owning this session
+    uint8_t m_id;        // index in the session table
+
     IPAddress dataIp; // IP address of client for data
     WiFiClient client;
     WiFiClient data;
@@ -102,17 +309,77 @@ private:
     File m_file;  //
 
     boolean dataPassiveConn;
+    boolean dataArmed;          // PASV received, accept the data connection as soon as it arrives
+    boolean dataPending;        // current command waits for its data connection
+    boolean dataRetry;          // current command is re-run after waiting for the data connection
+    boolean m_epsvAll;          // EPSV ALL received, no other data connection setup allowed
     uint16_t dataPort;
+    uint16_t m_pasvPort;        // port of the open passive listener, 0 while closed
     char buf[FTP_BUF_SIZE];     // data buffer for transfers
     char cmdLine[FTP_CMD_SIZE]; // where to store incoming char from client
     char cwdName[FTP_CWD_SIZE]; // name of current directory
-    char command[5];            // command sent by client
+    char transferPath[FTP_CWD_SIZE]; // file of the running STOR
+    char m_fromPath[FTP_CWD_SIZE];   // source of RNFR or SITE CPFR, buf may hold upload data meanwhile
+    char command[9];            // command sent by client, up to 8 letters
+    uint32_t commandKey;        // command packed into 32 bit, key of the dispatch table
     boolean rnfrCmd;            // previous command was RNFR
+    boolean cpfrCmd;            // previous command was SITE CPFR, the source is in m_fromPath like for RNFR
     char *parameters;           // point to begin of parameters sent by client
     uint16_t iCL;               // pointer to cmdLine next incoming char
+    char m_rx[FTP_RX_SIZE];     // bytes read from the control connection, not parsed yet
+    uint16_t m_rxLength;
+    uint16_t m_rxPos;           // next byte of m_rx to parse
+    uint32_t m_restartOffset;   // set by REST, where the next RETR/STOR starts
+    uint32_t m_storeOffset;     // restart offset of the running STOR, the file is cut behind its data
+
+    FtpListener m_dataListener; // opened by PASV/EPSV, on a new port each time
+    uint32_t m_eventBytes;      // bytesTransferred when the server task last waited
+    SemaphoreHandle_t m_lock; // hands the transfer over between handleFTP() and the transfer task
+
+    FtpRetrievePipeline m_retrPipe; // storage read-ahead of the running RETR
+    uint32_t m_networkMicros;       // time spent in socket reads/writes of the running transfer
+    uint32_t m_storageMicros;       // time spent in file reads/writes of the running transfer, without pipelines
+    size_t m_retrBlockPos;          // bytes of the current read-ahead block already sent
+    FtpStorePipeline m_storPipe;    // ring and storage writer of the running STOR
+    FtpWriteCoalescer m_coalescer;  // block aligned writes of a STOR without the ring
+    FtpRateLimiter m_rateLimiter;   // per transfer bandwidth cap
+
+    const uint8_t *m_pMappedData;   // RETR of a mapped partition, sent without a copy
+    size_t m_mappedSize;
+    size_t m_mappedPos;
+    const uint8_t *m_pCachedData;   // file cache entry pinned by the running RETR, sent like a mapped file
+
+    File m_copyFile;                // target of the running SITE CPTO, m_file is the source
+    uint8_t *m_pCopyBuffer;         // FTP_COPY_BUF_SIZE bytes, NULL while buf is used
+    uint32_t m_copySize;            // bytes of the source
+    uint32_t m_copyProgress;        // millis() of the last progress line
+
+    uint8_t *m_pListCapture;        // FTP_LIST_CACHE_MAX_SIZE bytes kept for the session, listing for the cache
+    size_t m_listCaptureLength;
+    boolean m_listCapturing;        // the listing being sent still fits m_pListCapture
+    size_t m_listLength;            // listing bytes staged in buf
+
+    boolean m_modeZ;                // MODE Z, the data connection carries zlib streams
+    uint8_t m_zLevel;               // compression level of MODE Z
+    FtpDeflater m_deflater;         // compresses RETR data and listings in MODE Z
+    FtpInflater m_inflater;         // decompresses STOR data in MODE Z
+    size_t m_zInPos;                // compressed STOR bytes in the lower half of buf
+    size_t m_zInLength;
+    boolean m_zFailed;              // compressed STOR data is corrupt
+    uint32_t m_compressedBytes;     // bytes of the zlib stream of the running transfer
+
+    FtpHash m_hash;                 // digest of the running HASH/XCRC/XMD5/XSHA
+    FtpHash::Algorithm m_hashAlgorithm; // selected by OPTS HASH
+    uint32_t m_hashStart;           // range of the running digest, end excluded
+    uint32_t m_hashEnd;
+    boolean m_hashReply;            // answer in the format of HASH, else of XCRC/XMD5/XSHA
+    boolean m_hashWhole;            // the running digest covers the whole file, it goes into the hash index
+    uint32_t m_storeCrc;            // CRC-32 of the bytes received by the running STOR
+    boolean m_storeWhole;           // the running STOR writes the file from its start, its digests go into the index
+    FtpHash m_storeHash;            // digest of the OPTS HASH algorithm of the bytes received by the running STOR
 
-    WiFiServer *m_pCommandServer;
-    WiFiServer *m_pDataServer;
+    char m_reply[FTP_REPLY_SIZE];   // reply collected for one write to the control connection
+    size_t m_replyLength;
 
     enum class CmdStatus
     {
@@ -124,12 +391,234 @@ private:
         READY,
     } cmdStatus;
 
-    int8_t transferStatus;  // status of ftp data transfer
-    uint32_t millisTimeOut, // disconnect after 5 min of inactivity
-        millisDelay,
+    volatile int8_t transferStatus;  // status of ftp data transfer, 3 while a checksum is computed, 4 while a file is copied
+    uint32_t millisDelay,
         millisEndConnection, //
+        millisDataTimeOut,   // give up waiting for the data connection
+        m_dataWaitStart,     // micros() when the command started waiting for the data connection
         millisBeginTrans,    // store time of beginning of a transaction
         bytesTransferred;    //
+};
+
+class FtpServer
+{
+public:
+    FtpServer();
+    ~FtpServer();
+
+    /**
+     * @brief Start listening, serving fs
+     * 
+     * mountPoint is where fs was mounted, e.g. "/spiffs" for SPIFFS.
+     * fs::FS can't set file times or cut files, MFMT and STOR after REST
+     * go through the VFS path.
+     * */
+    bool begin(String uname, String pword, fs::FS &fs = SD, const char *mountPoint = FTP_MOUNT_POINT);
+
+    /** 
+     * @brief
+     * 
+     * */
+    int handleFTP();
+
+    /**
+     * @brief Number of sessions with a connected control client
+     * 
+     * */
+    uint8_t isConnected();
+
+    /**
+     * @brief Listings served from the listing cache / rendered by walking the directory
+     * 
+     * */
+    uint32_t listCacheHits() { return m_listCache.hits(); }
+    uint32_t listCacheMisses() { return m_listCache.misses(); }
+
+    /**
+     * @brief Checksums answered from the hash index / computed by reading the file
+     * 
+     * */
+    uint32_t hashIndexHits() { return m_hashIndex.hits(); }
+    uint32_t hashIndexMisses() { return m_hashIndex.misses(); }
+
+    /**
+     * @brief Keep small files in memory, RETR and SIZE of a hot file skip the file system
+     *
+     * Must be called before begin(). size bytes hold all cached files in
+     * PSRAM, files above maxFileSize are read from the file system as
+     * before. Without PSRAM on the ESP32 the cache stays off.
+     * */
+    void enableFileCache(size_t size = FTP_FILE_CACHE_SIZE, size_t maxFileSize = FTP_FILE_CACHE_MAX_FILE);
+
+    /**
+     * @brief RETR/SIZE answered from the file cache / by the file system, files evicted to make room
+     *
+     * */
+    uint32_t fileCacheHits() { return m_fileCache.hits(); }
+    uint32_t fileCacheMisses() { return m_fileCache.misses(); }
+    uint32_t fileCacheEvictions() { return m_fileCache.evictions(); }
+    size_t fileCacheUsed() { return m_fileCache.used(); }
+
+    /**
+     * @brief Pump RETR/STOR data from a dedicated task instead of handleFTP()
+     *
+     * Must be called before begin(). The control protocol stays in
+     * handleFTP(), the task moves the data as fast as storage and network
+     * allow, independent of the loop rate of the application.
+     * */
+    void enableTransferTask(BaseType_t core = FTP_TASK_CORE,
+                            UBaseType_t priority = FTP_TASK_PRIORITY,
+                            uint32_t stackSize = FTP_TASK_STACK_SIZE);
+
+    /**
+     * @brief Run the whole server in its own task, woken by socket events
+     *
+     * Must be called before begin(). The task sleeps in select() until a
+     * client connects, sends a command or a data connection is ready, so
+     * replies don't wait for the loop() of the application and an idle
+     * server takes no CPU. handleFTP() then only reports the state. Can be
+     * combined with enableTransferTask().
+     * */
+    void enableServerTask(BaseType_t core = FTP_SERVER_TASK_CORE,
+                          UBaseType_t priority = FTP_SERVER_TASK_PRIORITY,
+                          uint32_t stackSize = FTP_SERVER_TASK_STACK_SIZE);
+
+    /**
+     * @brief Serve a flash data partition as read-only file path
+     *
+     * RETR sends straight from the memory-mapped flash instead of copying
+     * through the transfer buffer. length 0 serves the whole partition, on
+     * a host build label is the path of a file standing in for it.
+     * */
+    bool addMappedFile(const char *path, const char *label, size_t length = 0);
+
+    /**
+     * @brief Add a SITE subcommand, e.g. "SITE REBOOT"
+     *
+     * The name is matched case-insensitively, only logged in clients reach
+     * it. The callback runs in handleFTP() with pContext passed through.
+     * */
+    bool addSiteCommand(const char *name, FtpSiteCallback callback, void *pContext = NULL);
+
+    /**
+     * @brief Cap the data bandwidth in bytes/s, 0 is unlimited
+     *
+     * rate is shared by all transfers, transferRate applies to each one.
+     * Throttled transfers pause without blocking handleFTP(), burst bytes
+     * may be moved at once after a pause. Running transfers follow at once.
+     * */
+    void setRateLimit(uint32_t rate, uint32_t transferRate, uint32_t burst = FTP_RATE_BURST);
+
+    uint32_t rateLimit() { return m_rateLimiter.rate(); }
+    uint32_t transferRateLimit() { return m_transferRate; }
+    uint32_t rateBurst() { return m_rateBurst; }
+
+    /**
+     * @brief Copy of the counters, also shown by SITE STATS
+     *
+     * Safe to call while transfers run in the transfer task.
+     * */
+    void metrics(FtpMetrics *pMetrics);
+
+    /**
+     * @brief Block size of the storage, e.g. the cluster of a FAT or the page of a flash file system
+     *
+     * Uploads are written in pieces ending on its boundaries, only the tail
+     * of a file is a partial write. fs::FS does not tell the geometry, so
+     * it is FTP_STOR_CHUNK unless set here. A power of 2 from 512 up to
+     * FTP_STOR_RING_SIZE, effective from the next STOR.
+     * */
+    bool setStorageBlockSize(size_t blockSize);
+
+    /**
+     * @brief Passive data ports, count ports from first on
+     *
+     * Every PASV/EPSV listens on the next port of the range, a connection
+     * meant for an earlier transfer can't reach the next one. Open the range
+     * in the firewall. At least one port per session, effective from the
+     * next PASV.
+     * */
+    bool setPassivePorts(uint16_t first, uint16_t count);
+
+    /**
+     * @brief Clear all counters
+     *
+     * */
+    void resetMetrics();
+
+private:
+    friend class FtpSession;
+
+    int serviceSessions();
+    void acceptClient();
+    static void serverTask(void *pArg);
+    void wakeTransferTask();
+    static void transferTask(void *pArg);
+    const FtpMappedFile *findMappedFile(const char *path);
+    bool isWriting(const char *path);
+    uint16_t allocatePassivePort(const FtpSession *pSession);
+
+    void recordCommand(uint8_t index, uint32_t key, uint32_t micros);
+    void recordUnknownCommand();
+    void recordRefusedData();
+    void recordDataWait(uint32_t micros, bool connected);
+    void recordTransfer(bool upload, bool completed, uint32_t bytes, uint32_t storageMicros, uint32_t networkMicros);
+    void recordStoreWrites(uint32_t avoidedWrites, uint32_t partialWrites);
+
+    struct SiteEntry
+    {
+        char name[FTP_SITE_NAME_SIZE];
+        FtpSiteCallback callback;
+        void *pContext;
+    } m_siteCommands[FTP_MAX_SITE_COMMANDS];
+    uint8_t m_siteCount;
+
+    struct MappedEntry
+    {
+        String path;
+        FtpMappedFile file;
+    } m_mapped[FTP_MAX_MAPPED_FILES];
+
+    FtpListCache m_listCache; // rendered listings shared by all sessions
+    FtpHashIndex m_hashIndex; // digests of unchanged files, kept in memory and on the file system
+    FtpFileCache m_fileCache; // contents of small files, off unless enabled
+
+    FtpRateLimiter m_rateLimiter; // bandwidth cap of all transfers together
+    uint32_t m_transferRate;      // bandwidth cap of every single transfer
+    uint32_t m_rateBurst;
+
+    size_t m_storageBlock;        // STOR writes end on boundaries of this
+
+    uint16_t m_pasvFirst;         // passive port range
+    uint16_t m_pasvCount;
+    uint16_t m_pasvNext;          // offset in the range of the next passive port
+
+    portMUX_TYPE m_metricsMux;    // sessions record from handleFTP() and the transfer task
+    FtpMetrics m_metrics;
+
+    bool m_useTransferTask;           // begin() starts the transfer task
+    BaseType_t m_taskCore;
+    UBaseType_t m_taskPriority;
+    uint32_t m_taskStackSize;
+    TaskHandle_t m_transferTask;      // NULL while handleFTP() pumps the data itself
+    volatile bool m_stopTransferTask;
+
+    bool m_useServerTask;             // begin() starts the server task
+    BaseType_t m_serverTaskCore;
+    UBaseType_t m_serverTaskPriority;
+    uint32_t m_serverTaskStackSize;
+    TaskHandle_t m_serverTask;        // NULL while handleFTP() runs the server
+    volatile bool m_stopServerTask;
+    volatile int m_serverResult;      // last result of the server task, returned by handleFTP()
+
+    fs::FS *m_fs; // pointer to the used file system
+    String m_mountPoint; // VFS path of m_fs, file times are set through it
+
+    FtpListener m_commandListener;
+    FtpSession *m_pSessions[FTP_MAX_SESSIONS];
+    uint8_t m_nextSession; // session serviced first on the next handleFTP()
+
+    uint32_t millisTimeOut; // disconnect after 5 min of inactivity
     String m_User;
     String m_Password;
 };
@@ -0,0 +1,1140 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpDeflate.h"
+
+static_assert((FTP_DEFLATE_WINDOW_BITS >= 9) && (FTP_DEFLATE_WINDOW_BITS <= 15), "FTP_DEFLATE_WINDOW_BITS must be 9..15");
+static_assert(FTP_DEFLATE_OUT_SIZE >= 64, "FTP_DEFLATE_OUT_SIZE too small");
+
+#define DEFLATE_WINDOW (1UL << FTP_DEFLATE_WINDOW_BITS)
+#define DEFLATE_HASH_SIZE (1UL << FTP_DEFLATE_HASH_BITS)
+#define DEFLATE_HASH_SHIFT ((FTP_DEFLATE_HASH_BITS + 2) / 3)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_MIN_LOOKAHEAD (DEFLATE_MAX_MATCH + DEFLATE_MIN_MATCH + 1)
+#define DEFLATE_MAX_DISTANCE (DEFLATE_WINDOW - DEFLATE_MIN_LOOKAHEAD)
+#define DEFLATE_SYMBOL_BYTES 8    // output room for one coded literal or match
+
+// base values and extra bits of the length codes 257..285 and distance codes 0..29 (RFC 1951)
+static const uint16_t s_lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t s_lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t s_distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t s_distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// order the code length code lengths are sent in
+static const uint8_t s_codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// hash chain entries searched per level
+static const uint16_t s_maxChain[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+
+
+static uint32_t adler32(uint32_t adler, const uint8_t *pData, size_t length)
+{
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (length > 0)
+    {
+        // 5552 bytes are the most that can be summed before the 32 bit sums overflow
+        size_t block = (length < 5552) ? length : 5552;
+        length -= block;
+
+        while (block--)
+        {
+            a += *pData++;
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+
+FtpDeflater::FtpDeflater():
+    m_level(0),
+    m_maxChain(0),
+    m_pWindow(NULL),
+    m_pHead(NULL),
+    m_pPrev(NULL),
+    m_strStart(0),
+    m_lookahead(0),
+    m_pOut(NULL),
+    m_outLength(0),
+    m_bitBuffer(0),
+    m_bitCount(0),
+    m_adler(1),
+    m_finished(false)
+{
+
+}
+
+
+FtpDeflater::~FtpDeflater()
+{
+    end();
+}
+
+
+bool FtpDeflater::begin(uint8_t level)
+{
+    end();
+
+    m_level      = (level > 9) ? 9 : level;
+    m_maxChain   = s_maxChain[m_level];
+    m_strStart   = 0;
+    m_lookahead  = 0;
+    m_outLength  = 0;
+    m_bitBuffer  = 0;
+    m_bitCount   = 0;
+    m_adler      = 1;
+    m_finished   = false;
+
+    m_pOut = (uint8_t *)malloc(FTP_DEFLATE_OUT_SIZE);
+
+    bool result = (m_pOut != NULL);
+
+    // stored blocks need no history
+    if ((result) && (m_level > 0))
+    {
+        m_pWindow = (uint8_t *)malloc(2 * DEFLATE_WINDOW);
+        m_pHead   = (uint16_t *)calloc(DEFLATE_HASH_SIZE, sizeof(uint16_t));
+        m_pPrev   = (uint16_t *)calloc(DEFLATE_WINDOW, sizeof(uint16_t));
+
+        result = (m_pWindow) && (m_pHead) && (m_pPrev);
+    }
+
+    if (!result)
+    {
+        end();
+        return false;
+    }
+
+    // zlib header: deflate with our window size, level hint, check bits
+    uint8_t cmf = ((FTP_DEFLATE_WINDOW_BITS - 8) << 4) | 8;
+    uint8_t flg = ((m_level < 2) ? 0 : (m_level < 6) ? 1 : (m_level == 6) ? 2 : 3) << 6;
+    flg += 31 - ((cmf * 256 + flg) % 31);
+
+    m_pOut[m_outLength++] = cmf;
+    m_pOut[m_outLength++] = flg;
+
+    if (m_level > 0)
+    {
+        // one fixed Huffman block for the whole stream, finish() closes it
+        putBits(0, 1);
+        putBits(1, 2);
+    }
+
+    return true;
+}
+
+
+void FtpDeflater::end()
+{
+    free(m_pWindow);
+    free(m_pHead);
+    free(m_pPrev);
+    free(m_pOut);
+
+    m_pWindow = NULL;
+    m_pHead   = NULL;
+    m_pPrev   = NULL;
+    m_pOut    = NULL;
+    m_outLength = 0;
+}
+
+
+size_t FtpDeflater::write(const uint8_t *pData, size_t length)
+{
+    size_t taken = 0;
+
+    if ((m_pOut == NULL) || (m_finished))
+    {
+        return 0;
+    }
+
+    if (m_level == 0)
+    {
+        // header byte, LEN and NLEN in front of every stored block
+        while ((taken < length) && (m_outLength + 16 < FTP_DEFLATE_OUT_SIZE))
+        {
+            size_t block = FTP_DEFLATE_OUT_SIZE - m_outLength - 8;
+
+            if (block > 65535)
+            {
+                block = 65535;
+            }
+
+            if (block > length - taken)
+            {
+                block = length - taken;
+            }
+
+            storeBlock(pData + taken, block, false);
+            taken += block;
+        }
+    }
+    else
+    {
+        while (m_outLength + DEFLATE_SYMBOL_BYTES <= FTP_DEFLATE_OUT_SIZE)
+        {
+            if (m_strStart >= 2 * DEFLATE_WINDOW - DEFLATE_MIN_LOOKAHEAD)
+            {
+                slideWindow();
+            }
+
+            size_t space = 2 * DEFLATE_WINDOW - (m_strStart + m_lookahead);
+
+            if (space > length - taken)
+            {
+                space = length - taken;
+            }
+
+            memcpy(m_pWindow + m_strStart + m_lookahead, pData + taken, space);
+            m_lookahead += space;
+            taken       += space;
+
+            // a match may be up to DEFLATE_MAX_MATCH long, wait for more input
+            if (m_lookahead < DEFLATE_MIN_LOOKAHEAD)
+            {
+                break;
+            }
+
+            compress(false);
+        }
+    }
+
+    m_adler = adler32(m_adler, pData, taken);
+
+    return taken;
+}
+
+
+bool FtpDeflater::finish()
+{
+    if (m_finished)
+    {
+        return true;
+    }
+
+    if (m_pOut == NULL)
+    {
+        return false;
+    }
+
+    if (m_level > 0)
+    {
+        compress(true);
+
+        if (m_lookahead > 0)
+        {
+            return false;
+        }
+    }
+
+    // end of block, final block, alignment and checksum
+    if (m_outLength + 16 > FTP_DEFLATE_OUT_SIZE)
+    {
+        return false;
+    }
+
+    if (m_level > 0)
+    {
+        // close the open fixed block and append an empty final one
+        putCode(0, 7);
+        putBits(1, 1);
+        putBits(1, 2);
+        putCode(0, 7);
+        alignBits();
+    }
+    else
+    {
+        storeBlock(NULL, 0, true);
+    }
+
+    m_pOut[m_outLength++] = m_adler >> 24;
+    m_pOut[m_outLength++] = m_adler >> 16;
+    m_pOut[m_outLength++] = m_adler >> 8;
+    m_pOut[m_outLength++] = m_adler;
+
+    m_finished = true;
+    return true;
+}
+
+
+size_t FtpDeflater::output(const uint8_t **ppData)
+{
+    *ppData = m_pOut;
+    return m_outLength;
+}
+
+
+void FtpDeflater::putBits(uint32_t value, uint8_t count)
+{
+    // count is at most 16, the buffer holds less than 8 bits between calls
+    m_bitBuffer |= value << m_bitCount;
+    m_bitCount  += count;
+
+    while (m_bitCount >= 8)
+    {
+        m_pOut[m_outLength++] = m_bitBuffer;
+        m_bitBuffer >>= 8;
+        m_bitCount   -= 8;
+    }
+}
+
+
+void FtpDeflater::putCode(uint16_t code, uint8_t length)
+{
+    // Huffman codes are packed starting with their most significant bit
+    uint16_t reversed = 0;
+
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+
+    putBits(reversed, length);
+}
+
+
+void FtpDeflater::putLiteral(uint8_t value)
+{
+    if (value < 144)
+    {
+        putCode(0x30 + value, 8);
+    }
+    else
+    {
+        putCode(0x190 + value - 144, 9);
+    }
+}
+
+
+void FtpDeflater::putMatch(uint16_t length, uint16_t distance)
+{
+    uint8_t code = 28;
+
+    while (s_lengthBase[code] > length)
+    {
+        --code;
+    }
+
+    // fixed codes of the symbols 257..279 are 7 bits, 280..285 8 bits
+    uint16_t symbol = 257 + code;
+
+    if (symbol < 280)
+    {
+        putCode(symbol - 256, 7);
+    }
+    else
+    {
+        putCode(0xC0 + symbol - 280, 8);
+    }
+
+    if (s_lengthExtra[code])
+    {
+        putBits(length - s_lengthBase[code], s_lengthExtra[code]);
+    }
+
+    code = 29;
+
+    while (s_distanceBase[code] > distance)
+    {
+        --code;
+    }
+
+    putCode(code, 5);
+
+    if (s_distanceExtra[code])
+    {
+        putBits(distance - s_distanceBase[code], s_distanceExtra[code]);
+    }
+}
+
+
+void FtpDeflater::alignBits()
+{
+    if (m_bitCount > 0)
+    {
+        putBits(0, 8 - m_bitCount);
+    }
+}
+
+
+void FtpDeflater::storeBlock(const uint8_t *pData, uint16_t length, bool final)
+{
+    putBits(final ? 1 : 0, 1);
+    putBits(0, 2);
+    alignBits();
+
+    m_pOut[m_outLength++] = length;
+    m_pOut[m_outLength++] = length >> 8;
+    m_pOut[m_outLength++] = ~length;
+    m_pOut[m_outLength++] = (~length) >> 8;
+
+    if (length > 0)
+    {
+        memcpy(m_pOut + m_outLength, pData, length);
+        m_outLength += length;
+    }
+}
+
+
+void FtpDeflater::slideWindow()
+{
+    memcpy(m_pWindow, m_pWindow + DEFLATE_WINDOW, DEFLATE_WINDOW);
+    m_strStart -= DEFLATE_WINDOW;
+
+    // positions in the discarded half become "none"
+    for (uint32_t i = 0; i < DEFLATE_HASH_SIZE; ++i)
+    {
+        m_pHead[i] = (m_pHead[i] >= DEFLATE_WINDOW) ? m_pHead[i] - DEFLATE_WINDOW : 0;
+    }
+
+    for (uint32_t i = 0; i < DEFLATE_WINDOW; ++i)
+    {
+        m_pPrev[i] = (m_pPrev[i] >= DEFLATE_WINDOW) ? m_pPrev[i] - DEFLATE_WINDOW : 0;
+    }
+}
+
+
+void FtpDeflater::insertString(uint32_t pos)
+{
+    const uint8_t *p = m_pWindow + pos;
+    uint32_t hash = ((p[0] << (2 * DEFLATE_HASH_SHIFT)) ^ (p[1] << DEFLATE_HASH_SHIFT) ^ p[2]) & (DEFLATE_HASH_SIZE - 1);
+
+    m_pPrev[pos & (DEFLATE_WINDOW - 1)] = m_pHead[hash];
+    m_pHead[hash] = pos;
+}
+
+
+uint16_t FtpDeflater::longestMatch(uint32_t pos, uint16_t *pDistance)
+{
+    const uint8_t *pScan = m_pWindow + pos;
+    uint32_t hash = ((pScan[0] << (2 * DEFLATE_HASH_SHIFT)) ^ (pScan[1] << DEFLATE_HASH_SHIFT) ^ pScan[2]) & (DEFLATE_HASH_SIZE - 1);
+    uint32_t current = m_pHead[hash];
+
+    m_pPrev[pos & (DEFLATE_WINDOW - 1)] = current;
+    m_pHead[hash] = pos;
+
+    uint32_t limit = (pos > DEFLATE_MAX_DISTANCE) ? pos - DEFLATE_MAX_DISTANCE : 0;
+    uint16_t maxLength = (m_lookahead < DEFLATE_MAX_MATCH) ? m_lookahead : DEFLATE_MAX_MATCH;
+    uint16_t best = DEFLATE_MIN_MATCH - 1;
+    uint16_t chain = m_maxChain;
+
+    while ((current > limit) && (chain-- > 0))
+    {
+        const uint8_t *pMatch = m_pWindow + current;
+
+        // the byte that would make the match longer rejects most candidates
+        if ((pMatch[best] == pScan[best]) && (pMatch[0] == pScan[0]) && (pMatch[1] == pScan[1]))
+        {
+            uint16_t length = 2;
+
+            while ((length < maxLength) && (pMatch[length] == pScan[length]))
+            {
+                ++length;
+            }
+
+            if (length > best)
+            {
+                best = length;
+                *pDistance = pos - current;
+
+                if (length >= maxLength)
+                {
+                    break;
+                }
+            }
+        }
+
+        uint32_t next = m_pPrev[current & (DEFLATE_WINDOW - 1)];
+
+        if (next >= current)
+        {
+            break;
+        }
+
+        current = next;
+    }
+
+    return (best >= DEFLATE_MIN_MATCH) ? best : 0;
+}
+
+
+void FtpDeflater::compress(bool flush)
+{
+    while ((m_outLength + DEFLATE_SYMBOL_BYTES <= FTP_DEFLATE_OUT_SIZE) &&
+           (m_lookahead >= (flush ? 1 : DEFLATE_MIN_LOOKAHEAD)))
+    {
+        uint16_t length = 0;
+        uint16_t distance = 0;
+
+        if (m_lookahead >= DEFLATE_MIN_MATCH)
+        {
+            length = longestMatch(m_strStart, &distance);
+        }
+
+        if (length >= DEFLATE_MIN_MATCH)
+        {
+            putMatch(length, distance);
+
+            // index the covered positions, a later match may start there
+            uint32_t end = m_strStart + m_lookahead;
+
+            for (uint32_t pos = m_strStart + 1; (pos < m_strStart + length) && (pos + DEFLATE_MIN_MATCH <= end); ++pos)
+            {
+                insertString(pos);
+            }
+
+            m_strStart  += length;
+            m_lookahead -= length;
+        }
+        else
+        {
+            putLiteral(m_pWindow[m_strStart]);
+            ++m_strStart;
+            --m_lookahead;
+        }
+    }
+}
+
+
+FtpInflater::FtpInflater():
+    m_state(HEADER),
+    m_active(false),
+    m_final(false),
+    m_pIn(NULL),
+    m_inLength(0),
+    m_inPos(0),
+    m_bitBuffer(0),
+    m_bitCount(0),
+    m_pOut(NULL),
+    m_outSize(0),
+    m_outPos(0),
+    m_pWindow(NULL),
+    m_windowSize(0),
+    m_windowPos(0),
+    m_windowFill(0),
+    m_storedLength(0),
+    m_copyLength(0),
+    m_copyDistance(0),
+    m_lengthCount(0),
+    m_distanceCount(0),
+    m_codeCount(0),
+    m_lengthsRead(0),
+    m_adler(1)
+{
+    m_lengthCode.pSymbol   = m_lengthSymbols;
+    m_distanceCode.pSymbol = m_distanceSymbols;
+}
+
+
+FtpInflater::~FtpInflater()
+{
+    end();
+}
+
+
+void FtpInflater::begin()
+{
+    end();
+
+    m_state      = HEADER;
+    m_active     = true;
+    m_final      = false;
+    m_bitBuffer  = 0;
+    m_bitCount   = 0;
+    m_windowPos  = 0;
+    m_windowFill = 0;
+    m_copyLength = 0;
+    m_adler      = 1;
+}
+
+
+void FtpInflater::end()
+{
+    free(m_pWindow);
+    m_pWindow = NULL;
+    m_windowSize = 0;
+    m_active = false;
+}
+
+
+bool FtpInflater::needBits(uint8_t count)
+{
+    while (m_bitCount < count)
+    {
+        if (m_inPos >= m_inLength)
+        {
+            return false;
+        }
+
+        m_bitBuffer |= (uint64_t)m_pIn[m_inPos++] << m_bitCount;
+        m_bitCount  += 8;
+    }
+
+    return true;
+}
+
+
+uint32_t FtpInflater::getBits(uint8_t count)
+{
+    uint32_t value = m_bitBuffer & ((1UL << count) - 1);
+
+    m_bitBuffer >>= count;
+    m_bitCount   -= count;
+
+    return value;
+}
+
+
+// Decode the next symbol without taking its bits
+//
+// return:
+//    symbol, -1 for an invalid code, -2 if the buffered bits are not enough
+int16_t FtpInflater::decode(const Huffman &huffman, uint8_t *pLength)
+{
+    int32_t code  = 0;
+    int32_t first = 0;
+    int32_t index = 0;
+
+    for (uint8_t length = 1; length <= 15; ++length)
+    {
+        if (length > m_bitCount)
+        {
+            return -2;
+        }
+
+        code |= (m_bitBuffer >> (length - 1)) & 1;
+
+        int32_t count = huffman.count[length];
+
+        if (code - count < first)
+        {
+            *pLength = length;
+            return huffman.pSymbol[index + (code - first)];
+        }
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code  <<= 1;
+    }
+
+    return -1;
+}
+
+
+bool FtpInflater::buildTable(Huffman &huffman, const uint8_t *pLengths, uint16_t count)
+{
+    uint16_t offsets[16];
+
+    memset(huffman.count, 0, sizeof(huffman.count));
+
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        huffman.count[pLengths[i]]++;
+    }
+
+    // over-subscribed lengths can't form a prefix code, incomplete ones fail on use
+    int32_t left = 1;
+
+    for (uint8_t length = 1; length <= 15; ++length)
+    {
+        left <<= 1;
+        left -= huffman.count[length];
+
+        if (left < 0)
+        {
+            return false;
+        }
+    }
+
+    offsets[1] = 0;
+
+    for (uint8_t length = 1; length < 15; ++length)
+    {
+        offsets[length + 1] = offsets[length] + huffman.count[length];
+    }
+
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        if (pLengths[i] != 0)
+        {
+            huffman.pSymbol[offsets[pLengths[i]]++] = i;
+        }
+    }
+
+    return true;
+}
+
+
+void FtpInflater::buildFixedTables()
+{
+    uint16_t i = 0;
+
+    for (; i < 144; ++i) m_lengths[i] = 8;
+    for (; i < 256; ++i) m_lengths[i] = 9;
+    for (; i < 280; ++i) m_lengths[i] = 7;
+    for (; i < 288; ++i) m_lengths[i] = 8;
+
+    buildTable(m_lengthCode, m_lengths, 288);
+
+    for (i = 0; i < 30; ++i) m_lengths[i] = 5;
+
+    buildTable(m_distanceCode, m_lengths, 30);
+}
+
+
+void FtpInflater::putByte(uint8_t value)
+{
+    m_pOut[m_outPos++] = value;
+    m_pWindow[m_windowPos] = value;
+    m_windowPos = (m_windowPos + 1) & (m_windowSize - 1);
+
+    if (m_windowFill < m_windowSize)
+    {
+        ++m_windowFill;
+    }
+}
+
+
+FtpInflater::Status FtpInflater::inflate(const uint8_t *pIn, size_t inLength, size_t *pConsumed,
+                                         uint8_t *pOut, size_t outSize, size_t *pProduced)
+{
+    m_pIn      = pIn;
+    m_inLength = inLength;
+    m_inPos    = 0;
+    m_pOut     = pOut;
+    m_outSize  = outSize;
+    m_outPos   = 0;
+
+    size_t summed = 0;      // output already added to the checksum
+    bool blocked  = false;  // out of input or output space
+
+    while (!blocked)
+    {
+        switch (m_state)
+        {
+            case HEADER:
+            {
+                if (!needBits(16))
+                {
+                    blocked = true;
+                    break;
+                }
+
+                uint8_t cmf = getBits(8);
+                uint8_t flg = getBits(8);
+
+                // deflate only, no preset dictionary
+                if (((cmf * 256 + flg) % 31 != 0) || ((cmf & 0x0F) != 8) || ((cmf >> 4) > 7) || (flg & 0x20))
+                {
+                    m_state = ERROR_STATE;
+                    break;
+                }
+
+                m_windowSize = 1UL << ((cmf >> 4) + 8);
+                m_pWindow = (uint8_t *)malloc(m_windowSize);
+                m_state = (m_pWindow) ? BLOCK : ERROR_STATE;
+                break;
+            }
+
+            case BLOCK:
+            {
+                if (!needBits(3))
+                {
+                    blocked = true;
+                    break;
+                }
+
+                m_final = getBits(1);
+
+                switch (getBits(2))
+                {
+                    case 0:
+                        m_state = STORED_LENGTH;
+                        break;
+
+                    case 1:
+                        buildFixedTables();
+                        m_state = CODES;
+                        break;
+
+                    case 2:
+                        m_state = TABLE_COUNTS;
+                        break;
+
+                    default:
+                        m_state = ERROR_STATE;
+                        break;
+                }
+                break;
+            }
+
+            case STORED_LENGTH:
+            {
+                // stored blocks start at a byte boundary
+                getBits(m_bitCount & 7);
+
+                if (!needBits(32))
+                {
+                    blocked = true;
+                    break;
+                }
+
+                uint16_t length = getBits(16);
+                uint16_t check  = getBits(16);
+
+                if (length != (uint16_t)~check)
+                {
+                    m_state = ERROR_STATE;
+                    break;
+                }
+
+                m_storedLength = length;
+                m_state = STORED_COPY;
+                break;
+            }
+
+            case STORED_COPY:
+            {
+                while ((m_storedLength > 0) && (m_outPos < m_outSize))
+                {
+                    // whole bytes still in the bit buffer come first
+                    if (m_bitCount >= 8)
+                    {
+                        putByte(getBits(8));
+                    }
+                    else if (m_inPos < m_inLength)
+                    {
+                        putByte(m_pIn[m_inPos++]);
+                    }
+                    else
+                    {
+                        break;
+                    }
+
+                    --m_storedLength;
+                }
+
+                if (m_storedLength > 0)
+                {
+                    blocked = true;
+                }
+                else
+                {
+                    m_state = (m_final) ? CHECKSUM : BLOCK;
+                }
+                break;
+            }
+
+            case TABLE_COUNTS:
+            {
+                if (!needBits(14))
+                {
+                    blocked = true;
+                    break;
+                }
+
+                m_lengthCount   = getBits(5) + 257;
+                m_distanceCount = getBits(5) + 1;
+                m_codeCount     = getBits(4) + 4;
+                m_lengthsRead   = 0;
+
+                memset(m_lengths, 0, 19);
+
+                m_state = ((m_lengthCount > 286) || (m_distanceCount > 30)) ? ERROR_STATE : TABLE_CODE_LENGTHS;
+                break;
+            }
+
+            case TABLE_CODE_LENGTHS:
+            {
+                while ((m_lengthsRead < m_codeCount) && (needBits(3)))
+                {
+                    m_lengths[s_codeLengthOrder[m_lengthsRead++]] = getBits(3);
+                }
+
+                if (m_lengthsRead < m_codeCount)
+                {
+                    blocked = true;
+                    break;
+                }
+
+                // the code length code lives in the distance table until that is built
+                m_lengthsRead = 0;
+                m_state = (buildTable(m_distanceCode, m_lengths, 19)) ? TABLE_LENGTHS : ERROR_STATE;
+                break;
+            }
+
+            case TABLE_LENGTHS:
+            {
+                uint16_t total = m_lengthCount + m_distanceCount;
+
+                while ((m_lengthsRead < total) && (m_state == TABLE_LENGTHS))
+                {
+                    uint8_t length;
+
+                    needBits(7 + 7);
+                    int16_t symbol = decode(m_distanceCode, &length);
+
+                    if (symbol == -2)
+                    {
+                        break;
+                    }
+
+                    if (symbol < 0)
+                    {
+                        m_state = ERROR_STATE;
+                        break;
+                    }
+
+                    if (symbol < 16)
+                    {
+                        getBits(length);
+                        m_lengths[m_lengthsRead++] = symbol;
+                        continue;
+                    }
+
+                    // 16: repeat the previous length 3..6 times, 17/18: 3..10/11..138 zeros
+                    uint8_t extra = (symbol == 16) ? 2 : (symbol == 17) ? 3 : 7;
+
+                    if (length + extra > m_bitCount)
+                    {
+                        break;
+                    }
+
+                    getBits(length);
+
+                    uint16_t repeat = getBits(extra) + ((symbol == 16) ? 3 : (symbol == 17) ? 3 : 11);
+                    uint8_t value = 0;
+
+                    if (symbol == 16)
+                    {
+                        if (m_lengthsRead == 0)
+                        {
+                            m_state = ERROR_STATE;
+                            break;
+                        }
+
+                        value = m_lengths[m_lengthsRead - 1];
+                    }
+
+                    if (m_lengthsRead + repeat > total)
+                    {
+                        m_state = ERROR_STATE;
+                        break;
+                    }
+
+                    while (repeat--)
+                    {
+                        m_lengths[m_lengthsRead++] = value;
+                    }
+                }
+
+                if (m_state != TABLE_LENGTHS)
+                {
+                    break;
+                }
+
+                if (m_lengthsRead < total)
+                {
+                    blocked = true;
+                    break;
+                }
+
+                // a block without end of block code can't be decoded
+                if ((m_lengths[256] == 0) ||
+                    (!buildTable(m_lengthCode, m_lengths, m_lengthCount)) ||
+                    (!buildTable(m_distanceCode, m_lengths + m_lengthCount, m_distanceCount)))
+                {
+                    m_state = ERROR_STATE;
+                    break;
+                }
+
+                m_state = CODES;
+                break;
+            }
+
+            case CODES:
+            {
+                uint8_t length;
+
+                // room for the longest code: 15 + 5 extra + 15 + 13 extra bits
+                needBits(48);
+                int16_t symbol = decode(m_lengthCode, &length);
+
+                if (symbol == -2)
+                {
+                    blocked = true;
+                    break;
+                }
+
+                if ((symbol < 0) || (symbol > 285))
+                {
+                    m_state = ERROR_STATE;
+                    break;
+                }
+
+                if (symbol < 256)
+                {
+                    if (m_outPos >= m_outSize)
+                    {
+                        blocked = true;
+                        break;
+                    }
+
+                    getBits(length);
+                    putByte(symbol);
+                    break;
+                }
+
+                if (symbol == 256)
+                {
+                    getBits(length);
+                    m_state = (m_final) ? CHECKSUM : BLOCK;
+                    break;
+                }
+
+                // length and distance are taken together, only once all their bits arrived
+                uint8_t code  = symbol - 257;
+                uint8_t used  = length + s_lengthExtra[code];
+
+                if (used > m_bitCount)
+                {
+                    blocked = true;
+                    break;
+                }
+
+                uint16_t copyLength = s_lengthBase[code] +
+                                      ((m_bitBuffer >> length) & ((1UL << s_lengthExtra[code]) - 1));
+
+                // decode() reads from the start of the bit buffer
+                uint64_t saveBuffer = m_bitBuffer;
+                uint8_t saveCount   = m_bitCount;
+
+                m_bitBuffer >>= used;
+                m_bitCount   -= used;
+
+                uint8_t distanceLength;
+                int16_t distanceSymbol = decode(m_distanceCode, &distanceLength);
+
+                if ((distanceSymbol == -2) ||
+                    ((distanceSymbol >= 0) && (distanceSymbol < 30) &&
+                     (distanceLength + s_distanceExtra[distanceSymbol] > m_bitCount)))
+                {
+                    m_bitBuffer = saveBuffer;
+                    m_bitCount  = saveCount;
+                    blocked = true;
+                    break;
+                }
+
+                if ((distanceSymbol < 0) || (distanceSymbol >= 30))
+                {
+                    m_state = ERROR_STATE;
+                    break;
+                }
+
+                getBits(distanceLength);
+
+                uint32_t distance = s_distanceBase[distanceSymbol] + getBits(s_distanceExtra[distanceSymbol]);
+
+                if (distance > m_windowFill)
+                {
+                    m_state = ERROR_STATE;
+                    break;
+                }
+
+                m_copyLength   = copyLength;
+                m_copyDistance = distance;
+                m_state = COPY;
+                break;
+            }
+
+            case COPY:
+            {
+                while ((m_copyLength > 0) && (m_outPos < m_outSize))
+                {
+                    putByte(m_pWindow[(m_windowPos - m_copyDistance) & (m_windowSize - 1)]);
+                    --m_copyLength;
+                }
+
+                if (m_copyLength > 0)
+                {
+                    blocked = true;
+                }
+                else
+                {
+                    m_state = CODES;
+                }
+                break;
+            }
+
+            case CHECKSUM:
+            {
+                m_adler = adler32(m_adler, m_pOut + summed, m_outPos - summed);
+                summed  = m_outPos;
+
+                getBits(m_bitCount & 7);
+
+                if (!needBits(32))
+                {
+                    blocked = true;
+                    break;
+                }
+
+                uint32_t adler = getBits(8) << 24;
+                adler |= getBits(8) << 16;
+                adler |= getBits(8) << 8;
+                adler |= getBits(8);
+
+                m_state = (adler == m_adler) ? DONE_STATE : ERROR_STATE;
+                break;
+            }
+
+            default:
+                blocked = true;
+                break;
+        }
+    }
+
+    m_adler = adler32(m_adler, m_pOut + summed, m_outPos - summed);
+
+    *pConsumed = m_inPos;
+    *pProduced = m_outPos;
+
+    if (m_state == ERROR_STATE)
+    {
+        return FAILED;
+    }
+
+    return (m_state == DONE_STATE) ? DONE : MORE;
+}
@@ -0,0 +1,217 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **               ZLIB STREAMS FOR COMPRESSED TRANSFERS (MODE Z)               **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_DEFLATE_H
+#define FTP_DEFLATE_H
+
+#include <Arduino.h>
+
+#ifndef FTP_DEFLATE_WINDOW_BITS
+#define FTP_DEFLATE_WINDOW_BITS 12   // history of the compressor, 2^n bytes (9..15), memory grows with 4 * 2^n
+#endif
+#define FTP_DEFLATE_HASH_BITS 11     // hash table of the compressor, 2^n entries
+#define FTP_DEFLATE_OUT_SIZE 2048    // compressed bytes collected before they are sent
+
+/**
+ * @brief Streaming zlib compressor with bounded memory
+ *
+ * Greedy LZ77 over a small sliding window, coded with the fixed Huffman
+ * table. Level 0 only wraps the data into stored blocks, 1..9 search
+ * longer hash chains. The output is a zlib stream any inflater accepts.
+ * */
+class FtpDeflater
+{
+public:
+    FtpDeflater();
+    ~FtpDeflater();
+
+    /**
+     * @brief Allocate the window and write the zlib header
+     *
+     * */
+    bool begin(uint8_t level);
+
+    /**
+     * @brief Release all memory
+     *
+     * */
+    void end();
+
+    /**
+     * @brief Compress up to length bytes, returns how many were taken
+     *
+     * Stops early once the output buffer is full, send and drain() it
+     * before passing the rest.
+     * */
+    size_t write(const uint8_t *pData, size_t length);
+
+    /**
+     * @brief Compress the remaining input and close the stream
+     *
+     * Returns false while the output buffer is too full to complete,
+     * send and drain() it and call again.
+     * */
+    bool finish();
+
+    /**
+     * @brief Compressed bytes ready to be sent
+     *
+     * */
+    size_t output(const uint8_t **ppData);
+    void drain() { m_outLength = 0; }
+
+    bool isActive() { return m_pOut != NULL; }
+
+private:
+    void putBits(uint32_t value, uint8_t count);
+    void putCode(uint16_t code, uint8_t length);
+    void putLiteral(uint8_t value);
+    void putMatch(uint16_t length, uint16_t distance);
+    void alignBits();
+    void storeBlock(const uint8_t *pData, uint16_t length, bool final);
+    void slideWindow();
+    void insertString(uint32_t pos);
+    uint16_t longestMatch(uint32_t pos, uint16_t *pDistance);
+    void compress(bool flush);
+
+    uint8_t m_level;
+    uint16_t m_maxChain;       // hash chain entries searched for a match
+
+    uint8_t *m_pWindow;        // 2 windows, the upper half slides down when full
+    uint16_t *m_pHead;         // last position per hash, 0 is none
+    uint16_t *m_pPrev;         // previous position with the same hash
+    uint32_t m_strStart;       // next window position to code
+    uint32_t m_lookahead;      // bytes after m_strStart not coded yet
+
+    uint8_t *m_pOut;
+    size_t m_outLength;
+    uint32_t m_bitBuffer;
+    uint8_t m_bitCount;
+
+    uint32_t m_adler;
+    bool m_finished;
+};
+
+/**
+ * @brief Streaming zlib decompressor
+ *
+ * Takes the input in pieces of any size and cut at any bit, the state of
+ * a partly received code is kept in its bit buffer. The history window
+ * has the size announced in the zlib header.
+ * */
+class FtpInflater
+{
+public:
+    enum Status : int8_t
+    {
+        FAILED = -1, // corrupt stream or no memory
+        MORE   = 0,  // needs more input or more output space
+        DONE   = 1,  // stream complete and checksum verified
+    };
+
+    FtpInflater();
+    ~FtpInflater();
+
+    void begin();
+    void end();
+
+    bool isActive() { return m_active; }
+
+    /**
+     * @brief Decompress from pIn into pOut as far as both allow
+     *
+     * pConsumed and pProduced return the bytes taken and written.
+     * */
+    Status inflate(const uint8_t *pIn, size_t inLength, size_t *pConsumed,
+                   uint8_t *pOut, size_t outSize, size_t *pProduced);
+
+    bool isDone() { return m_state == DONE_STATE; }
+
+private:
+    enum State : uint8_t
+    {
+        HEADER,
+        BLOCK,
+        STORED_LENGTH,
+        STORED_COPY,
+        TABLE_COUNTS,
+        TABLE_CODE_LENGTHS,
+        TABLE_LENGTHS,
+        CODES,
+        COPY,
+        CHECKSUM,
+        DONE_STATE,
+        ERROR_STATE,
+    };
+
+    struct Huffman
+    {
+        uint16_t count[16];   // codes per length
+        uint16_t *pSymbol;    // symbols ordered by code
+    };
+
+    bool needBits(uint8_t count);
+    uint32_t getBits(uint8_t count);
+    int16_t decode(const Huffman &huffman, uint8_t *pLength);
+    bool buildTable(Huffman &huffman, const uint8_t *pLengths, uint16_t count);
+    void buildFixedTables();
+    void putByte(uint8_t value);
+
+    State m_state;
+    bool m_active;
+    bool m_final;             // current block is the last one
+
+    const uint8_t *m_pIn;     // input of the running inflate() call
+    size_t m_inLength;
+    size_t m_inPos;
+    uint64_t m_bitBuffer;     // bits taken from the input, not decoded yet
+    uint8_t m_bitCount;
+
+    uint8_t *m_pOut;          // output of the running inflate() call
+    size_t m_outSize;
+    size_t m_outPos;
+
+    uint8_t *m_pWindow;       // history for back references
+    uint32_t m_windowSize;
+    uint32_t m_windowPos;
+    uint32_t m_windowFill;
+
+    uint32_t m_storedLength;  // bytes left of a stored block
+    uint16_t m_copyLength;    // bytes left of a back reference
+    uint16_t m_copyDistance;
+
+    uint16_t m_lengthCount;   // dynamic table: literal/length codes
+    uint16_t m_distanceCount; // dynamic table: distance codes
+    uint16_t m_codeCount;     // dynamic table: code length codes
+    uint16_t m_lengthsRead;
+    uint8_t m_lengths[320];   // code lengths of the dynamic tables
+
+    uint16_t m_lengthSymbols[288];
+    uint16_t m_distanceSymbols[32];
+    Huffman m_lengthCode;
+    Huffman m_distanceCode;
+
+    uint32_t m_adler;
+};
+
+#endif // FTP_DEFLATE_H
@@ -0,0 +1,193 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpEvents.h"
+
+#ifdef ESP_PLATFORM
+#include <lwip/sockets.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+FtpListener::FtpListener():
+    m_fd(-1),
+    m_acceptedFd(-1),
+    m_port(0)
+{
+
+}
+
+
+FtpListener::~FtpListener()
+{
+    end();
+}
+
+
+bool FtpListener::begin(uint16_t port)
+{
+    end();
+
+    m_port = port;
+    m_fd   = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (m_fd < 0)
+    {
+        log_e("No socket for port %u: %d", port, errno);
+        return false;
+    }
+
+    // a port of an earlier listener may still have connections closing
+    int one = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(port);
+
+    if ((bind(m_fd, (struct sockaddr *)&address, sizeof(address)) != 0) || (listen(m_fd, FTP_LISTEN_BACKLOG) != 0))
+    {
+        log_e("Port %u can't be opened: %d", port, errno);
+        end();
+        return false;
+    }
+
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    return true;
+}
+
+
+void FtpListener::end()
+{
+    if (m_acceptedFd >= 0)
+    {
+        close(m_acceptedFd);
+        m_acceptedFd = -1;
+    }
+
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+
+bool FtpListener::hasClient()
+{
+    if ((m_acceptedFd < 0) && (m_fd >= 0))
+    {
+        m_acceptedFd = accept(m_fd, NULL, NULL);
+    }
+
+    return m_acceptedFd >= 0;
+}
+
+
+WiFiClient FtpListener::available()
+{
+    if (!hasClient())
+    {
+        return WiFiClient();
+    }
+
+    int fd = m_acceptedFd;
+    m_acceptedFd = -1;
+
+    // WiFiClient expects a blocking socket, replies and data go out without delay
+    int one = 1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+    return WiFiClient(fd);
+}
+
+
+FtpEventSet::FtpEventSet()
+{
+    clear();
+}
+
+
+void FtpEventSet::clear()
+{
+    FD_ZERO(&m_read);
+    FD_ZERO(&m_write);
+    m_maxFd   = 0;
+    m_timeout = UINT32_MAX;
+}
+
+
+void FtpEventSet::addRead(int fd)
+{
+    if ((fd >= 0) && (fd < FD_SETSIZE))
+    {
+        FD_SET(fd, &m_read);
+        m_maxFd = (fd >= m_maxFd) ? fd + 1 : m_maxFd;
+    }
+}
+
+
+void FtpEventSet::addWrite(int fd)
+{
+    if ((fd >= 0) && (fd < FD_SETSIZE))
+    {
+        FD_SET(fd, &m_write);
+        m_maxFd = (fd >= m_maxFd) ? fd + 1 : m_maxFd;
+    }
+}
+
+
+void FtpEventSet::wakeIn(uint32_t ms)
+{
+    if (ms < m_timeout)
+    {
+        m_timeout = ms;
+    }
+}
+
+
+int FtpEventSet::wait()
+{
+    struct timeval timeout;
+    timeout.tv_sec  = m_timeout / 1000;
+    timeout.tv_usec = (m_timeout % 1000) * 1000;
+
+    // no timeout set, only a socket ends the wait
+    int result = select(m_maxFd, &m_read, &m_write, NULL, (m_timeout != UINT32_MAX) ? &timeout : NULL);
+
+    if (result < 0)
+    {
+        // a socket closed by another task, the caller looks at all of them again
+        FD_ZERO(&m_read);
+        FD_ZERO(&m_write);
+        result = 0;
+    }
+
+    return result;
+}
@@ -0,0 +1,117 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                 NON-BLOCKING SOCKETS AND READINESS EVENTS                  **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_EVENTS_H
+#define FTP_EVENTS_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include <sys/select.h>
+
+#define FTP_LISTEN_BACKLOG 4   // connections the stack queues before they are accepted
+
+/**
+ * @brief Listening TCP socket on all interfaces, never blocks
+ *
+ * Like WiFiServer, but it tells its socket, so a task can sleep in
+ * select() until a client connects.
+ * */
+class FtpListener
+{
+public:
+    FtpListener();
+    ~FtpListener();
+
+    /**
+     * @brief Listen on port, a running listener is closed first
+     *
+     * */
+    bool begin(uint16_t port);
+
+    /**
+     * @brief Close the socket, connections not accepted yet are refused
+     *
+     * */
+    void end();
+
+    /**
+     * @brief Accept a waiting connection, kept until available() takes it
+     *
+     * */
+    bool hasClient();
+    WiFiClient available();
+
+    int fd() { return m_fd; }
+    uint16_t port() { return m_port; }
+    operator bool() { return m_fd >= 0; }
+
+private:
+    int m_fd;
+    int m_acceptedFd;
+    uint16_t m_port;
+};
+
+/**
+ * @brief Sockets and deadline a task waits for
+ *
+ * Collect the sockets whose readiness ends the wait, then wait() sleeps in
+ * select() until one of them is ready or the shortest timeout expired.
+ * */
+class FtpEventSet
+{
+public:
+    FtpEventSet();
+
+    void clear();
+
+    /**
+     * @brief End the wait when fd has bytes or a connection to accept / space to send
+     *
+     * Negative fds are ignored, e.g. of a closed WiFiClient.
+     * */
+    void addRead(int fd);
+    void addWrite(int fd);
+
+    /**
+     * @brief End the wait after ms at the latest, the shortest timeout wins
+     *
+     * */
+    void wakeIn(uint32_t ms);
+
+    /**
+     * @brief Sleep until an event or the timeout
+     *
+     * Returns the number of ready sockets, 0 on timeout. The sets are
+     * used up, clear() before collecting the next wait.
+     * */
+    int wait();
+
+private:
+    fd_set m_read;
+    fd_set m_write;
+    int m_maxFd;        // highest fd + 1
+    uint32_t m_timeout; // ms
+};
+
+#endif // FTP_EVENTS_H
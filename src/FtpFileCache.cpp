@@ -0,0 +1,374 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpFileCache.h"
+
+#include <esp_heap_caps.h>
+
+
+FtpFileCache::FtpFileCache():
+    m_pFs(NULL),
+    m_lock(NULL),
+    m_size(0),
+    m_maxFileSize(0),
+    m_used(0),
+    m_useCounter(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0)
+{
+    for (uint8_t i = 0; i < FTP_FILE_CACHE_ENTRIES; ++i)
+    {
+        m_entries[i].pData = NULL;
+        m_entries[i].pPath = NULL;
+        m_entries[i].size  = 0;
+        m_entries[i].pins  = 0;
+        m_entries[i].valid = false;
+    }
+}
+
+
+FtpFileCache::~FtpFileCache()
+{
+    for (uint8_t i = 0; i < FTP_FILE_CACHE_ENTRIES; ++i)
+    {
+        if (m_entries[i].pData)
+        {
+            heap_caps_free(m_entries[i].pData);
+        }
+    }
+
+    if (m_lock)
+    {
+        vSemaphoreDelete(m_lock);
+    }
+}
+
+
+void FtpFileCache::setLimits(size_t size, size_t maxFileSize)
+{
+    m_size        = size;
+    m_maxFileSize = (maxFileSize < size) ? maxFileSize : size;
+}
+
+
+bool FtpFileCache::begin(fs::FS &fs)
+{
+    m_pFs = &fs;
+
+#ifdef ESP_PLATFORM
+    // without PSRAM the files would take the internal heap the transfers need
+    if ((m_size > 0) && (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) == 0))
+    {
+        log_w("No PSRAM, file cache disabled");
+        m_size = 0;
+    }
+#endif
+
+    if ((m_size > 0) && (m_lock == NULL))
+    {
+        m_lock = xSemaphoreCreateMutex();
+    }
+
+    return (m_size == 0) || (m_lock != NULL);
+}
+
+
+const uint8_t *FtpFileCache::acquire(const char *path, size_t *pSize)
+{
+    if (!isEnabled())
+    {
+        return NULL;
+    }
+
+    const uint8_t *pData = NULL;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    Entry *pEntry = find(path);
+
+    if ((pEntry) && (!isCurrent(*pEntry)))
+    {
+        invalidate(*pEntry);
+        pEntry = NULL;
+    }
+
+    if (pEntry)
+    {
+        pEntry->lastUse = ++m_useCounter;
+        ++pEntry->pins;
+
+        *pSize = pEntry->size;
+        pData  = pEntry->pData;
+        ++m_hits;
+    }
+    else
+    {
+        ++m_misses;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return pData;
+}
+
+
+const uint8_t *FtpFileCache::load(const char *path, File &file, size_t *pSize)
+{
+    size_t size = file.size();
+    size_t pathLength = strlen(path) + 1;
+
+    if ((!isEnabled()) || (size > m_maxFileSize) || (file.isDirectory()))
+    {
+        return NULL;
+    }
+
+    // the path follows the contents in the same block
+    uint8_t *pData = (uint8_t *)heap_caps_malloc(size + pathLength, MALLOC_CAP_SPIRAM);
+
+    if (pData == NULL)
+    {
+        return NULL;
+    }
+
+    // read outside the lock, the other sessions keep being served
+    time_t lastWrite = file.getLastWrite();
+
+    if ((!file.seek(0)) || (file.read(pData, size) != size))
+    {
+        heap_caps_free(pData);
+        return NULL;
+    }
+    memcpy(pData + size, path, pathLength);
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    // another session may have loaded it meanwhile
+    Entry *pOld = find(path);
+    if (pOld)
+    {
+        invalidate(*pOld);
+    }
+
+    Entry *pEntry = NULL;
+
+    if (makeRoom(size))
+    {
+        for (uint8_t i = 0; (i < FTP_FILE_CACHE_ENTRIES) && (pEntry == NULL); ++i)
+        {
+            if (m_entries[i].pData == NULL)
+            {
+                pEntry = &m_entries[i];
+            }
+        }
+    }
+
+    if (pEntry)
+    {
+        pEntry->pData     = pData;
+        pEntry->pPath     = (const char *)pData + size;
+        pEntry->size      = size;
+        pEntry->lastWrite = lastWrite;
+        pEntry->checked   = millis();
+        pEntry->lastUse   = ++m_useCounter;
+        pEntry->pins      = 1;
+        pEntry->valid     = true;
+        m_used += size;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    if (pEntry == NULL)
+    {
+        heap_caps_free(pData);
+        return NULL;
+    }
+
+    *pSize = size;
+    return pData;
+}
+
+
+void FtpFileCache::release(const uint8_t *pData)
+{
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < FTP_FILE_CACHE_ENTRIES; ++i)
+    {
+        Entry &entry = m_entries[i];
+
+        if ((entry.pData == pData) && (entry.pins > 0))
+        {
+            // invalidated while it was sent, free it now
+            if ((--entry.pins == 0) && (!entry.valid))
+            {
+                drop(entry);
+            }
+            break;
+        }
+    }
+
+    xSemaphoreGive(m_lock);
+}
+
+
+void FtpFileCache::invalidatePath(const char *path)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    size_t length = strlen(path);
+
+    // "/" is the parent of everything
+    if ((length > 0) && (path[length - 1] == '/'))
+    {
+        --length;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < FTP_FILE_CACHE_ENTRIES; ++i)
+    {
+        Entry &entry = m_entries[i];
+
+        if ((entry.valid) && (!strncmp(entry.pPath, path, length)) &&
+            ((entry.pPath[length] == 0) || (entry.pPath[length] == '/')))
+        {
+            invalidate(entry);
+        }
+    }
+
+    xSemaphoreGive(m_lock);
+}
+
+
+uint8_t FtpFileCache::count()
+{
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < FTP_FILE_CACHE_ENTRIES; ++i)
+    {
+        if (m_entries[i].valid)
+        {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+
+FtpFileCache::Entry *FtpFileCache::find(const char *path)
+{
+    for (uint8_t i = 0; i < FTP_FILE_CACHE_ENTRIES; ++i)
+    {
+        if ((m_entries[i].valid) && (!strcmp(m_entries[i].pPath, path)))
+        {
+            return &m_entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+// Compare an entry not checked for FTP_FILE_CACHE_CHECK_TIME with its file
+bool FtpFileCache::isCurrent(Entry &entry)
+{
+    if (millis() - entry.checked < FTP_FILE_CACHE_CHECK_TIME)
+    {
+        return true;
+    }
+
+    File file = m_pFs->open(entry.pPath, "r");
+
+    bool current = (file) && (!file.isDirectory()) && (file.size() == entry.size) &&
+                   (file.getLastWrite() == entry.lastWrite);
+
+    file.close();
+
+    if (current)
+    {
+        entry.checked = millis();
+    }
+
+    return current;
+}
+
+
+// Drop the least recently used files until size more bytes and an entry are free
+bool FtpFileCache::makeRoom(size_t size)
+{
+    for (;;)
+    {
+        bool freeEntry = false;
+        Entry *pVictim = NULL;
+
+        for (uint8_t i = 0; i < FTP_FILE_CACHE_ENTRIES; ++i)
+        {
+            Entry &entry = m_entries[i];
+
+            if (entry.pData == NULL)
+            {
+                freeEntry = true;
+            }
+            else if ((entry.pins == 0) && ((pVictim == NULL) || (entry.lastUse < pVictim->lastUse)))
+            {
+                pVictim = &entry;
+            }
+        }
+
+        if ((freeEntry) && (m_used + size <= m_size))
+        {
+            return true;
+        }
+
+        // the rest is being sent
+        if (pVictim == NULL)
+        {
+            return false;
+        }
+
+        drop(*pVictim);
+        ++m_evictions;
+    }
+}
+
+
+void FtpFileCache::invalidate(Entry &entry)
+{
+    entry.valid = false;
+
+    if (entry.pins == 0)
+    {
+        drop(entry);
+    }
+}
+
+
+void FtpFileCache::drop(Entry &entry)
+{
+    heap_caps_free(entry.pData);
+    m_used -= entry.size;
+
+    entry.pData = NULL;
+    entry.pPath = NULL;
+    entry.size  = 0;
+    entry.valid = false;
+}
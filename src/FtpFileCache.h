@@ -0,0 +1,126 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                  CACHE OF SMALL FILES IN PSRAM (RETR, SIZE)                **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_FILE_CACHE_H
+#define FTP_FILE_CACHE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define FTP_FILE_CACHE_ENTRIES 16            // files kept at most
+#define FTP_FILE_CACHE_SIZE (256 * 1024)     // default bytes of all cached files together
+#define FTP_FILE_CACHE_MAX_FILE (32 * 1024)  // default size of the largest file cached
+#define FTP_FILE_CACHE_CHECK_TIME 1000       // ms a file is served before its size and time are compared again
+
+/**
+ * @brief Contents of small, often retrieved files
+ *
+ * Kept in PSRAM, shared by all sessions and keyed by path, size and
+ * modification time. The server drops an entry on every command changing
+ * the file. A change made around the server is noticed on the next use
+ * after FTP_FILE_CACHE_CHECK_TIME, the file is then compared with its
+ * entry. The least recently used files make room for new ones.
+ * */
+class FtpFileCache
+{
+public:
+    FtpFileCache();
+    ~FtpFileCache();
+
+    /**
+     * @brief Memory of all files and size of the largest one, 0 disables the cache
+     *
+     * Must be called before begin().
+     * */
+    void setLimits(size_t size, size_t maxFileSize);
+
+    bool begin(fs::FS &fs);
+
+    bool isEnabled() { return (m_size > 0) && (m_lock != NULL); }
+
+    /**
+     * @brief Pin the contents of path, NULL on a miss
+     *
+     * The bytes stay valid until release(), even if the file is
+     * invalidated meanwhile.
+     * */
+    const uint8_t *acquire(const char *path, size_t *pSize);
+
+    /**
+     * @brief Read the open file whole into the cache and pin it
+     *
+     * NULL if it is too big or there is no memory, the position of file
+     * is undefined then.
+     * */
+    const uint8_t *load(const char *path, File &file, size_t *pSize);
+
+    /**
+     * @brief Unpin contents returned by acquire() or load()
+     *
+     * */
+    void release(const uint8_t *pData);
+
+    /**
+     * @brief Forget path and everything below it
+     *
+     * */
+    void invalidatePath(const char *path);
+
+    uint32_t hits() { return m_hits; }
+    uint32_t misses() { return m_misses; }
+    uint32_t evictions() { return m_evictions; } // files dropped to make room
+    size_t used() { return m_used; }              // bytes of the cached files
+    uint8_t count();                              // cached files
+
+private:
+    struct Entry
+    {
+        uint8_t *pData;    // contents, followed by the path
+        const char *pPath;
+        size_t size;
+        time_t lastWrite;
+        uint32_t checked;  // millis() when size and time last matched the file
+        uint32_t lastUse;
+        uint8_t pins;      // sessions currently sending the data
+        bool valid;
+    };
+
+    Entry *find(const char *path);
+    bool isCurrent(Entry &entry);
+    bool makeRoom(size_t size);
+    void invalidate(Entry &entry);
+    void drop(Entry &entry);
+
+    Entry m_entries[FTP_FILE_CACHE_ENTRIES];
+    fs::FS *m_pFs;
+    SemaphoreHandle_t m_lock;
+    size_t m_size;
+    size_t m_maxFileSize;
+    size_t m_used;
+    uint32_t m_useCounter;
+    uint32_t m_hits;
+    uint32_t m_misses;
+    uint32_t m_evictions;
+};
+
+#endif // FTP_FILE_CACHE_H
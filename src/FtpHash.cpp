@@ -0,0 +1,572 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpHash.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_idf_version.h>
+
+#if ESP_IDF_VERSION_MAJOR < 5
+// mbedtls 2 names the functions returning an error code with a suffix
+#define mbedtls_md5_starts mbedtls_md5_starts_ret
+#define mbedtls_md5_update mbedtls_md5_update_ret
+#define mbedtls_md5_finish mbedtls_md5_finish_ret
+#define mbedtls_sha1_starts mbedtls_sha1_starts_ret
+#define mbedtls_sha1_update mbedtls_sha1_update_ret
+#define mbedtls_sha1_finish mbedtls_sha1_finish_ret
+#define mbedtls_sha256_starts mbedtls_sha256_starts_ret
+#define mbedtls_sha256_update mbedtls_sha256_update_ret
+#define mbedtls_sha256_finish mbedtls_sha256_finish_ret
+#endif
+#endif
+
+static const char *s_names[FtpHash::ALGORITHMS] = { "CRC32", "MD5", "SHA-1", "SHA-256" };
+
+// CRC-32 of every byte value, polynomial 0xEDB88320
+static const uint32_t s_crcTable[256] =
+{
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+    0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+    0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+    0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+    0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+    0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+    0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+    0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+    0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+    0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+    0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+    0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+    0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+    0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+    0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+    0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+    0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+    0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+    0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+    0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+    0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+    0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+};
+
+
+FtpHash::FtpHash():
+    m_algorithm(CRC32),
+    m_active(false)
+{
+    m_context.crc = 0;
+}
+
+
+FtpHash::~FtpHash()
+{
+    release();
+}
+
+
+uint32_t FtpHash::crc32(uint32_t crc, const uint8_t *pData, size_t length)
+{
+    crc = ~crc;
+
+    while (length--)
+    {
+        crc = (crc >> 8) ^ s_crcTable[(crc ^ *pData++) & 0xff];
+    }
+
+    return ~crc;
+}
+
+
+const char *FtpHash::name(Algorithm algorithm)
+{
+    return (algorithm < ALGORITHMS) ? s_names[algorithm] : "";
+}
+
+
+bool FtpHash::find(const char *name, Algorithm *pAlgorithm)
+{
+    for (uint8_t i = 0; i < ALGORITHMS; ++i)
+    {
+        if (strcasecmp(name, s_names[i]) == 0)
+        {
+            *pAlgorithm = (Algorithm)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static size_t hexString(char *pHex, const uint8_t *pDigest, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        sprintf(pHex + 2 * i, "%02x", pDigest[i]);
+    }
+
+    pHex[2 * length] = 0;
+    return 2 * length;
+}
+
+
+#ifdef ESP_PLATFORM
+
+void FtpHash::begin(Algorithm algorithm)
+{
+    release();
+
+    m_algorithm = algorithm;
+    m_active    = true;
+
+    switch (algorithm)
+    {
+    case MD5:
+        mbedtls_md5_init(&m_context.md5);
+        mbedtls_md5_starts(&m_context.md5);
+        break;
+    case SHA1:
+        mbedtls_sha1_init(&m_context.sha1);
+        mbedtls_sha1_starts(&m_context.sha1);
+        break;
+    case SHA256:
+        mbedtls_sha256_init(&m_context.sha256);
+        mbedtls_sha256_starts(&m_context.sha256, 0);
+        break;
+    default:
+        m_context.crc = 0;
+        break;
+    }
+}
+
+
+void FtpHash::update(const uint8_t *pData, size_t length)
+{
+    switch (m_algorithm)
+    {
+    case MD5:
+        mbedtls_md5_update(&m_context.md5, pData, length);
+        break;
+    case SHA1:
+        mbedtls_sha1_update(&m_context.sha1, pData, length);
+        break;
+    case SHA256:
+        mbedtls_sha256_update(&m_context.sha256, pData, length);
+        break;
+    default:
+        m_context.crc = crc32(m_context.crc, pData, length);
+        break;
+    }
+}
+
+
+size_t FtpHash::finish(char *pHex)
+{
+    uint8_t digest[32];
+    size_t length = 0;
+
+    switch (m_algorithm)
+    {
+    case MD5:
+        mbedtls_md5_finish(&m_context.md5, digest);
+        length = 16;
+        break;
+    case SHA1:
+        mbedtls_sha1_finish(&m_context.sha1, digest);
+        length = 20;
+        break;
+    case SHA256:
+        mbedtls_sha256_finish(&m_context.sha256, digest);
+        length = 32;
+        break;
+    default:
+        release();
+        return sprintf(pHex, "%08lx", (unsigned long)m_context.crc);
+    }
+
+    release();
+    return hexString(pHex, digest, length);
+}
+
+
+void FtpHash::release()
+{
+    if (m_active)
+    {
+        switch (m_algorithm)
+        {
+        case MD5:
+            mbedtls_md5_free(&m_context.md5);
+            break;
+        case SHA1:
+            mbedtls_sha1_free(&m_context.sha1);
+            break;
+        case SHA256:
+            mbedtls_sha256_free(&m_context.sha256);
+            break;
+        default:
+            break;
+        }
+        m_active = false;
+    }
+}
+
+#else // host build: portable implementations of RFC 1321 and FIPS 180-4
+
+static inline uint32_t rotateLeft(uint32_t value, uint8_t count)
+{
+    return (value << count) | (value >> (32 - count));
+}
+
+
+static inline uint32_t rotateRight(uint32_t value, uint8_t count)
+{
+    return (value >> count) | (value << (32 - count));
+}
+
+
+static inline uint32_t loadBigEndian(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static void md5Block(uint32_t *pState, const uint8_t *pBlock)
+{
+    static const uint32_t k[64] =
+    {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const uint8_t shift[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+    uint32_t m[16];
+
+    for (uint8_t i = 0; i < 16; ++i)
+    {
+        m[i] = ((uint32_t)pBlock[4 * i + 3] << 24) | ((uint32_t)pBlock[4 * i + 2] << 16) |
+               ((uint32_t)pBlock[4 * i + 1] << 8) | pBlock[4 * i];
+    }
+
+    uint32_t a = pState[0];
+    uint32_t b = pState[1];
+    uint32_t c = pState[2];
+    uint32_t d = pState[3];
+
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        uint32_t f;
+        uint8_t g;
+        uint8_t round = i / 16;
+
+        if (round == 0)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (round == 1)
+        {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if (round == 2)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+
+        uint32_t next = d;
+        d = c;
+        c = b;
+        b = b + rotateLeft(a + f + k[i] + m[g], shift[round * 4 + i % 4]);
+        a = next;
+    }
+
+    pState[0] += a;
+    pState[1] += b;
+    pState[2] += c;
+    pState[3] += d;
+}
+
+
+static void sha1Block(uint32_t *pState, const uint8_t *pBlock)
+{
+    uint32_t w[80];
+
+    for (uint8_t i = 0; i < 16; ++i)
+    {
+        w[i] = loadBigEndian(pBlock + 4 * i);
+    }
+
+    for (uint8_t i = 16; i < 80; ++i)
+    {
+        w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = pState[0];
+    uint32_t b = pState[1];
+    uint32_t c = pState[2];
+    uint32_t d = pState[3];
+    uint32_t e = pState[4];
+
+    for (uint8_t i = 0; i < 80; ++i)
+    {
+        uint32_t f;
+        uint32_t k;
+
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotateLeft(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    pState[0] += a;
+    pState[1] += b;
+    pState[2] += c;
+    pState[3] += d;
+    pState[4] += e;
+}
+
+
+static void sha256Block(uint32_t *pState, const uint8_t *pBlock)
+{
+    static const uint32_t k[64] =
+    {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    uint32_t w[64];
+
+    for (uint8_t i = 0; i < 16; ++i)
+    {
+        w[i] = loadBigEndian(pBlock + 4 * i);
+    }
+
+    for (uint8_t i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t v[8];
+    memcpy(v, pState, sizeof(v));
+
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        uint32_t s1    = rotateRight(v[4], 6) ^ rotateRight(v[4], 11) ^ rotateRight(v[4], 25);
+        uint32_t ch    = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t temp1 = v[7] + s1 + ch + k[i] + w[i];
+        uint32_t s0    = rotateRight(v[0], 2) ^ rotateRight(v[0], 13) ^ rotateRight(v[0], 22);
+        uint32_t maj   = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += temp1;
+        v[0]  = temp1 + s0 + maj;
+    }
+
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+        pState[i] += v[i];
+    }
+}
+
+
+void FtpHash::begin(Algorithm algorithm)
+{
+    static const uint32_t md5Init[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    static const uint32_t sha1Init[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    static const uint32_t sha256Init[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    m_algorithm = algorithm;
+    m_active    = true;
+
+    switch (algorithm)
+    {
+    case MD5:
+        memcpy(m_context.digest.state, md5Init, sizeof(md5Init));
+        break;
+    case SHA1:
+        memcpy(m_context.digest.state, sha1Init, sizeof(sha1Init));
+        break;
+    case SHA256:
+        memcpy(m_context.digest.state, sha256Init, sizeof(sha256Init));
+        break;
+    default:
+        m_context.crc = 0;
+        return;
+    }
+
+    m_context.digest.count = 0;
+}
+
+
+void FtpHash::update(const uint8_t *pData, size_t length)
+{
+    if (m_algorithm == CRC32)
+    {
+        m_context.crc = crc32(m_context.crc, pData, length);
+        return;
+    }
+
+    void (*process)(uint32_t *, const uint8_t *) = (m_algorithm == MD5) ? md5Block :
+                                                   (m_algorithm == SHA1) ? sha1Block : sha256Block;
+    Digest &digest = m_context.digest;
+    size_t used = digest.count % 64;
+
+    digest.count += length;
+
+    // complete the block left over from the last call
+    if (used > 0)
+    {
+        size_t take = (length < 64 - used) ? length : 64 - used;
+
+        memcpy(digest.block + used, pData, take);
+        pData  += take;
+        length -= take;
+
+        if (used + take < 64)
+        {
+            return;
+        }
+
+        process(digest.state, digest.block);
+    }
+
+    while (length >= 64)
+    {
+        process(digest.state, pData);
+        pData  += 64;
+        length -= 64;
+    }
+
+    memcpy(digest.block, pData, length);
+}
+
+
+size_t FtpHash::finish(char *pHex)
+{
+    m_active = false;
+
+    if (m_algorithm == CRC32)
+    {
+        return sprintf(pHex, "%08lx", (unsigned long)m_context.crc);
+    }
+
+    void (*process)(uint32_t *, const uint8_t *) = (m_algorithm == MD5) ? md5Block :
+                                                   (m_algorithm == SHA1) ? sha1Block : sha256Block;
+    Digest &digest = m_context.digest;
+    size_t used = digest.count % 64;
+    uint64_t bits = digest.count * 8;
+
+    // a 1 bit, zeros and the length in bits fill up the last block
+    digest.block[used++] = 0x80;
+
+    if (used > 56)
+    {
+        memset(digest.block + used, 0, 64 - used);
+        process(digest.state, digest.block);
+        used = 0;
+    }
+
+    memset(digest.block + used, 0, 56 - used);
+
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+        // MD5 is little endian, SHA big endian
+        digest.block[56 + i] = (m_algorithm == MD5) ? (uint8_t)(bits >> (8 * i)) : (uint8_t)(bits >> (56 - 8 * i));
+    }
+
+    process(digest.state, digest.block);
+
+    uint8_t words = (m_algorithm == MD5) ? 4 : (m_algorithm == SHA1) ? 5 : 8;
+    uint8_t bytes[32];
+
+    for (uint8_t i = 0; i < 4 * words; ++i)
+    {
+        uint8_t shift = (m_algorithm == MD5) ? 8 * (i % 4) : 24 - 8 * (i % 4);
+        bytes[i] = (uint8_t)(digest.state[i / 4] >> shift);
+    }
+
+    return hexString(pHex, bytes, 4 * words);
+}
+
+
+void FtpHash::release()
+{
+    m_active = false;
+}
+
+#endif // ESP_PLATFORM
@@ -0,0 +1,128 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                 STREAMING CHECKSUMS OF FILES (HASH, XCRC)                  **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_HASH_H
+#define FTP_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include <mbedtls/md5.h>
+#include <mbedtls/sha1.h>
+#include <mbedtls/sha256.h>
+#endif
+
+#define FTP_HASH_HEX_SIZE 65 // longest digest as hex string, SHA-256 and its terminator
+
+/**
+ * @brief Incremental CRC-32, MD5, SHA-1 or SHA-256 of a byte stream
+ *
+ * On the ESP32 the digests come from mbedtls, which runs SHA-1 and
+ * SHA-256 on the hardware SHA engine. A host build uses the portable
+ * implementations in FtpHash.cpp. CRC-32 is the one of zlib and is
+ * computed in software on both.
+ * */
+class FtpHash
+{
+public:
+    enum Algorithm : uint8_t
+    {
+        CRC32,
+        MD5,
+        SHA1,
+        SHA256,
+        ALGORITHMS, // number of algorithms
+    };
+
+    FtpHash();
+    ~FtpHash();
+
+    /**
+     * @brief Start a new digest, a running one is dropped
+     *
+     * */
+    void begin(Algorithm algorithm);
+
+    /**
+     * @brief Add length bytes to the digest
+     *
+     * */
+    void update(const uint8_t *pData, size_t length);
+
+    /**
+     * @brief Complete the digest and write it as lower case hex into pHex
+     *
+     * pHex needs FTP_HASH_HEX_SIZE bytes, returns the length of the string.
+     * */
+    size_t finish(char *pHex);
+
+    Algorithm algorithm() { return m_algorithm; }
+
+    /**
+     * @brief Continue the CRC-32 crc over length more bytes, start with 0
+     *
+     * */
+    static uint32_t crc32(uint32_t crc, const uint8_t *pData, size_t length);
+
+    /**
+     * @brief Name of the algorithm as registered with IANA, e.g. "SHA-256"
+     *
+     * */
+    static const char *name(Algorithm algorithm);
+
+    /**
+     * @brief Algorithm of a name, case-insensitive
+     *
+     * */
+    static bool find(const char *name, Algorithm *pAlgorithm);
+
+private:
+    void release();
+
+#ifndef ESP_PLATFORM
+    struct Digest
+    {
+        uint32_t state[8];    // MD5 uses 4 words, SHA-1 5
+        uint64_t count;       // bytes hashed
+        uint8_t block[64];    // bytes of the incomplete block
+    };
+#endif
+
+    Algorithm m_algorithm;
+    bool m_active;            // a digest context is initialized
+
+    union
+    {
+        uint32_t crc;
+#ifdef ESP_PLATFORM
+        mbedtls_md5_context md5;
+        mbedtls_sha1_context sha1;
+        mbedtls_sha256_context sha256;
+#else
+        Digest digest;
+#endif
+    } m_context;
+};
+
+#endif // FTP_HASH_H
@@ -0,0 +1,570 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpHashIndex.h"
+
+// length of the hex digest of each algorithm
+static const uint8_t s_hexLengths[FtpHash::ALGORITHMS] = { 8, 32, 40, 64 };
+
+
+FtpHashIndex::FtpHashIndex():
+    m_pFs(NULL),
+    m_lock(NULL),
+    m_pData(NULL),
+    m_length(0),
+    m_capacity(0),
+    m_dirty(false),
+    m_changeTime(0),
+    m_chunkPos(0),
+    m_chunkLength(0),
+    m_hits(0),
+    m_misses(0)
+{
+    m_path[0] = 0;
+}
+
+
+FtpHashIndex::~FtpHashIndex()
+{
+    if (m_lock)
+    {
+        vSemaphoreDelete(m_lock);
+    }
+
+    free(m_pData);
+}
+
+
+bool FtpHashIndex::begin(fs::FS &fs, const char *path)
+{
+    m_pFs = &fs;
+
+    if (strlen(path) < sizeof(m_path))
+    {
+        strcpy(m_path, path);
+    }
+    else
+    {
+        log_w("Hash index path %s too long, index disabled", path);
+        m_path[0] = 0;
+    }
+
+    if (m_lock == NULL)
+    {
+        m_lock = xSemaphoreCreateMutex();
+    }
+
+    if ((m_lock) && (m_path[0] != 0))
+    {
+        xSemaphoreTake(m_lock, portMAX_DELAY);
+        load();
+        xSemaphoreGive(m_lock);
+    }
+
+    return m_lock != NULL;
+}
+
+
+void FtpHashIndex::flush(bool force)
+{
+    if ((m_lock == NULL) || (!m_dirty))
+    {
+        return;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    if ((m_dirty) && ((force) || (millis() - m_changeTime >= FTP_HASH_INDEX_FLUSH_TIME)))
+    {
+        char tmpPath[FTP_HASH_INDEX_PATH_SIZE + 4];
+        snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", m_path);
+
+        // the copy replaces the index once it is complete
+        File tmp = m_pFs->open(tmpPath, "w");
+        bool written = (tmp) && ((m_length == 0) || (tmp.write((const uint8_t *)m_pData, m_length) == m_length));
+        tmp.close();
+
+        // rename() does not replace an existing file on every file system
+        m_pFs->remove(m_path);
+
+        if ((written) && (m_pFs->rename(tmpPath, m_path)))
+        {
+            m_dirty = false;
+        }
+        else
+        {
+            // without a file the next start begins with an empty index, never with a stale one
+            log_w("Hash index %s could not be written, trying again later", m_path);
+            m_pFs->remove(tmpPath);
+            m_changeTime = millis();
+        }
+    }
+
+    xSemaphoreGive(m_lock);
+}
+
+
+bool FtpHashIndex::isIndex(const char *path)
+{
+    size_t length = strlen(m_path);
+
+    return (length > 0) && (strncasecmp(path, m_path, length) == 0) &&
+           ((path[length] == 0) || (strcasecmp(path + length, ".tmp") == 0));
+}
+
+
+bool FtpHashIndex::lookup(const char *path, uint32_t size, time_t lastWrite, FtpHash::Algorithm algorithm, char *pHex)
+{
+    if ((m_lock == NULL) || (m_path[0] == 0))
+    {
+        return false;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    Entry entry;
+    bool found = (find(path, &entry)) && (entry.size == size) && (entry.lastWrite == (uint32_t)lastWrite) &&
+                 (entry.pDigests[algorithm] != NULL);
+
+    if (found)
+    {
+        memcpy(pHex, entry.pDigests[algorithm], s_hexLengths[algorithm]);
+        pHex[s_hexLengths[algorithm]] = 0;
+        ++m_hits;
+    }
+    else
+    {
+        ++m_misses;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return found;
+}
+
+
+void FtpHashIndex::store(const char *path, uint32_t size, time_t lastWrite, const char * const *ppDigests)
+{
+    if ((m_lock == NULL) || (m_path[0] == 0) || (isIndex(path)))
+    {
+        return;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    // digests of other algorithms stay while the file is unchanged
+    Entry entry;
+    bool known = (find(path, &entry)) && (entry.size == size) && (entry.lastWrite == (uint32_t)lastWrite);
+
+    // a path too long for a line is not indexed
+    bool formatted = format(path, size, lastWrite, ppDigests, (known) ? &entry : NULL);
+    bool removed = remove(path, false);
+
+    if (formatted)
+    {
+        append(m_newLine);
+    }
+
+    if ((formatted) || (removed))
+    {
+        changed();
+    }
+
+    xSemaphoreGive(m_lock);
+}
+
+
+void FtpHashIndex::retime(const char *path, time_t before, time_t after)
+{
+    if ((m_lock == NULL) || (m_path[0] == 0))
+    {
+        return;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    const char *none[FtpHash::ALGORITHMS] = { NULL };
+    Entry entry;
+
+    if ((find(path, &entry)) && (entry.lastWrite == (uint32_t)before))
+    {
+        // the old entry would not match any more, so it goes either way
+        bool formatted = format(path, entry.size, after, none, &entry);
+
+        remove(path, false);
+
+        if (formatted)
+        {
+            append(m_newLine);
+        }
+        changed();
+    }
+
+    xSemaphoreGive(m_lock);
+}
+
+
+void FtpHashIndex::invalidatePath(const char *path)
+{
+    if ((m_lock == NULL) || (m_path[0] == 0))
+    {
+        return;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    // most commands touch files that are not indexed, they leave the index unchanged
+    if (remove(path, true))
+    {
+        changed();
+    }
+
+    xSemaphoreGive(m_lock);
+}
+
+
+// Read the index file into memory, damaged lines are dropped
+void FtpHashIndex::load()
+{
+    m_length      = 0;
+    m_dirty       = false;
+    m_chunkPos    = 0;
+    m_chunkLength = 0;
+
+    if (!m_pFs->exists(m_path))
+    {
+        return;
+    }
+
+    File file = m_pFs->open(m_path, "r");
+
+    if ((!file) || (file.isDirectory()))
+    {
+        return;
+    }
+
+    Entry entry;
+
+    while (readLine(file))
+    {
+        if (parse(&entry))
+        {
+            size_t length = strlen(m_line);
+            m_line[length] = '\n';
+            m_line[length + 1] = 0;
+
+            append(m_line);
+        }
+    }
+
+    file.close();
+}
+
+
+// Read the next line of the index file into m_line
+//
+// A line too long for m_line comes back empty, so it fails to parse. The
+// line end is not copied, m_line keeps room for it.
+//
+// return:
+//    false at the end of the file
+bool FtpHashIndex::readLine(File &file)
+{
+    size_t length = 0;
+    bool overflow = false;
+
+    for (;;)
+    {
+        if (m_chunkPos == m_chunkLength)
+        {
+            size_t nb = file.read((uint8_t *)m_chunk, sizeof(m_chunk));
+
+            if (nb == 0)
+            {
+                break;
+            }
+
+            m_chunkPos    = 0;
+            m_chunkLength = nb;
+        }
+
+        char c = m_chunk[m_chunkPos++];
+
+        if (c == '\n')
+        {
+            m_line[overflow ? 0 : length] = 0;
+            return true;
+        }
+
+        if (length < sizeof(m_line) - 2)
+        {
+            m_line[length++] = c;
+        }
+        else
+        {
+            overflow = true;
+        }
+    }
+
+    m_line[overflow ? 0 : length] = 0;
+    return length > 0;
+}
+
+
+// Copy the line of the index in memory at *pPos into m_line, without its end
+//
+// return:
+//    false at the end of the index, else *pPos moved to the next line
+bool FtpHashIndex::nextLine(size_t *pPos)
+{
+    if (*pPos >= m_length)
+    {
+        return false;
+    }
+
+    const char *pStart = m_pData + *pPos;
+    const char *pEnd = (const char *)memchr(pStart, '\n', m_length - *pPos);
+    size_t length = (pEnd) ? pEnd - pStart : m_length - *pPos;
+
+    *pPos += length + 1;
+
+    // only lines that fit were taken in, anything else fails to parse
+    if (length >= sizeof(m_line))
+    {
+        length = 0;
+    }
+
+    memcpy(m_line, pStart, length);
+    m_line[length] = 0;
+
+    return true;
+}
+
+
+// Split m_line into its fields, the entry points into m_line
+//
+// return:
+//    false, if the line is damaged
+bool FtpHashIndex::parse(Entry *pEntry)
+{
+    const char *pField = m_line;
+    char *pEnd;
+
+    pEntry->size = strtoul(pField, &pEnd, 10);
+    if ((pEnd == pField) || (*pEnd != ' '))
+    {
+        return false;
+    }
+
+    pField = pEnd + 1;
+    pEntry->lastWrite = strtoul(pField, &pEnd, 10);
+    if ((pEnd == pField) || (*pEnd != ' '))
+    {
+        return false;
+    }
+
+    pField = pEnd + 1;
+
+    for (uint8_t i = 0; i < FtpHash::ALGORITHMS; ++i)
+    {
+        size_t length = strcspn(pField, " ");
+
+        if ((length == 1) && (pField[0] == '-'))
+        {
+            pEntry->pDigests[i] = NULL;
+        }
+        else if ((length == s_hexLengths[i]) && (strspn(pField, "0123456789abcdef") == length))
+        {
+            pEntry->pDigests[i] = pField;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (pField[length] != ' ')
+        {
+            return false;
+        }
+
+        pField += length + 1;
+    }
+
+    pEntry->pPath = pField;
+
+    return pField[0] == '/';
+}
+
+
+// Render an entry into m_newLine, digests missing in ppDigests come from pKnown
+//
+// return:
+//    false, if the entry does not fit into a line
+bool FtpHashIndex::format(const char *path, uint32_t size, time_t lastWrite, const char * const *ppDigests,
+                          const Entry *pKnown)
+{
+    size_t length = snprintf(m_newLine, sizeof(m_newLine), "%lu %lu", (unsigned long)size, (unsigned long)lastWrite);
+
+    for (uint8_t i = 0; (i < FtpHash::ALGORITHMS) && (length < sizeof(m_newLine)); ++i)
+    {
+        const char *pDigest = ppDigests[i];
+
+        if ((pDigest == NULL) && (pKnown))
+        {
+            pDigest = pKnown->pDigests[i];
+        }
+
+        if ((pDigest == NULL) || ((ppDigests[i]) && (strlen(pDigest) != s_hexLengths[i])))
+        {
+            pDigest = "-";
+        }
+
+        length += snprintf(m_newLine + length, sizeof(m_newLine) - length, " %.*s",
+                           (int)((pDigest[0] == '-') ? 1 : s_hexLengths[i]), pDigest);
+    }
+
+    if (length < sizeof(m_newLine))
+    {
+        length += snprintf(m_newLine + length, sizeof(m_newLine) - length, " %s\n", path);
+    }
+
+    return length < sizeof(m_newLine);
+}
+
+
+bool FtpHashIndex::find(const char *path, Entry *pEntry)
+{
+    size_t pos = 0;
+
+    while (nextLine(&pos))
+    {
+        if ((parse(pEntry)) && (strcmp(pEntry->pPath, path) == 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Drop the entries of path, and of everything below it if below
+//
+// return:
+//    true, if an entry was dropped
+bool FtpHashIndex::remove(const char *path, bool below)
+{
+    size_t pos = 0;
+    size_t kept = 0;
+    bool removed = false;
+
+    while (pos < m_length)
+    {
+        size_t start = pos;
+        Entry entry;
+
+        nextLine(&pos);
+
+        if ((parse(&entry)) && (matches(entry.pPath, path, below)))
+        {
+            removed = true;
+            continue;
+        }
+
+        // the lines behind a dropped one move up
+        if (kept != start)
+        {
+            memmove(m_pData + kept, m_pData + start, pos - start);
+        }
+        kept += pos - start;
+    }
+
+    m_length = kept;
+
+    return removed;
+}
+
+
+// Add a line ending in '\n' as the newest entry
+//
+// The oldest entries are dropped to stay below FTP_HASH_INDEX_MAX_SIZE, or
+// below the memory the index got.
+void FtpHashIndex::append(const char *pLine)
+{
+    size_t length = strlen(pLine);
+    size_t needed = m_length + length;
+
+    if ((needed > m_capacity) && (m_capacity < FTP_HASH_INDEX_MAX_SIZE))
+    {
+        size_t capacity = (needed + FTP_HASH_INDEX_GROW - 1) / FTP_HASH_INDEX_GROW * FTP_HASH_INDEX_GROW;
+
+        if (capacity > FTP_HASH_INDEX_MAX_SIZE)
+        {
+            capacity = FTP_HASH_INDEX_MAX_SIZE;
+        }
+
+        char *pData = (char *)realloc(m_pData, capacity);
+
+        if (pData)
+        {
+            m_pData    = pData;
+            m_capacity = capacity;
+        }
+    }
+
+    if (length > m_capacity)
+    {
+        return;
+    }
+
+    size_t drop = 0;
+
+    while (m_length - drop + length > m_capacity)
+    {
+        const char *pEnd = (const char *)memchr(m_pData + drop, '\n', m_length - drop);
+        drop = (pEnd) ? pEnd - m_pData + 1 : m_length;
+    }
+
+    if (drop > 0)
+    {
+        memmove(m_pData, m_pData + drop, m_length - drop);
+        m_length -= drop;
+    }
+
+    memcpy(m_pData + m_length, pLine, length);
+    m_length += length;
+}
+
+
+// Note a change, flush() writes it once FTP_HASH_INDEX_FLUSH_TIME passed
+void FtpHashIndex::changed()
+{
+    if (!m_dirty)
+    {
+        m_dirty      = true;
+        m_changeTime = millis();
+    }
+}
+
+
+bool FtpHashIndex::matches(const char *pEntryPath, const char *path, bool below)
+{
+    size_t length = strlen(path);
+
+    return (strcmp(pEntryPath, path) == 0) ||
+           ((below) && (strncmp(pEntryPath, path, length) == 0) && (pEntryPath[length] == '/'));
+}
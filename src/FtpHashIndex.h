@@ -0,0 +1,142 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                PERSISTENT INDEX OF FILE CHECKSUMS (HASH, XCRC)             **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_HASH_INDEX_H
+#define FTP_HASH_INDEX_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "FtpHash.h"
+
+#define FTP_HASH_INDEX_PATH "/.ftphash"  // index file on the served file system, "" disables the index
+#define FTP_HASH_INDEX_MAX_SIZE 16384    // bytes of the index, the oldest entries are dropped beyond
+#define FTP_HASH_INDEX_GROW 1024         // bytes the index in memory grows by
+#define FTP_HASH_INDEX_FLUSH_TIME 5000   // ms changes wait in memory, the uploads meanwhile share one write
+#define FTP_HASH_INDEX_LINE_SIZE 512     // longest entry, size, time, all digests and the path
+#define FTP_HASH_INDEX_PATH_SIZE 32      // max size of the name of the index file
+
+/**
+ * @brief Digests of unchanged files, kept in a small file on the served file system
+ *
+ * One line per file: size, modification time, a digest per algorithm or
+ * "-", and the path. An entry only counts while size and time still match
+ * the file, so changes made around the server invalidate it too. STOR fills
+ * it with the digests computed on the way in, the checksum commands with
+ * what they read. Shared by all sessions.
+ *
+ * The index is read at begin() and worked on in memory, flush() writes it
+ * back FTP_HASH_INDEX_FLUSH_TIME after the first change.
+ * */
+class FtpHashIndex
+{
+public:
+    FtpHashIndex();
+    ~FtpHashIndex();
+
+    bool begin(fs::FS &fs, const char *path = FTP_HASH_INDEX_PATH);
+
+    /**
+     * @brief Write the changes back once they waited FTP_HASH_INDEX_FLUSH_TIME, or now if force
+     *
+     * */
+    void flush(bool force = false);
+
+    /**
+     * @brief Digest of path with the given size and time, false if not known
+     *
+     * pHex needs FTP_HASH_HEX_SIZE bytes.
+     * */
+    bool lookup(const char *path, uint32_t size, time_t lastWrite, FtpHash::Algorithm algorithm, char *pHex);
+
+    /**
+     * @brief Remember the digests of path, ppDigests holds one per algorithm or NULL
+     *
+     * Digests already known for the same size and time are kept.
+     * */
+    void store(const char *path, uint32_t size, time_t lastWrite, const char * const *ppDigests);
+
+    /**
+     * @brief Move the entry of path to a new file time, e.g. after MFMT
+     *
+     * Only if it was taken at the old time, the content is the same.
+     * */
+    void retime(const char *path, time_t before, time_t after);
+
+    /**
+     * @brief Forget path and, if it is a directory, everything below it
+     *
+     * */
+    void invalidatePath(const char *path);
+
+    /**
+     * @brief The index file or its copy being written, clients never see them
+     *
+     * path must be normalized. The case is ignored, FAT ignores it too.
+     * */
+    bool isIndex(const char *path);
+
+    uint32_t hits() { return m_hits; }
+    uint32_t misses() { return m_misses; }
+
+private:
+    struct Entry
+    {
+        uint32_t size;
+        uint32_t lastWrite;
+        const char *pDigests[FtpHash::ALGORITHMS]; // point into m_line, NULL if unknown
+        const char *pPath;
+    };
+
+    void load();
+    bool readLine(File &file);
+    bool nextLine(size_t *pPos);
+    bool parse(Entry *pEntry);
+    bool find(const char *path, Entry *pEntry);
+    bool format(const char *path, uint32_t size, time_t lastWrite, const char * const *ppDigests, const Entry *pKnown);
+    bool remove(const char *path, bool below);
+    void append(const char *pLine);
+    void changed();
+    static bool matches(const char *pEntryPath, const char *path, bool below);
+
+    fs::FS *m_pFs;
+    char m_path[FTP_HASH_INDEX_PATH_SIZE];
+    SemaphoreHandle_t m_lock;
+
+    char *m_pData;                            // the lines of the index, oldest first
+    size_t m_length;
+    size_t m_capacity;
+    bool m_dirty;                             // m_pData differs from the file
+    uint32_t m_changeTime;                    // millis() of the first change not written yet
+
+    char m_line[FTP_HASH_INDEX_LINE_SIZE];    // line read last
+    char m_newLine[FTP_HASH_INDEX_LINE_SIZE]; // entry being stored
+    char m_chunk[256];                        // read ahead of the index file
+    size_t m_chunkPos;
+    size_t m_chunkLength;
+
+    uint32_t m_hits;
+    uint32_t m_misses;
+};
+
+#endif // FTP_HASH_INDEX_H
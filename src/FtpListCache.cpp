@@ -0,0 +1,265 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpListCache.h"
+
+
+FtpListCache::FtpListCache():
+    m_lock(NULL),
+    m_useCounter(0),
+    m_generation(0),
+    m_hits(0),
+    m_misses(0)
+{
+    for (uint8_t i = 0; i < FTP_LIST_CACHE_ENTRIES; ++i)
+    {
+        m_entries[i].pData = NULL;
+        m_entries[i].pins  = 0;
+        m_entries[i].valid = false;
+    }
+}
+
+
+FtpListCache::~FtpListCache()
+{
+    for (uint8_t i = 0; i < FTP_LIST_CACHE_ENTRIES; ++i)
+    {
+        free(m_entries[i].pData);
+    }
+
+    if (m_lock)
+    {
+        vSemaphoreDelete(m_lock);
+    }
+}
+
+
+bool FtpListCache::begin()
+{
+    if (m_lock == NULL)
+    {
+        m_lock = xSemaphoreCreateMutex();
+    }
+
+    return m_lock != NULL;
+}
+
+
+const uint8_t *FtpListCache::acquire(const char *dir, Format format, size_t *pLength, uint32_t *pCount)
+{
+    const uint8_t *pData = NULL;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < FTP_LIST_CACHE_ENTRIES; ++i)
+    {
+        Entry &entry = m_entries[i];
+
+        if ((entry.valid) && (entry.format == format) && (!strcmp(entry.dir, dir)))
+        {
+            // the directory may have changed around the server
+            if (millis() - entry.stored >= FTP_LIST_CACHE_MAX_AGE)
+            {
+                invalidate(entry);
+                break;
+            }
+
+            entry.lastUse = ++m_useCounter;
+            ++entry.pins;
+
+            *pLength = entry.length;
+            *pCount  = entry.count;
+            pData    = entry.pData;
+            break;
+        }
+    }
+
+    if (pData)
+    {
+        ++m_hits;
+    }
+    else
+    {
+        ++m_misses;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return pData;
+}
+
+
+void FtpListCache::release(const uint8_t *pData)
+{
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < FTP_LIST_CACHE_ENTRIES; ++i)
+    {
+        Entry &entry = m_entries[i];
+
+        if ((entry.pData == pData) && (entry.pins > 0))
+        {
+            // invalidated while it was sent, free it now
+            if ((--entry.pins == 0) && (!entry.valid))
+            {
+                drop(entry);
+            }
+            break;
+        }
+    }
+
+    xSemaphoreGive(m_lock);
+}
+
+
+void FtpListCache::store(const char *dir, Format format, const uint8_t *pData, size_t length, uint32_t count,
+                         uint32_t generation)
+{
+    if ((strlen(dir) >= FTP_LIST_CACHE_DIR_SIZE) || (generation != m_generation))
+    {
+        return;
+    }
+
+    uint8_t *pCopy = (uint8_t *)malloc((length > 0) ? length : 1);
+    if (pCopy == NULL)
+    {
+        return;
+    }
+    memcpy(pCopy, pData, length);
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    Entry *pVictim = NULL;
+
+    // an invalidation came while the copy was made
+    if (generation != m_generation)
+    {
+        xSemaphoreGive(m_lock);
+        free(pCopy);
+        return;
+    }
+
+    for (uint8_t i = 0; i < FTP_LIST_CACHE_ENTRIES; ++i)
+    {
+        Entry &entry = m_entries[i];
+
+        // entries still being sent are never replaced
+        if (entry.pins > 0)
+        {
+            continue;
+        }
+
+        if ((entry.valid) && (entry.format == format) && (!strcmp(entry.dir, dir)))
+        {
+            pVictim = &entry;
+            break;
+        }
+
+        // otherwise a free slot, otherwise the least recently used one
+        if ((pVictim == NULL) ||
+            ((!entry.valid) && (pVictim->valid)) ||
+            ((entry.valid == pVictim->valid) && (entry.lastUse < pVictim->lastUse)))
+        {
+            pVictim = &entry;
+        }
+    }
+
+    if (pVictim)
+    {
+        drop(*pVictim);
+
+        strcpy(pVictim->dir, dir);
+        pVictim->format  = format;
+        pVictim->pData   = pCopy;
+        pVictim->length  = length;
+        pVictim->count   = count;
+        pVictim->lastUse = ++m_useCounter;
+        pVictim->stored  = millis();
+        pVictim->valid   = true;
+        pCopy = NULL;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    free(pCopy);
+}
+
+
+void FtpListCache::invalidatePath(const char *path)
+{
+    if (m_lock == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    // walks running now must not store what they saw
+    ++m_generation;
+
+    // the directory holding the entry
+    const char *pSlash = strrchr(path, '/');
+    size_t length = (pSlash) ? pSlash - path : 0;
+
+    invalidate(path, (length > 0) ? length : 1, false);
+
+    // the entry itself and what is below it, if it is a directory
+    invalidate(path, strlen(path), true);
+
+    xSemaphoreGive(m_lock);
+}
+
+
+void FtpListCache::invalidate(Entry &entry)
+{
+    entry.valid = false;
+
+    if (entry.pins == 0)
+    {
+        drop(entry);
+    }
+}
+
+
+// Forget dir, with below also its subdirectories
+void FtpListCache::invalidate(const char *dir, size_t length, bool below)
+{
+    for (uint8_t i = 0; i < FTP_LIST_CACHE_ENTRIES; ++i)
+    {
+        Entry &entry = m_entries[i];
+
+        if ((!entry.valid) || (strncmp(entry.dir, dir, length)))
+        {
+            continue;
+        }
+
+        // "/" is the parent of everything
+        if ((entry.dir[length] == 0) ||
+            ((below) && ((entry.dir[length] == '/') || (dir[length - 1] == '/'))))
+        {
+            invalidate(entry);
+        }
+    }
+}
+
+
+void FtpListCache::drop(Entry &entry)
+{
+    free(entry.pData);
+    entry.pData = NULL;
+    entry.valid = false;
+}
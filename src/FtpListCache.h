@@ -0,0 +1,121 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                  CACHE OF RENDERED DIRECTORY LISTINGS                      **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_LIST_CACHE_H
+#define FTP_LIST_CACHE_H
+
+#include <Arduino.h>
+
+#define FTP_LIST_CACHE_ENTRIES 4      // listings kept rendered, least recently used is replaced
+#define FTP_LIST_CACHE_MAX_SIZE 8192  // bytes of the largest listing kept, bigger ones are not cached
+#define FTP_LIST_CACHE_DIR_SIZE 255 + 8 // max size of a cached directory name
+#define FTP_LIST_CACHE_MAX_AGE 2000   // ms a listing is served before the directory is walked again
+
+/**
+ * @brief Rendered LIST/MLSD/NLST bytes per directory and format
+ *
+ * Shared by all sessions. Every command changing a directory invalidates
+ * it and everything below it. A change made around the server, by the
+ * sketch or another task, shows after FTP_LIST_CACHE_MAX_AGE at the
+ * latest, older listings are walked again.
+ * */
+class FtpListCache
+{
+public:
+    enum Format : uint8_t
+    {
+        LIST,
+        MLSD,
+        NLST,
+    };
+
+    FtpListCache();
+    ~FtpListCache();
+
+    bool begin();
+
+    /**
+     * @brief Pin the listing of dir, NULL on a miss
+     *
+     * The bytes stay valid until release(), even if the directory is
+     * invalidated meanwhile.
+     * */
+    const uint8_t *acquire(const char *dir, Format format, size_t *pLength, uint32_t *pCount);
+
+    /**
+     * @brief Unpin a listing returned by acquire()
+     *
+     * */
+    void release(const uint8_t *pData);
+
+    /**
+     * @brief Keep a copy of the listing of dir
+     *
+     * generation is the one read before the walk began, a listing that
+     * overlapped an invalidation is not kept.
+     * */
+    void store(const char *dir, Format format, const uint8_t *pData, size_t length, uint32_t count,
+               uint32_t generation);
+
+    /**
+     * @brief Forget the listings of the directory containing path, of path and below it
+     *
+     * */
+    void invalidatePath(const char *path);
+
+    /**
+     * @brief Counts the invalidations, read it before walking a directory
+     *
+     * */
+    uint32_t generation() { return m_generation; }
+
+    uint32_t hits() { return m_hits; }
+    uint32_t misses() { return m_misses; }
+
+private:
+    struct Entry
+    {
+        char dir[FTP_LIST_CACHE_DIR_SIZE];
+        Format format;
+        uint8_t *pData;
+        size_t length;
+        uint32_t count;    // entries in the listing
+        uint32_t lastUse;
+        uint32_t stored;   // millis() when the directory was walked
+        uint8_t pins;      // sessions currently sending the data
+        bool valid;
+    };
+
+    void invalidate(Entry &entry);
+    void invalidate(const char *dir, size_t length, bool below);
+    void drop(Entry &entry);
+
+    Entry m_entries[FTP_LIST_CACHE_ENTRIES];
+    SemaphoreHandle_t m_lock;
+    uint32_t m_useCounter;
+    volatile uint32_t m_generation;
+    uint32_t m_hits;
+    uint32_t m_misses;
+};
+
+#endif // FTP_LIST_CACHE_H
@@ -0,0 +1,148 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpMappedFile.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_idf_version.h>
+#include <esp_partition.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+FtpMappedFile::FtpMappedFile():
+    m_pData(NULL),
+    m_size(0),
+    m_handle(0)
+{
+
+}
+
+
+FtpMappedFile::~FtpMappedFile()
+{
+    unmap();
+}
+
+
+#ifdef ESP_PLATFORM
+
+bool FtpMappedFile::map(const char *label, size_t length)
+{
+    unmap();
+
+    const esp_partition_t *pPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                 ESP_PARTITION_SUBTYPE_ANY, label);
+    if (pPartition == NULL)
+    {
+        return false;
+    }
+
+    if ((length == 0) || (length > pPartition->size))
+    {
+        length = pPartition->size;
+    }
+
+    const void *pData = NULL;
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(pPartition, 0, length, ESP_PARTITION_MMAP_DATA, &pData, &handle);
+#else
+    spi_flash_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(pPartition, 0, length, SPI_FLASH_MMAP_DATA, &pData, &handle);
+#endif
+
+    if (err != ESP_OK)
+    {
+        return false;
+    }
+
+    m_pData  = (const uint8_t *)pData;
+    m_size   = length;
+    m_handle = handle;
+    return true;
+}
+
+
+void FtpMappedFile::unmap()
+{
+    if (m_pData)
+    {
+#if ESP_IDF_VERSION_MAJOR >= 5
+        esp_partition_munmap((esp_partition_mmap_handle_t)m_handle);
+#else
+        spi_flash_munmap((spi_flash_mmap_handle_t)m_handle);
+#endif
+        m_pData = NULL;
+        m_size  = 0;
+    }
+}
+
+#else // host stand-in: the "partition" is a file mapped with mmap()
+
+bool FtpMappedFile::map(const char *label, size_t length)
+{
+    unmap();
+
+    int fd = open(label, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    if ((length == 0) || (length > (size_t)st.st_size))
+    {
+        length = st.st_size;
+    }
+
+    void *pData = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pData == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_pData = (const uint8_t *)pData;
+    m_size  = length;
+    return true;
+}
+
+
+void FtpMappedFile::unmap()
+{
+    if (m_pData)
+    {
+        munmap((void *)m_pData, m_size);
+        m_pData = NULL;
+        m_size  = 0;
+    }
+}
+
+#endif // ESP_PLATFORM
@@ -0,0 +1,65 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **              READ-ONLY FILES MAPPED FROM FLASH PARTITIONS                  **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_MAPPED_FILE_H
+#define FTP_MAPPED_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Data partition mapped into the address space
+ *
+ * On the ESP32 the partition is looked up by its label and mapped through
+ * the flash cache. On a host build the label is the path of a file that
+ * stands in for the partition and is mmap'ed read-only.
+ * */
+class FtpMappedFile
+{
+public:
+    FtpMappedFile();
+    ~FtpMappedFile();
+
+    /**
+     * @brief Map the partition, length 0 maps all of it
+     *
+     * */
+    bool map(const char *label, size_t length = 0);
+
+    /**
+     * @brief Release the mapping
+     *
+     * */
+    void unmap();
+
+    const uint8_t *data() const { return m_pData; }
+    size_t size() const { return m_size; }
+    bool isMapped() const { return m_pData != NULL; }
+
+private:
+    const uint8_t *m_pData;
+    size_t m_size;
+    uint32_t m_handle; // spi_flash_mmap_handle_t on the ESP32
+};
+
+#endif // FTP_MAPPED_FILE_H
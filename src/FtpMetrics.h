@@ -0,0 +1,78 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                        COUNTERS OF THE FTP SERVER                          **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_METRICS_H
+#define FTP_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FTP_METRICS_COMMANDS 32        // command table entries counted
+#define FTP_METRICS_LATENCY_BUCKETS 6  // handling time decades: <100us <1ms <10ms <100ms <1s >=1s
+
+/**
+ * @brief Counters of one FTP command
+ *
+ * */
+struct FtpCommandMetrics
+{
+    char name[5];
+    uint32_t count;
+    uint64_t totalMicros;                           // time spent in the handler
+    uint32_t maxMicros;
+    uint32_t latency[FTP_METRICS_LATENCY_BUCKETS];  // commands per decade of handling time
+};
+
+/**
+ * @brief Counters of the server since start or the last reset
+ *
+ * Byte counts are the bytes on the data connection, compressed ones in
+ * MODE Z. Storage and network times are summed up over all transfers, in
+ * a pipelined transfer both run in parallel.
+ * */
+struct FtpMetrics
+{
+    uint64_t bytesIn;              // received by STOR/APPE
+    uint64_t bytesOut;             // sent by RETR
+    uint32_t transfersCompleted;
+    uint32_t transfersAborted;     // ABOR, lost connections and failed writes
+    uint64_t storageMicros;        // file reads and writes of transfers
+    uint64_t networkMicros;        // socket reads and writes of transfers
+    uint32_t avoidedWrites;        // upload pieces not block aligned, collected to whole blocks
+    uint32_t partialWrites;        // upload writes not covering whole blocks, unaligned start or tail
+
+    uint32_t dataWaits;            // commands waiting for their data connection
+    uint32_t dataTimeouts;         // ... of which never got it
+    uint32_t dataRefused;          // data connections from another host than the control connection
+    uint64_t dataWaitMicros;
+    uint32_t maxDataWaitMicros;
+
+    uint32_t unknownCommands;
+    uint32_t freeHeap;             // free heap when the metrics were read
+    uint32_t minFreeHeap;          // lowest free heap since boot
+
+    uint8_t commandCount;          // used entries of commands
+    FtpCommandMetrics commands[FTP_METRICS_COMMANDS];
+};
+
+#endif // FTP_METRICS_H
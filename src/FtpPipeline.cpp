@@ -0,0 +1,414 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpPipeline.h"
+
+
+FtpRetrievePipeline::FtpRetrievePipeline():
+    m_pFile(NULL),
+    m_ppBuffers(NULL),
+    m_count(0),
+    m_size(0),
+    m_free(NULL),
+    m_filled(NULL),
+    m_done(NULL),
+    m_reader(NULL),
+    m_stop(false),
+    m_hasCurrent(false),
+    m_storageMicros(0)
+{
+
+}
+
+
+FtpRetrievePipeline::~FtpRetrievePipeline()
+{
+    end();
+}
+
+
+bool FtpRetrievePipeline::begin(File &file, uint8_t count, size_t size)
+{
+    end();
+
+    m_pFile         = &file;
+    m_count         = count;
+    m_size          = size;
+    m_stop          = false;
+    m_hasCurrent    = false;
+    m_storageMicros = 0;
+
+    m_ppBuffers = (uint8_t **)calloc(count, sizeof(uint8_t *));
+    m_free      = xQueueCreate(count, sizeof(uint8_t));
+    m_filled    = xQueueCreate(count, sizeof(Block));
+    m_done      = xSemaphoreCreateBinary();
+
+    bool result = (m_ppBuffers) && (m_free) && (m_filled) && (m_done);
+
+    for (uint8_t i = 0; (result) && (i < count); ++i)
+    {
+        m_ppBuffers[i] = (uint8_t *)malloc(size);
+
+        if (m_ppBuffers[i] == NULL)
+        {
+            result = false;
+        }
+        else
+        {
+            xQueueSend(m_free, &i, 0);
+        }
+    }
+
+    if ((result) && (xTaskCreatePinnedToCore(readerTask, "ftpReader", FTP_PIPELINE_STACK_SIZE, this,
+                                             FTP_PIPELINE_PRIORITY, &m_reader, FTP_PIPELINE_CORE) != pdPASS))
+    {
+        m_reader = NULL;
+        result   = false;
+    }
+
+    if (!result)
+    {
+        log_w("No memory for the read-ahead, using direct reads");
+        end();
+    }
+
+    return result;
+}
+
+
+void FtpRetrievePipeline::end()
+{
+    if (m_reader)
+    {
+        // the reader checks the flag at least every FTP_PIPELINE_POLL ms
+        m_stop = true;
+        xSemaphoreTake(m_done, portMAX_DELAY);
+        m_reader = NULL;
+    }
+
+    if (m_ppBuffers)
+    {
+        for (uint8_t i = 0; i < m_count; ++i)
+        {
+            free(m_ppBuffers[i]);
+        }
+        free(m_ppBuffers);
+        m_ppBuffers = NULL;
+    }
+
+    if (m_free)
+    {
+        vQueueDelete(m_free);
+        m_free = NULL;
+    }
+
+    if (m_filled)
+    {
+        vQueueDelete(m_filled);
+        m_filled = NULL;
+    }
+
+    if (m_done)
+    {
+        vSemaphoreDelete(m_done);
+        m_done = NULL;
+    }
+
+    m_hasCurrent = false;
+    m_pFile = NULL;
+}
+
+
+bool FtpRetrievePipeline::peek(const uint8_t **ppData, size_t *pLength)
+{
+    if ((!m_hasCurrent) && (xQueueReceive(m_filled, &m_current, 0) == pdTRUE))
+    {
+        m_hasCurrent = true;
+    }
+
+    if (!m_hasCurrent)
+    {
+        return false;
+    }
+
+    *ppData  = m_ppBuffers[m_current.index];
+    *pLength = (m_current.length > 0) ? m_current.length : 0;
+    return true;
+}
+
+
+void FtpRetrievePipeline::release()
+{
+    if (m_hasCurrent)
+    {
+        xQueueSend(m_free, &m_current.index, 0);
+        m_hasCurrent = false;
+    }
+}
+
+
+void FtpRetrievePipeline::readerTask(void *pArg)
+{
+    FtpRetrievePipeline *pPipe = (FtpRetrievePipeline *)pArg;
+    bool eof = false;
+
+    while ((!pPipe->m_stop) && (!eof))
+    {
+        Block block;
+
+        if (xQueueReceive(pPipe->m_free, &block.index, pdMS_TO_TICKS(FTP_PIPELINE_POLL)) != pdTRUE)
+        {
+            continue;
+        }
+
+        uint32_t start = micros();
+        int32_t nb = pPipe->m_pFile->read(pPipe->m_ppBuffers[block.index], pPipe->m_size);
+        pPipe->m_storageMicros += micros() - start;
+
+        if (nb <= 0)
+        {
+            // end of file or read error, the sender finishes the transfer
+            nb  = 0;
+            eof = true;
+        }
+
+        block.length = nb;
+        xQueueSend(pPipe->m_filled, &block, portMAX_DELAY);
+    }
+
+    // end() joins on the semaphore, also after the task is gone
+    xSemaphoreGive(pPipe->m_done);
+    vTaskDelete(NULL);
+}
+
+
+FtpStorePipeline::FtpStorePipeline():
+    m_pFile(NULL),
+    m_pRing(NULL),
+    m_size(0),
+    m_chunk(0),
+    m_head(0),
+    m_tail(0),
+    m_flush(false),
+    m_stop(false),
+    m_failed(false),
+    m_done(NULL),
+    m_writer(NULL),
+    m_fullCount(0),
+    m_maxFill(0),
+    m_storageMicros(0),
+    m_avoidedWrites(0),
+    m_partialWrites(0)
+{
+
+}
+
+
+FtpStorePipeline::~FtpStorePipeline()
+{
+    end();
+}
+
+
+bool FtpStorePipeline::begin(File &file, size_t size, size_t chunk, uint32_t offset)
+{
+    end();
+
+    m_pFile         = &file;
+    m_size          = size;
+    m_chunk         = chunk;
+    m_head          = (chunk > 0) ? offset % chunk : 0;
+    m_tail          = m_head;
+    m_flush         = false;
+    m_stop          = false;
+    m_failed        = false;
+    m_fullCount     = 0;
+    m_maxFill       = 0;
+    m_storageMicros = 0;
+    m_avoidedWrites = 0;
+    m_partialWrites = 0;
+
+    m_pRing = (uint8_t *)malloc(size);
+    m_done  = xSemaphoreCreateBinary();
+
+    bool result = (m_pRing) && (m_done) && (chunk > 0) && (size % chunk == 0);
+
+    if ((result) && (xTaskCreatePinnedToCore(writerTask, "ftpWriter", FTP_PIPELINE_STACK_SIZE, this,
+                                             FTP_PIPELINE_PRIORITY, &m_writer, FTP_PIPELINE_CORE) != pdPASS))
+    {
+        m_writer = NULL;
+        result   = false;
+    }
+
+    if (!result)
+    {
+        log_w("No memory for the store ring, using direct writes");
+        end();
+    }
+
+    return result;
+}
+
+
+bool FtpStorePipeline::finish()
+{
+    if (m_writer)
+    {
+        m_flush = true;
+        xTaskNotifyGive(m_writer);
+        xSemaphoreTake(m_done, portMAX_DELAY);
+        m_writer = NULL;
+    }
+
+    bool result = !m_failed;
+
+    end();
+
+    return result;
+}
+
+
+void FtpStorePipeline::end()
+{
+    if (m_writer)
+    {
+        m_stop = true;
+        xTaskNotifyGive(m_writer);
+        xSemaphoreTake(m_done, portMAX_DELAY);
+        m_writer = NULL;
+    }
+
+    if (m_pRing)
+    {
+        free(m_pRing);
+        m_pRing = NULL;
+    }
+
+    if (m_done)
+    {
+        vSemaphoreDelete(m_done);
+        m_done = NULL;
+    }
+
+    m_pFile = NULL;
+}
+
+
+size_t FtpStorePipeline::writable(uint8_t **ppData)
+{
+    uint32_t fill = m_head - m_tail;
+    size_t index  = m_head % m_size;
+    size_t space  = m_size - fill;
+
+    // only up to the end of the ring, the rest follows on the next call
+    if (space > m_size - index)
+    {
+        space = m_size - index;
+    }
+
+    if (space == 0)
+    {
+        ++m_fullCount;
+    }
+
+    *ppData = m_pRing + index;
+    return space;
+}
+
+
+void FtpStorePipeline::commit(size_t length)
+{
+    if ((m_head % m_chunk) || (length % m_chunk))
+    {
+        ++m_avoidedWrites;
+    }
+
+    m_head += length;
+
+    uint32_t fill = m_head - m_tail;
+
+    if (fill > m_maxFill)
+    {
+        m_maxFill = fill;
+    }
+
+    if (fill >= m_chunk)
+    {
+        xTaskNotifyGive(m_writer);
+    }
+}
+
+
+void FtpStorePipeline::writerTask(void *pArg)
+{
+    FtpStorePipeline *pPipe = (FtpStorePipeline *)pArg;
+
+    while (!pPipe->m_stop)
+    {
+        uint32_t fill  = pPipe->m_head - pPipe->m_tail;
+        size_t index   = pPipe->m_tail % pPipe->m_size;
+        size_t length  = pPipe->m_size - index;
+
+        if (length > fill)
+        {
+            length = fill;
+        }
+
+        // end on a chunk boundary of the file, the short tail is written once the transfer ended
+        size_t beyond = (pPipe->m_tail + length) % pPipe->m_chunk;
+
+        if (length > beyond)
+        {
+            length -= beyond;
+        }
+        else if (!pPipe->m_flush)
+        {
+            length = 0;
+        }
+
+        if ((length > 0) && ((pPipe->m_tail % pPipe->m_chunk) || (length % pPipe->m_chunk)))
+        {
+            ++pPipe->m_partialWrites;
+        }
+
+        if (length > 0)
+        {
+            uint32_t start = micros();
+            size_t written = pPipe->m_pFile->write(pPipe->m_pRing + index, length);
+            pPipe->m_storageMicros += micros() - start;
+
+            if (written != length)
+            {
+                log_e("Bytes written (%lu) differs from buffered bytes (%lu)", (unsigned long)written, (unsigned long)length);
+                pPipe->m_failed = true;
+            }
+
+            pPipe->m_tail += length;
+        }
+        else if (pPipe->m_flush)
+        {
+            break;
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FTP_PIPELINE_POLL));
+        }
+    }
+
+    xSemaphoreGive(pPipe->m_done);
+    vTaskDelete(NULL);
+}
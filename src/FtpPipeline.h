@@ -0,0 +1,186 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **             STORAGE PIPELINES FOR THE FTP DATA TRANSFERS                   **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_PIPELINE_H
+#define FTP_PIPELINE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define FTP_PIPELINE_CORE tskNO_AFFINITY  // core of the storage reader/writer tasks
+#define FTP_PIPELINE_PRIORITY 2           // priority of the storage reader/writer tasks
+#define FTP_PIPELINE_STACK_SIZE 4096      // stack size of the storage reader/writer tasks
+#define FTP_PIPELINE_POLL 50              // ms a storage task waits before checking for shutdown
+
+/**
+ * @brief Read-ahead for RETR
+ *
+ * A reader task fills a ring of blocks from the file while the session
+ * sends the previous block, so storage reads overlap network sends.
+ * */
+class FtpRetrievePipeline
+{
+public:
+    FtpRetrievePipeline();
+    ~FtpRetrievePipeline();
+
+    /**
+     * @brief Allocate count blocks of size bytes and start reading file
+     *
+     * */
+    bool begin(File &file, uint8_t count, size_t size);
+
+    /**
+     * @brief Stop the reader and release all blocks, statistics stay valid
+     *
+     * */
+    void end();
+
+    /**
+     * @brief Next block in file order, never waits
+     *
+     * Returns false while the reader has not filled the block yet. A length
+     * of 0 marks the end of the file.
+     * */
+    bool peek(const uint8_t **ppData, size_t *pLength);
+
+    /**
+     * @brief Hand the block returned by peek() back to the reader
+     *
+     * */
+    void release();
+
+    bool isActive() { return m_reader != NULL; }
+
+    /**
+     * @brief Time the reader spent in file reads of the last transfer
+     *
+     * */
+    uint32_t storageMicros() { return m_storageMicros; }
+
+private:
+    struct Block
+    {
+        uint8_t index;
+        int32_t length; // bytes in the block, 0 at end of file
+    };
+
+    static void readerTask(void *pArg);
+
+    File *m_pFile;
+    uint8_t **m_ppBuffers;
+    uint8_t m_count;
+    size_t m_size;
+
+    QueueHandle_t m_free;   // indexes of blocks the reader may fill
+    QueueHandle_t m_filled; // blocks ready to be sent, in file order
+    SemaphoreHandle_t m_done;
+    TaskHandle_t m_reader;
+    volatile bool m_stop;
+
+    Block m_current;       // block handed out by peek()
+    bool m_hasCurrent;
+
+    volatile uint32_t m_storageMicros;
+};
+
+/**
+ * @brief Ring buffer between the STOR socket reader and a storage writer task
+ *
+ * The session copies whatever the socket delivers into the ring, the writer
+ * drains it in writes ending on chunk boundaries of the file. The ring
+ * absorbs storage latency spikes, so the socket keeps being read and the
+ * TCP receive window stays open.
+ * */
+class FtpStorePipeline
+{
+public:
+    FtpStorePipeline();
+    ~FtpStorePipeline();
+
+    /**
+     * @brief Allocate the ring and start the writer at file position offset
+     *
+     * size must be a multiple of chunk, both powers of 2.
+     * */
+    bool begin(File &file, size_t size, size_t chunk, uint32_t offset = 0);
+
+    /**
+     * @brief Write the remaining bytes and stop the writer
+     *
+     * Returns false if the storage did not accept all bytes.
+     * */
+    bool finish();
+
+    /**
+     * @brief Stop the writer without writing the remaining bytes
+     *
+     * */
+    void end();
+
+    /**
+     * @brief Contiguous free space of the ring, 0 while the writer is behind
+     *
+     * */
+    size_t writable(uint8_t **ppData);
+
+    /**
+     * @brief Hand length bytes placed at the writable() pointer to the writer
+     *
+     * */
+    void commit(size_t length);
+
+    bool isActive() { return m_writer != NULL; }
+
+    uint32_t fullCount() { return m_fullCount; }       // socket reads skipped, ring was full
+    uint32_t maxFill() { return m_maxFill; }           // highest number of bytes waiting in the ring
+    uint32_t size() { return m_size; }
+    uint32_t storageMicros() { return m_storageMicros; } // time the writer spent in file writes
+    uint32_t avoidedWrites() { return m_avoidedWrites; } // socket reads not chunk aligned, each was a partial write before
+    uint32_t partialWrites() { return m_partialWrites; } // writes not covering whole chunks
+
+private:
+    static void writerTask(void *pArg);
+
+    File *m_pFile;
+    uint8_t *m_pRing;
+    size_t m_size;
+    size_t m_chunk;
+
+    volatile uint32_t m_head; // bytes put into the ring, starts at the file offset modulo chunk
+    volatile uint32_t m_tail; // bytes written to the file, so m_tail % m_chunk is the file position in its chunk
+    volatile bool m_flush;    // no more data, write the tail
+    volatile bool m_stop;
+    volatile bool m_failed;
+
+    SemaphoreHandle_t m_done;
+    TaskHandle_t m_writer;
+
+    uint32_t m_fullCount;
+    uint32_t m_maxFill;
+    volatile uint32_t m_storageMicros;
+    uint32_t m_avoidedWrites;
+    volatile uint32_t m_partialWrites;
+};
+
+#endif // FTP_PIPELINE_H
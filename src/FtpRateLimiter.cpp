@@ -0,0 +1,118 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpRateLimiter.h"
+
+
+FtpRateLimiter::FtpRateLimiter():
+    m_rate(0),
+    m_burst(FTP_RATE_MIN_BURST),
+    m_tokens(FTP_RATE_MIN_BURST),
+    m_lastMicros(0),
+    m_remainder(0)
+{
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    m_mux = unlocked;
+}
+
+
+void FtpRateLimiter::setRate(uint32_t rate, uint32_t burst)
+{
+    if (burst < FTP_RATE_MIN_BURST)
+    {
+        burst = FTP_RATE_MIN_BURST;
+    }
+
+    portENTER_CRITICAL(&m_mux);
+    m_rate  = rate;
+    m_burst = burst;
+    portEXIT_CRITICAL(&m_mux);
+
+    reset();
+}
+
+
+void FtpRateLimiter::reset()
+{
+    portENTER_CRITICAL(&m_mux);
+    m_tokens     = m_burst;
+    m_remainder  = 0;
+    m_lastMicros = micros();
+    portEXIT_CRITICAL(&m_mux);
+}
+
+
+size_t FtpRateLimiter::allowance(size_t wanted)
+{
+    if (m_rate == 0)
+    {
+        return wanted;
+    }
+
+    portENTER_CRITICAL(&m_mux);
+    refill();
+
+    if (wanted > m_tokens)
+    {
+        wanted = m_tokens;
+    }
+    portEXIT_CRITICAL(&m_mux);
+
+    return wanted;
+}
+
+
+void FtpRateLimiter::consume(size_t length)
+{
+    if (m_rate == 0)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&m_mux);
+    m_tokens = (length < m_tokens) ? m_tokens - length : 0;
+    portEXIT_CRITICAL(&m_mux);
+}
+
+
+// Add the tokens earned since the last refill, called in the critical section
+void FtpRateLimiter::refill()
+{
+    uint32_t now = micros();
+    uint32_t elapsed = now - m_lastMicros;
+
+    m_lastMicros = now;
+
+    // a full bucket needs at most burst / rate seconds, longer pauses only refill it
+    if ((uint64_t)elapsed * m_rate >= (uint64_t)m_burst * 1000000)
+    {
+        m_tokens    = m_burst;
+        m_remainder = 0;
+        return;
+    }
+
+    uint64_t earned = (uint64_t)elapsed * m_rate + m_remainder;
+
+    m_remainder = earned % 1000000;
+    m_tokens   += earned / 1000000;
+
+    if (m_tokens >= m_burst)
+    {
+        m_tokens    = m_burst;
+        m_remainder = 0;
+    }
+}
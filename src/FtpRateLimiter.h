@@ -0,0 +1,83 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                 TOKEN BUCKET FOR THE FTP DATA BANDWIDTH                    **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_RATE_LIMITER_H
+#define FTP_RATE_LIMITER_H
+
+#include <Arduino.h>
+
+#define FTP_RATE_MIN_BURST 1436   // smallest bucket, one TCP segment
+
+/**
+ * @brief Token bucket pacing data transfers
+ *
+ * Tokens are bytes, they flow in at the configured rate up to the burst
+ * size. Callers ask how much they may move now and never wait, a transfer
+ * getting 0 simply tries again on its next step.
+ * */
+class FtpRateLimiter
+{
+public:
+    FtpRateLimiter();
+
+    /**
+     * @brief Set rate in bytes/s (0 is unlimited) and the bucket size
+     *
+     * The bucket starts full, a burst below FTP_RATE_MIN_BURST is raised to it.
+     * */
+    void setRate(uint32_t rate, uint32_t burst);
+
+    /**
+     * @brief Bytes up to wanted that may be moved now
+     *
+     * */
+    size_t allowance(size_t wanted);
+
+    /**
+     * @brief Take length moved bytes out of the bucket
+     *
+     * */
+    void consume(size_t length);
+
+    /**
+     * @brief Refill the bucket, e.g. when a new transfer starts
+     *
+     * */
+    void reset();
+
+    uint32_t rate() { return m_rate; }
+    uint32_t burst() { return m_burst; }
+    bool isLimited() { return m_rate > 0; }
+
+private:
+    void refill();
+
+    portMUX_TYPE m_mux;      // the global bucket is shared by handleFTP() and the transfer task
+    uint32_t m_rate;         // bytes per second, 0 is unlimited
+    uint32_t m_burst;        // bucket size in bytes
+    uint32_t m_tokens;
+    uint32_t m_lastMicros;   // time of the last refill
+    uint32_t m_remainder;    // fractions of a byte carried to the next refill, in byte * us / s
+};
+
+#endif // FTP_RATE_LIMITER_H
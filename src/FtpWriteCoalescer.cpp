@@ -0,0 +1,119 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpWriteCoalescer.h"
+
+
+FtpWriteCoalescer::FtpWriteCoalescer():
+    m_pFile(NULL),
+    m_pBuffer(NULL),
+    m_capacity(0),
+    m_block(0),
+    m_position(0),
+    m_fill(0),
+    m_limit(0),
+    m_failed(false),
+    m_avoidedWrites(0),
+    m_partialWrites(0)
+{
+
+}
+
+
+void FtpWriteCoalescer::begin(File &file, uint8_t *pBuffer, size_t capacity, size_t block, uint32_t offset)
+{
+    while (block > capacity)
+    {
+        block /= 2;
+    }
+
+    m_pFile         = &file;
+    m_pBuffer       = pBuffer;
+    m_capacity      = capacity;
+    m_block         = block;
+    m_position      = offset;
+    m_fill          = 0;
+    m_failed        = false;
+    m_avoidedWrites = 0;
+    m_partialWrites = 0;
+
+    // an unaligned start fills up to the next boundary only
+    m_limit = ((offset + capacity) / block) * block - offset;
+}
+
+
+size_t FtpWriteCoalescer::writable(uint8_t **ppData)
+{
+    *ppData = m_pBuffer + m_fill;
+    return m_limit - m_fill;
+}
+
+
+void FtpWriteCoalescer::commit(size_t length)
+{
+    if (((m_position + m_fill) % m_block) || (length % m_block))
+    {
+        ++m_avoidedWrites;
+    }
+
+    m_fill += length;
+
+    if (m_fill == m_limit)
+    {
+        flush();
+
+        // from here on the buffer starts on a boundary
+        m_limit = (m_capacity / m_block) * m_block;
+    }
+}
+
+
+bool FtpWriteCoalescer::finish()
+{
+    if (m_pFile)
+    {
+        flush();
+        m_pFile = NULL;
+    }
+
+    return !m_failed;
+}
+
+
+void FtpWriteCoalescer::flush()
+{
+    if (m_fill == 0)
+    {
+        return;
+    }
+
+    if ((m_position % m_block) || (m_fill % m_block))
+    {
+        ++m_partialWrites;
+    }
+
+    size_t written = m_pFile->write(m_pBuffer, m_fill);
+
+    if (written != m_fill)
+    {
+        log_e("Bytes written (%lu) differs from buffered bytes (%lu)", (unsigned long)written, (unsigned long)m_fill);
+        m_failed = true;
+    }
+
+    m_position += m_fill;
+    m_fill = 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * FTP SERVER FOR ESP32
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*******************************************************************************
+ **                                                                            **
+ **                 BLOCK ALIGNED FILE WRITES FOR FTP UPLOADS                  **
+ **                                                                            **
+ *******************************************************************************/
+
+#ifndef FTP_WRITE_COALESCER_H
+#define FTP_WRITE_COALESCER_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+/**
+ * @brief Collects upload data in a caller's buffer and writes whole blocks
+ *
+ * Every write ends on a block boundary of the file, so the storage never
+ * has to read, modify and write back a sector or flash page. Only the
+ * first write after an unaligned start and the tail at the end are partial.
+ * */
+class FtpWriteCoalescer
+{
+public:
+    FtpWriteCoalescer();
+
+    /**
+     * @brief Start at file position offset, buffer is used until finish()
+     *
+     * A block larger than the buffer is reduced to the largest power of 2
+     * fitting into it.
+     * */
+    void begin(File &file, uint8_t *pBuffer, size_t capacity, size_t block, uint32_t offset);
+
+    /**
+     * @brief Write the remaining bytes, returns false if any write failed
+     *
+     * */
+    bool finish();
+
+    /**
+     * @brief Stop without writing the remaining bytes
+     *
+     * */
+    void end() { m_pFile = NULL; }
+
+    /**
+     * @brief Free space up to the next block boundary the buffer can hold
+     *
+     * */
+    size_t writable(uint8_t **ppData);
+
+    /**
+     * @brief Take length bytes placed at the writable() pointer, writes once full
+     *
+     * */
+    void commit(size_t length);
+
+    bool isActive() { return m_pFile != NULL; }
+
+    uint32_t avoidedWrites() { return m_avoidedWrites; } // pieces not block aligned, each was a partial write before
+    uint32_t partialWrites() { return m_partialWrites; } // writes not covering whole blocks
+    size_t block() { return m_block; }
+
+private:
+    void flush();
+
+    File *m_pFile;
+    uint8_t *m_pBuffer;
+    size_t m_capacity;
+    size_t m_block;
+    uint32_t m_position;      // file position of the first buffered byte
+    size_t m_fill;
+    size_t m_limit;           // buffered bytes reaching the last block boundary inside the buffer
+    bool m_failed;
+
+    uint32_t m_avoidedWrites;
+    uint32_t m_partialWrites;
+};
+
+#endif // FTP_WRITE_COALESCER_H